@@ -0,0 +1,22 @@
+CONFIG -= qt
+CONFIG += console
+CONFIG -= app_bundle
+
+TEMPLATE = app
+
+SOURCES += \
+    main.c \
+    ../SharedMem/sharedmem.c \
+    ../SharedMem/sharedmemtrace.c \
+    ../SharedMem/arch/sharedmemwin.c \
+    ../SharedMem/arch/sharedmemlinux.c \
+    ../SharedImage/sharedimage.c \
+    ../SharedImage/sharedimageconvert.c \
+    ../SharedImage/internal/sharedimageparallel.c
+
+win32:DEFINES += SHAREDMEM_WIN32
+linux:DEFINES += SHAREDMEM_LINUX
+unix:LIBS += -lpthread
+
+INCLUDEPATH += $$PWD/../SharedMem
+INCLUDEPATH += $$PWD/../SharedImage
@@ -0,0 +1,202 @@
+/*
+ * This file is part of SharedImageIPC.
+ *
+ * (c) Marzocchi Alessandro
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sharedimageconvert.h"
+#if defined(_WIN32)
+  #include <windows.h>
+#else
+  #include <time.h>
+#endif
+
+#define BENCHMARK_MIN_SECONDS 0.25
+
+typedef struct
+{
+  uint32_t sourceFormat;
+  uint32_t destinationFormat;
+  const char *name;
+} BenchmarkConversion;
+
+static const BenchmarkConversion conversions[]=
+{
+  {SharedImageFormatBGRA, SharedImageFormatBGRA, "BGRA repack"},
+  {SharedImageFormatBGRA, SharedImageFormatRGBA, "BGRA->RGBA"},
+  {SharedImageFormatGray16, SharedImageFormatGray8, "GRAY16->GRAY8"},
+  {SharedImageFormatGray8, SharedImageFormatBGRA, "GRAY8->BGRA"},
+  {SharedImageFormatRGB24, SharedImageFormatBGRA, "RGB24->BGRA"},
+  {SharedImageFormatBGRA, SharedImageFormatGray8, "BGRA->GRAY8"},
+  {SharedImageFormatNV12, SharedImageFormatBGRA, "NV12->BGRA"},
+  {SharedImageFormatI420, SharedImageFormatBGRA, "I420->BGRA"},
+  {SharedImageFormatYUYV, SharedImageFormatBGRA, "YUYV->BGRA"}
+};
+
+static const uint32_t sizes[][2]={{640, 480}, {1920, 1080}, {3840, 2160}};
+
+static const char *levelNames[]={"scalar", "sse2", "avx2", "avx512"};
+
+static double benchmarkSeconds(void)
+{
+#if defined(_WIN32)
+  LARGE_INTEGER counter, frequency;
+  QueryPerformanceCounter(&counter);
+  QueryPerformanceFrequency(&frequency);
+  return (double)counter.QuadPart/(double)frequency.QuadPart;
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)now.tv_sec+(double)now.tv_nsec*1e-9;
+#endif
+}
+
+// Returns milliseconds per copy, copy NULL for memcpy
+static double benchmarkCopy(void (*copy)(void *, const void *, size_t), void *destination, const void *source, size_t bytes)
+{
+  uint32_t copies=0;
+  double start=benchmarkSeconds(), elapsed;
+  do
+  {
+    if(copy)
+      copy(destination, source, bytes);
+    else
+      memcpy(destination, source, bytes);
+    copies++;
+    elapsed=benchmarkSeconds()-start;
+  }
+  while(elapsed<BENCHMARK_MIN_SECONDS);
+  return elapsed*1000.0/copies;
+}
+
+// Returns milliseconds per frame
+static double benchmarkRun(const void *source, const SharedImageSetting *sourceSetting, void *destination, const SharedImageSetting *destinationSetting)
+{
+  uint32_t frames=0;
+  double start=benchmarkSeconds(), elapsed;
+  do
+  {
+    sharedImageConvert(source, sourceSetting, destination, destinationSetting);
+    frames++;
+    elapsed=benchmarkSeconds()-start;
+  }
+  while(elapsed<BENCHMARK_MIN_SECONDS);
+  return elapsed*1000.0/frames;
+}
+
+int main(int argc, char *argv[])
+{
+  SharedImageSimdLevel maxLevel=sharedImageConvertSimdLevel();
+  (void)argc;
+  (void)argv;
+  printf("CPU level: %s\n", levelNames[maxLevel]);
+  printf("%-14s %-10s %-7s %10s %10s\n", "conversion", "size", "level", "1 thread", "threads");
+  for(size_t s=0;s<sizeof(sizes)/sizeof(sizes[0]);s++)
+  {
+    for(size_t c=0;c<sizeof(conversions)/sizeof(conversions[0]);c++)
+    {
+      SharedImageSetting sourceSetting, destinationSetting;
+      sourceSetting.width=destinationSetting.width=sizes[s][0];
+      sourceSetting.height=destinationSetting.height=sizes[s][1];
+      sourceSetting.format=conversions[c].sourceFormat;
+      destinationSetting.format=conversions[c].destinationFormat;
+      sourceSetting.bytesPerLine=sharedImageFormatMinBytesPerLine(sourceSetting.format, sourceSetting.width)+64; // Padded, like many capture devices
+      destinationSetting.bytesPerLine=sharedImageFormatMinBytesPerLine(destinationSetting.format, destinationSetting.width);
+      uint8_t *source=(uint8_t *)malloc(sharedImageFrameBytes(&sourceSetting));
+      uint8_t *destination=(uint8_t *)malloc(sharedImageFrameBytes(&destinationSetting));
+      if(source && destination)
+      {
+        for(uint64_t i=0;i<sharedImageFrameBytes(&sourceSetting);i++)
+          source[i]=(uint8_t)(i*131+(i>>12));
+        for(int level=SharedImageSimdScalar;level<=(int)maxLevel;level++)
+        {
+          double single, multi;
+          char size[16];
+          sharedImageConvertSetSimdLevel((SharedImageSimdLevel)level);
+          sharedImageConvertSetThreads(1);
+          single=benchmarkRun(source, &sourceSetting, destination, &destinationSetting);
+          sharedImageConvertSetThreads(0);
+          multi=benchmarkRun(source, &sourceSetting, destination, &destinationSetting);
+          snprintf(size, sizeof(size), "%ux%u", sizes[s][0], sizes[s][1]);
+          printf("%-14s %-10s %-7s %8.3fms %8.3fms\n", conversions[c].name, size, levelNames[level], single, multi);
+        }
+      }
+      free(source);
+      free(destination);
+    }
+  }
+  printf("\n%-10s %-7s %10s %10s\n", "pyramid", "level", "1 thread", "threads");
+  for(size_t s=0;s<sizeof(sizes)/sizeof(sizes[0]);s++)
+  {
+    SharedImagePlane levels[SHAREDIMAGE_MAX_PLANES];
+    uint32_t bytes=sizes[s][0]*sizes[s][1]*4*2;
+    uint8_t *buffer=(uint8_t *)malloc(bytes);
+    if(buffer)
+    {
+      memset(buffer, 1, bytes);
+      for(int level=SharedImageSimdScalar;level<=(int)maxLevel;level++)
+      {
+        double times[2]; // Single thread and all threads
+        char size[16];
+        sharedImageConvertSetSimdLevel((SharedImageSimdLevel)level);
+        for(int threads=0;threads<2;threads++)
+        {
+          uint32_t frames=0;
+          double start=benchmarkSeconds(), elapsed;
+          sharedImageConvertSetThreads(threads?0:1);
+          do
+          {
+            levels[0].setting.width=sizes[s][0];
+            levels[0].setting.height=sizes[s][1];
+            levels[0].setting.bytesPerLine=sizes[s][0]*4;
+            levels[0].setting.format=SharedImageFormatBGRA;
+            levels[0].offset=0;
+            sharedImageBuildPyramid(buffer, bytes, levels, SHAREDIMAGE_MAX_PLANES);
+            frames++;
+            elapsed=benchmarkSeconds()-start;
+          }
+          while(elapsed<BENCHMARK_MIN_SECONDS);
+          times[threads]=elapsed*1000.0/frames;
+        }
+        snprintf(size, sizeof(size), "%ux%u", sizes[s][0], sizes[s][1]);
+        printf("%-10s %-7s %8.3fms %8.3fms\n", size, levelNames[level], times[0], times[1]);
+      }
+    }
+    free(buffer);
+  }
+
+  printf("\n%-10s %-7s %10s %10s %10s\n", "copy", "level", "memcpy", "1 thread", "threads");
+  for(size_t s=0;s<sizeof(sizes)/sizeof(sizes[0]);s++)
+  {
+    size_t bytes=(size_t)sizes[s][0]*sizes[s][1]*4;
+    uint8_t *source=(uint8_t *)malloc(bytes);
+    uint8_t *destination=(uint8_t *)malloc(bytes);
+    if(source && destination)
+    {
+      memset(source, 1, bytes);
+      memset(destination, 0, bytes);
+      for(int level=SharedImageSimdScalar;level<=(int)maxLevel;level++)
+      {
+        double plain, single, multi;
+        char size[16];
+        sharedImageConvertSetSimdLevel((SharedImageSimdLevel)level);
+        plain=benchmarkCopy(NULL, destination, source, bytes);
+        sharedImageConvertSetThreads(1);
+        single=benchmarkCopy(sharedImageCopy, destination, source, bytes);
+        sharedImageConvertSetThreads(0);
+        multi=benchmarkCopy(sharedImageCopy, destination, source, bytes);
+        snprintf(size, sizeof(size), "%ux%u", sizes[s][0], sizes[s][1]);
+        printf("%-10s %-7s %8.3fms %8.3fms %8.3fms\n", size, levelNames[level], plain, single, multi);
+      }
+    }
+    free(source);
+    free(destination);
+  }
+  return 0;
+}
@@ -5,12 +5,22 @@ CONFIG += staticlib
 
 SOURCES += \
     sharedimage.c \
+    sharedimageconvert.c \
+    sharedimagesync.c \
+    internal/sharedimageparallel.c \
     ../SharedMem/sharedmem.c \
-    ../SharedMem/arch/sharedmemwin.c
+    ../SharedMem/sharedmemtrace.c \
+    ../SharedMem/arch/sharedmemwin.c \
+    ../SharedMem/arch/sharedmemlinux.c
 
 HEADERS += \
-    sharedimage.h
+    sharedimage.h \
+    sharedimageconvert.h \
+    sharedimagesync.h \
+    internal/sharedimageparallel.h
 
 win32:DEFINES += SHAREDMEM_WIN32
+linux:DEFINES += SHAREDMEM_LINUX
+trace:DEFINES += SHAREDMEM_TRACE
 
 INCLUDEPATH += $$PWD/../SharedMem
@@ -0,0 +1,189 @@
+/*
+ * This file is part of SharedImageIPC.
+ *
+ * (c) Marzocchi Alessandro
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#include "sharedimageparallel.h"
+#include "arch/sharedmematomic.h"
+#if defined(_WIN32)
+  #include <windows.h>
+  typedef SRWLOCK ParallelLock;
+  typedef CONDITION_VARIABLE ParallelCondition;
+  #define parallelLock(lock) AcquireSRWLockExclusive(lock)
+  #define parallelUnlock(lock) ReleaseSRWLockExclusive(lock)
+  #define parallelWait(condition, lock) SleepConditionVariableSRW(condition, lock, INFINITE, 0)
+  #define parallelWakeAll(condition) WakeAllConditionVariable(condition)
+#else
+  #include <pthread.h>
+  #include <sched.h>
+  #include <unistd.h>
+  typedef pthread_mutex_t ParallelLock;
+  typedef pthread_cond_t ParallelCondition;
+  #define parallelLock(lock) pthread_mutex_lock(lock)
+  #define parallelUnlock(lock) pthread_mutex_unlock(lock)
+  #define parallelWait(condition, lock) pthread_cond_wait(condition, lock)
+  #define parallelWakeAll(condition) pthread_cond_broadcast(condition)
+#endif
+
+#define SHAREDIMAGE_PARALLEL_MAX_THREADS 16
+
+enum
+{
+  ParallelUninitialized,
+  ParallelInitializing,
+  ParallelReady
+};
+
+static struct
+{
+  volatile uint32_t state;
+  uint32_t numWorkers;
+  ParallelLock lock;
+  ParallelCondition wake; // A job was posted
+  ParallelCondition done; // A worker left the job
+  uint32_t generation;    // Increased for each job
+  bool busy;
+  uint32_t active;        // Workers running the current job
+  SharedImageParallelFunction function;
+  void *context;
+  uint32_t numStripes;
+  volatile uint32_t nextStripe;
+} parallelPool;
+
+static void parallelWork(SharedImageParallelFunction function, void *context, uint32_t numStripes)
+{
+  for(;;)
+  {
+    uint32_t stripe=sharedMemAtomicAdd32(&parallelPool.nextStripe, 1);
+    if(stripe>=numStripes)
+      break;
+    function(context, stripe, numStripes);
+  }
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI parallelWorker(LPVOID arg)
+#else
+static void *parallelWorker(void *arg)
+#endif
+{
+  uint32_t generation=0;
+  (void)arg;
+  parallelLock(&parallelPool.lock);
+  for(;;)
+  {
+    while(generation==parallelPool.generation || !parallelPool.busy)
+    {
+      generation=parallelPool.generation;
+      parallelWait(&parallelPool.wake, &parallelPool.lock);
+    }
+    generation=parallelPool.generation;
+    SharedImageParallelFunction function=parallelPool.function;
+    void *context=parallelPool.context;
+    uint32_t numStripes=parallelPool.numStripes;
+    parallelPool.active++;
+    parallelUnlock(&parallelPool.lock);
+    parallelWork(function, context, numStripes);
+    parallelLock(&parallelPool.lock);
+    parallelPool.active--;
+    parallelWakeAll(&parallelPool.done);
+  }
+#if defined(_WIN32)
+  return 0;
+#else
+  return NULL;
+#endif
+}
+
+static void parallelInitialize(void)
+{
+  if(sharedMemAtomicCompareExchange32(&parallelPool.state, ParallelUninitialized, ParallelInitializing))
+  {
+    uint32_t numCpus;
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    numCpus=info.dwNumberOfProcessors;
+    InitializeSRWLock(&parallelPool.lock);
+    InitializeConditionVariable(&parallelPool.wake);
+    InitializeConditionVariable(&parallelPool.done);
+#else
+    long cpus=sysconf(_SC_NPROCESSORS_ONLN);
+    numCpus=(cpus>0)?(uint32_t)cpus:1;
+    pthread_mutex_init(&parallelPool.lock, NULL);
+    pthread_cond_init(&parallelPool.wake, NULL);
+    pthread_cond_init(&parallelPool.done, NULL);
+#endif
+    if(numCpus>SHAREDIMAGE_PARALLEL_MAX_THREADS)
+      numCpus=SHAREDIMAGE_PARALLEL_MAX_THREADS;
+    for(uint32_t i=1;i<numCpus;i++) // The calling thread is the last one
+    {
+#if defined(_WIN32)
+      HANDLE thread=CreateThread(NULL, 0, parallelWorker, NULL, 0, NULL);
+      if(!thread)
+        break;
+      CloseHandle(thread);
+#else
+      pthread_t thread;
+      if(pthread_create(&thread, NULL, parallelWorker, NULL)!=0)
+        break;
+      pthread_detach(thread);
+#endif
+      parallelPool.numWorkers++;
+    }
+    sharedMemAtomicStore32(&parallelPool.state, ParallelReady);
+  }
+  while(sharedMemAtomicLoad32(&parallelPool.state)!=ParallelReady)
+  {
+#if defined(_WIN32)
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+  }
+}
+
+uint32_t sharedImageParallelThreads(void)
+{
+  parallelInitialize();
+  return parallelPool.numWorkers+1;
+}
+
+void sharedImageParallelRun(SharedImageParallelFunction function, void *context, uint32_t numStripes)
+{
+  bool pooled=false;
+  if(numStripes>1)
+  {
+    parallelInitialize();
+    parallelLock(&parallelPool.lock);
+    if(!parallelPool.busy && parallelPool.numWorkers)
+    {
+      pooled=parallelPool.busy=true;
+      parallelPool.function=function;
+      parallelPool.context=context;
+      parallelPool.numStripes=numStripes;
+      sharedMemAtomicStore32(&parallelPool.nextStripe, 0);
+      parallelPool.generation++;
+      parallelWakeAll(&parallelPool.wake);
+    }
+    parallelUnlock(&parallelPool.lock);
+  }
+  if(pooled)
+  {
+    parallelWork(function, context, numStripes);
+    parallelLock(&parallelPool.lock);
+    while(parallelPool.active) // Stripes are all taken, waits the ones still running
+      parallelWait(&parallelPool.done, &parallelPool.lock);
+    parallelPool.busy=false;
+    parallelUnlock(&parallelPool.lock);
+  }
+  else
+  {
+    for(uint32_t stripe=0;stripe<numStripes;stripe++)
+      function(context, stripe, numStripes);
+  }
+}
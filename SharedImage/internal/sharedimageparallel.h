@@ -0,0 +1,26 @@
+/*
+ * This file is part of SharedImageIPC.
+ *
+ * (c) Marzocchi Alessandro
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+/*
+ * Process-wide worker pool used to split large image operations in horizontal stripes.
+ * Workers are created on first use and live until the process exits.
+ * Only one job runs at a time: a call made while the pool is busy runs all the stripes in the calling thread.
+ */
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+/// Processes one stripe of a job, stripes are numbered from 0 to numStripes-1
+typedef void (*SharedImageParallelFunction)(void *context, uint32_t stripe, uint32_t numStripes);
+
+/// Returns the number of threads that can run a job (workers plus the calling thread)
+uint32_t sharedImageParallelThreads(void);
+
+/// Runs function on numStripes stripes, the calling thread takes part; returns when all stripes are done
+void sharedImageParallelRun(SharedImageParallelFunction function, void *context, uint32_t numStripes);
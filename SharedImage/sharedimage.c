@@ -9,27 +9,104 @@
 
 #include "sharedimage.h"
 #include "sharedmem.h"
+#include "sharedmemtrace.h"
+#include "arch/sharedmematomic.h"
 #include <stdio.h>
 #include <string.h>
+#if defined(_WIN32)
+  #include <windows.h>
+  #define sharedImageYield() SwitchToThread()
+#else
+  #include <sched.h>
+  #define sharedImageYield() sched_yield()
+#endif
+
+#define SHAREDIMAGE_DIRTY_HISTORY 8 // Frames whose dirty rectangles are remembered by the generator
+#define SHAREDIMAGE_METADATA_ALIGN 8
+
+typedef struct
+{
+  uint64_t sequence;
+  uint32_t numRects; // 0 if the whole frame changed
+  SharedImageRect rects[SHAREDIMAGE_MAX_DIRTY_RECTS];
+} SharedImageDirtyHistory;
 
 typedef struct
 {
   bool initialized;
   bool valid;
   int32_t lastPage;
+  int32_t backPage; // Triple buffer mode, page written by generator
+  int32_t previousPage; // Generator, page of the last sent frame
+  bool previousReceived; // Consumer, previousSequence is valid
+  uint64_t previousSequence; // Consumer, sequence of the frame received before the current one
+  SharedImageDirtyHistory history[SHAREDIMAGE_DIRTY_HISTORY]; // Generator, indexed by sequence
+  uint64_t lastSendUs; // Generator, timestamp of the last sent frame
+  bool attached; // Consumer, counted in consumers of the header
+  uint32_t preferenceSeen; // Generator, preferenceSequence of the last read preference
+  uint32_t roisSeen; // Generator, roiSequence of the last read regions of interest
+  uint32_t maxLeases; // Consumer, 0 for the default
+  volatile uint32_t numLeases; // Consumer, leases not yet released, decreased from any thread
+  SharedImageSetting stripeSetting; // Generator, frame filled by stripes
+  uint32_t numStripes;
+  volatile uint32_t stripesPending; // Generator, stripes not yet done, the thread bringing it to 0 sends the frame
+  int32_t streamPage; // Generator, page sent with sharedImageSendPartial and still being written
 }SharedImageLocal;
 typedef struct
 {
   uint32_t magic;
   uint32_t version;
+  uint32_t mode;
+  uint32_t triple; // Triple buffer mode, index of the middle page and SHAREDIMAGE_TRIPLE_FRESH
+  uint64_t nextSequence; // Written only by generator
+  uint32_t requests; // Frame requests posted by the consumer
+  uint32_t servedRequests; // Value of requests when the generator sent the last frame
+  uint64_t requestNotBeforeUs; // Oldest timestamp of a frame satisfying the last request, written before requests
+  uint32_t consumers; // Attached consumers
+  uint32_t preferenceSequence; // Increased by two for each published preference, odd while the consumer writes it
+  uint64_t consumerActivityUs; // Timestamp of the last receive or request of a consumer
+  SharedImagePreference preference; // Written only by consumers
+  uint32_t roiSequence; // Same as preferenceSequence, for rois
+  uint32_t numRois;
+  SharedImageRect rois[SHAREDIMAGE_MAX_ROIS]; // Written only by consumers
 } SharedImageHeader;
 typedef struct
 {
-  SharedImageSetting setting;
+  SharedImageSetting setting; // Same as the first plane
+  SharedImageFrameInfo info;
+  uint32_t numDirtyRects; // Changed regions from the previous frame, 0 if the whole frame changed
+  uint32_t numPlanes;
+  SharedImageRect dirtyRects[SHAREDIMAGE_MAX_DIRTY_RECTS];
+  SharedImagePlane planes[SHAREDIMAGE_MAX_PLANES];
+  uint32_t metadataBytes; // Used bytes of the metadata area following this header
+  uint32_t numLevels; // Planes after the first one that are downscaled copies of it
+  uint32_t rowsDone; // Rows already written, less than the height while a partial frame is being written
+  uint32_t pageSequence; // Odd while the generator writes the page, increased again when the frame is complete, 0 if never sent
 } SharedImagePageHeader;
 
 #define SHAREDMEMIMAGE_MAGIC 0x41B0D34A
-#define SHAREDMEMIMAGE_VERSION 0x100
+#define SHAREDMEMIMAGE_VERSION 0x10E
+#define SHAREDIMAGE_DEFAULT_BUFFERS 2
+#define SHAREDIMAGE_TRIPLE_FRESH 4 // The middle page holds a frame not yet received
+#define SHAREDIMAGE_TRIPLE_BACK 0  // Initial page of generator
+#define SHAREDIMAGE_TRIPLE_MIDDLE 1
+#define SHAREDIMAGE_TRIPLE_FRONT 2 // Initial page of consumer
+#define SHAREDIMAGE_PAGE_LEASED 4 // Page state of frames held by a lease, 3 is the page held by sharedImageReceive
+#define SHAREDIMAGE_PREFERENCE_RETRIES 1000 // Reads of a preference or rois changed while reading before giving up
+#define SHAREDIMAGE_UPDATE_STALE_US 200000 // A preference or rois sequence odd for this long was left by a consumer that died while writing
+// Counts a consumer in the header once the image is valid, the generator is notified when the first one arrives
+static void sharedImageAttachConsumer(struct SharedMemory *shared, SharedImageLocal *local)
+{
+  if(local->valid && !local->attached && !sharedMemIsServerSide(shared))
+  {
+    volatile SharedImageHeader *header=(volatile SharedImageHeader *)sharedMemHeader(shared);
+    local->attached=true;
+    sharedMemAtomicStore64(&header->consumerActivityUs, sharedMemTimestampUs());
+    if(sharedMemAtomicAdd32(&header->consumers, 1)==0)
+      sharedMemNotify(shared);
+  }
+}
+
 bool sharedImageCheckInitialized(struct SharedImage *image)
 {
   struct SharedMemory *shared=(struct SharedMemory *)image;
@@ -41,40 +118,165 @@ bool sharedImageCheckInitialized(struct SharedImage *image)
     SharedImageHeader *header=(SharedImageHeader *)sharedMemHeader(shared);
     local->valid=(header->magic==SHAREDMEMIMAGE_MAGIC) && (header->version==SHAREDMEMIMAGE_VERSION);
     ret=local->valid;
+    sharedImageAttachConsumer(shared, local);
   }
   return ret;
 }
 
+static void sharedImageInfo(SharedMemInfo *info, const SharedImageConfig *config)
+{
+  memset(info, 0, sizeof(*info));
+  info->numPages=config->numBuffers?config->numBuffers:SHAREDIMAGE_DEFAULT_BUFFERS;
+  if(info->numPages<2)
+    info->numPages=2;
+  if(config->mode==SharedImageModeTriple)
+    info->numPages=3;
+  info->headerSize=sizeof(SharedImageHeader);
+  info->pageHeaderSize=sizeof(SharedImagePageHeader)+(config->metadataBytes+SHAREDIMAGE_METADATA_ALIGN-1)/SHAREDIMAGE_METADATA_ALIGN*SHAREDIMAGE_METADATA_ALIGN;
+  // Page data aligned and sized to memory pages, so it can be used for direct I/O and aligned vector access
+  info->pageAlign=SHAREDIMAGE_PAGE_ALIGN;
+  info->pageSize=(config->numBytes+SHAREDIMAGE_PAGE_ALIGN-1)/SHAREDIMAGE_PAGE_ALIGN*SHAREDIMAGE_PAGE_ALIGN;
+  if(config->mode!=SharedImageModeTriple && config->numLargeBuffers) // Large buffers follow the standard ones
+  {
+    info->numLargePages=config->numLargeBuffers;
+    info->numPages+=config->numLargeBuffers;
+    info->largePageSize=(config->largeBytes+SHAREDIMAGE_PAGE_ALIGN-1)/SHAREDIMAGE_PAGE_ALIGN*SHAREDIMAGE_PAGE_ALIGN;
+  }
+}
+
+static void sharedImageSetup(struct SharedMemory *shared, const SharedImageConfig *config)
+{
+  SharedImageLocal *local=(SharedImageLocal *)sharedMemLocal(shared);
+  local->initialized=local->valid=false;
+  memset(local, 0, sizeof(*local));
+  local->lastPage=local->backPage=local->previousPage=local->streamPage=-1;
+  volatile SharedImageHeader *header=(volatile SharedImageHeader *)sharedMemHeader(shared);
+  if(sharedMemMustInitialize(shared))
+  {
+    header->magic=SHAREDMEMIMAGE_MAGIC;
+    header->version=SHAREDMEMIMAGE_VERSION;
+    header->mode=config?config->mode:SharedImageModeLatest;
+    header->triple=SHAREDIMAGE_TRIPLE_MIDDLE;
+    header->nextSequence=0;
+    header->requests=header->servedRequests=0;
+    header->requestNotBeforeUs=0;
+    header->consumers=header->preferenceSequence=0;
+    header->consumerActivityUs=0;
+    header->preference.width=header->preference.height=header->preference.frameIntervalUs=0;
+    header->preference.format=SHAREDIMAGE_ANY_FORMAT;
+    header->roiSequence=header->numRois=0;
+    for(unsigned i=0;i<sharedMemInfo(shared)->numPages;i++)
+    {
+      memset((void *)sharedMemPageHeader(shared, i), 0, sizeof(SharedImagePageHeader));
+      if(header->mode==SharedImageModeFifo) // All the queue belongs to the generator
+        sharedMemInitPageServer(shared, i);
+      else
+        sharedMemInitPageClient(shared, i);
+    }
+    sharedMemEndInitialization(shared);
+    local->initialized=local->valid=true;
+    sharedImageAttachConsumer(shared, local);
+  }
+}
+
+static void sharedImageDefaultConfig(SharedImageConfig *config, uint32_t numBytes)
+{
+  memset(config, 0, sizeof(*config));
+  config->numBytes=numBytes;
+  config->numBuffers=SHAREDIMAGE_DEFAULT_BUFFERS;
+  config->mode=SharedImageModeLatest;
+}
+
 bool sharedImageCreate(const char *utf8Name, struct SharedImage **image, uint32_t numPixels, bool generator)
+{
+  return sharedImageCreateBytes(utf8Name, image, numPixels*sizeof(uint32_t), generator);
+}
+
+bool sharedImageCreateBytes(const char *utf8Name, struct SharedImage **image, uint32_t numBytes, bool generator)
+{
+  SharedImageConfig config;
+  sharedImageDefaultConfig(&config, numBytes);
+  return sharedImageCreateConfig(utf8Name, &config, image, generator);
+}
+
+bool sharedImageCreateConfig(const char *utf8Name, const SharedImageConfig *config, struct SharedImage **image, bool generator)
 {
   struct SharedMemory *ret=NULL;
   SharedMemInfo info;
-  memset(&info, 0, sizeof(info));
-  info.numPages=2;
-  info.headerSize=sizeof(SharedImageHeader);
-  info.pageHeaderSize=sizeof(SharedImagePageHeader);
-  info.pageSize=numPixels*sizeof(uint32_t);
+  sharedImageInfo(&info, config);
 
   bool retValue;
   retValue=sharedMemCreate(utf8Name, &info, &ret, sizeof(SharedImageLocal), generator);
   *image=(struct SharedImage *)ret;
   if(retValue)
+    sharedImageSetup(ret, config);
+  return retValue;
+}
+
+#if defined(SHAREDMEM_LINUX)
+bool sharedImageCreateAnonymous(struct SharedImage **image, uint32_t numPixels, bool generator)
+{
+  return sharedImageCreateAnonymousBytes(image, numPixels*sizeof(uint32_t), generator);
+}
+
+bool sharedImageCreateAnonymousBytes(struct SharedImage **image, uint32_t numBytes, bool generator)
+{
+  SharedImageConfig config;
+  sharedImageDefaultConfig(&config, numBytes);
+  return sharedImageCreateAnonymousConfig(&config, image, generator);
+}
+
+bool sharedImageCreateAnonymousConfig(const SharedImageConfig *config, struct SharedImage **image, bool generator)
+{
+  struct SharedMemory *ret=NULL;
+  SharedMemInfo info;
+  sharedImageInfo(&info, config);
+
+  bool retValue;
+  retValue=sharedMemCreateAnonymous(&info, &ret, sizeof(SharedImageLocal), generator);
+  *image=(struct SharedImage *)ret;
+  if(retValue)
+    sharedImageSetup(ret, config);
+  return retValue;
+}
+
+bool sharedImageSendToSocket(struct SharedImage *image, int socketFd)
+{
+  return sharedMemSendToSocket((struct SharedMemory *)image, socketFd);
+}
+
+bool sharedImageAttachFromSocket(int socketFd, struct SharedImage **image)
+{
+  struct SharedMemory *ret=NULL;
+  bool retValue;
+  retValue=sharedMemAttachFromSocket(socketFd, &ret, sizeof(SharedImageLocal));
+  *image=(struct SharedImage *)ret;
+  if(retValue)
+    sharedImageSetup(ret, NULL);
+  return retValue;
+}
+
+int sharedImageNotificationFd(struct SharedImage *image)
+{
+  return sharedMemNotificationFd((struct SharedMemory *)image);
+}
+#endif
+
+// Returns the queued frame with the lowest (oldest) or highest (newest) sequence
+static int32_t sharedImageFindFrame(struct SharedMemory *shared, bool newest)
+{
+  int32_t ret=-1;
+  uint64_t sequence=0;
+  for(int32_t page=sharedMemGetFirstPageN(shared, 2, 0);page>=0;page=sharedMemGetFirstPageN(shared, 2, page+1))
   {
-    SharedImageLocal *local=(SharedImageLocal *)sharedMemLocal(ret);
-    local->initialized=local->valid=false;
-    local->lastPage=-1;
-    volatile SharedImageHeader *header=(volatile SharedImageHeader *)sharedMemHeader(ret);
-    if(sharedMemMustInitialize(ret))
+    uint64_t pageSequence=((volatile SharedImagePageHeader *)sharedMemPageHeader(shared, page))->info.sequence;
+    if(ret<0 || (newest?(pageSequence>sequence):(pageSequence<sequence)))
     {
-      header->magic=SHAREDMEMIMAGE_MAGIC;
-      header->version=SHAREDMEMIMAGE_VERSION;
-      for(unsigned i=0;i<info.numPages;i++)
-        sharedMemInitPageClient(ret, i);
-      sharedMemEndInitialization(ret);
-      local->initialized=local->valid=true;
+      ret=page;
+      sequence=pageSequence;
     }
   }
-  return retValue;
+  return ret;
 }
 
 bool sharedImageReceive(struct SharedImage *image, void **imageData, const SharedImageSetting **settings)
@@ -84,74 +286,437 @@ bool sharedImageReceive(struct SharedImage *image, void **imageData, const Share
   {
     struct SharedMemory *shared=(struct SharedMemory *)image;
     SharedImageLocal *local=sharedMemLocal(shared);
-    int32_t page=sharedMemGetFirstPageN(shared, 2, 0);
+    volatile SharedImageHeader *imageHeader=(volatile SharedImageHeader *)sharedMemHeader(shared);
+    uint32_t mode=imageHeader->mode;
+    int32_t page=-1;
+    sharedMemAtomicStore64(&imageHeader->consumerActivityUs, sharedMemTimestampUs());
+    if(mode!=SharedImageModeTriple)
+      page=sharedImageFindFrame(shared, mode==SharedImageModeLatest);
+    else if(sharedMemAtomicLoad32(&imageHeader->triple)&SHAREDIMAGE_TRIPLE_FRESH) // Only the consumer clears the flag
+      page=(int32_t)(sharedMemAtomicExchange32(&imageHeader->triple, (uint32_t)(local->lastPage>=0?local->lastPage:SHAREDIMAGE_TRIPLE_FRONT))&3);
     if(page>=0)
     {
       ret=true;
-      if(imageData)
-        *imageData=(void *)sharedMemPageData(shared, page);
+      SHAREDMEM_TRACE_EVENT(shared, SharedMemTraceReceive, page);
+      if(imageData) // Data of the first plane
+        *imageData=(void *)((volatile uint8_t *)sharedMemPageData(shared, page)+((volatile SharedImagePageHeader *)sharedMemPageHeader(shared, page))->planes[0].offset);
       if(settings)
         *settings=&((SharedImagePageHeader *)sharedMemPageHeader(shared, page))->setting;
+      local->previousReceived=(local->lastPage>=0);
+      if(local->previousReceived)
+        local->previousSequence=((volatile SharedImagePageHeader *)sharedMemPageHeader(shared, local->lastPage))->info.sequence;
 
-      if(local->lastPage>=0) // If we had a previous page frees it
+      if(mode==SharedImageModeTriple) // Page states are not used
+        local->lastPage=page;
+      else
       {
-        sharedMemFreePage(shared, local->lastPage);
-        local->lastPage=-1;
+        if(local->lastPage>=0) // If we had a previous page frees it (in FIFO mode gives it back to the generator)
+        {
+          if(mode==SharedImageModeFifo)
+            sharedMemSendFree(shared, local->lastPage);
+          else
+            sharedMemFreePage(shared, local->lastPage);
+          local->lastPage=-1;
+        }
+        local->lastPage=page;
+        sharedMemSetPageN(shared, page, 3);
+        while(mode==SharedImageModeLatest) // Frees all other data pages, if any
+        {
+          page=sharedMemGetFirstPageN(shared, 2, 0);
+          if(page<0)
+            break;
+          sharedMemFreePage(shared, page);
+        }
       }
-      local->lastPage=page;
-      sharedMemSetPageN(shared, page, 3);
-      for(;;) // Frees all other data pages, if any
+    }
+    int num=(mode==SharedImageModeLatest)?sharedMemGetNumOwnedPages(shared):0;
+    if(num>1)
+    {
+      page=sharedMemGetFreePage(shared, 0);
+      if(page>=0) // In theory this should always happen
+        sharedMemSendFree(shared, page);
+    }
+  }
+  return ret;
+}
+
+static uint32_t sharedImageMaxLeases(struct SharedMemory *shared, SharedImageLocal *local)
+{
+  uint32_t ret=sharedMemInfo(shared)->numPages-1; // The generator always keeps a page to write
+  if(local->maxLeases && local->maxLeases<ret)
+    ret=local->maxLeases;
+  return ret;
+}
+
+bool sharedImageSetMaxLeases(struct SharedImage *image, uint32_t maxLeases)
+{
+  bool ret=false;
+  if(sharedImageCheckInitialized(image))
+  {
+    struct SharedMemory *shared=(struct SharedMemory *)image;
+    SharedImageLocal *local=(SharedImageLocal *)sharedMemLocal(shared);
+    local->maxLeases=maxLeases;
+    ret=(sharedImageMaxLeases(shared, local)==maxLeases);
+  }
+  return ret;
+}
+
+bool sharedImageAcquire(struct SharedImage *image, SharedImageLease *lease)
+{
+  bool ret=false;
+  if(lease)
+    lease->page=-1;
+  if(sharedImageCheckInitialized(image) && lease)
+  {
+    struct SharedMemory *shared=(struct SharedMemory *)image;
+    SharedImageLocal *local=(SharedImageLocal *)sharedMemLocal(shared);
+    volatile SharedImageHeader *imageHeader=(volatile SharedImageHeader *)sharedMemHeader(shared);
+    uint32_t mode=imageHeader->mode;
+    int32_t page=-1;
+    sharedMemAtomicStore64(&imageHeader->consumerActivityUs, sharedMemTimestampUs());
+    if(mode!=SharedImageModeTriple && sharedMemAtomicLoad32(&local->numLeases)<sharedImageMaxLeases(shared, local))
+      page=sharedImageFindFrame(shared, mode==SharedImageModeLatest);
+    if(page>=0)
+    {
+      SharedImagePageHeader *header=(SharedImagePageHeader *)sharedMemPageHeader(shared, page);
+      ret=true;
+      SHAREDMEM_TRACE_EVENT(shared, SharedMemTraceReceive, page);
+      sharedMemSetPageN(shared, page, SHAREDIMAGE_PAGE_LEASED);
+      sharedMemAtomicAdd32(&local->numLeases, 1);
+      lease->page=page;
+      lease->frameData=(void *)sharedMemPageData(shared, page);
+      lease->planes=header->planes;
+      lease->numPlanes=header->numPlanes;
+      lease->info=&header->info;
+      while(mode==SharedImageModeLatest) // Older frames are dropped, as in sharedImageReceive
       {
-        page=sharedMemGetDataPage(shared, page+1);
+        page=sharedMemGetFirstPageN(shared, 2, 0);
         if(page<0)
           break;
         sharedMemFreePage(shared, page);
       }
     }
-    int num=sharedMemGetNumOwnedPages(shared);
-    if(num>1)
+    while(mode==SharedImageModeLatest && sharedMemGetNumOwnedPages(shared)>1) // Free pages go back to the generator
     {
       page=sharedMemGetFreePage(shared, 0);
-      if(page>=0) // In theory this should always happen
-        sharedMemSendFree(shared, page);
+      if(page<0)
+        break;
+      sharedMemSendFree(shared, page);
+    }
+  }
+  return ret;
+}
+
+bool sharedImageRelease(struct SharedImage *image, SharedImageLease *lease)
+{
+  bool ret=false;
+  if(sharedImageCheckInitialized(image) && lease && lease->page>=0)
+  {
+    struct SharedMemory *shared=(struct SharedMemory *)image;
+    SharedImageLocal *local=(SharedImageLocal *)sharedMemLocal(shared);
+    // Straight to the generator in any mode, without touching the state of the object used by the acquiring thread
+    if(sharedMemSendFreeN(shared, (uint32_t)lease->page, SHAREDIMAGE_PAGE_LEASED))
+    {
+      ret=true;
+      sharedMemAtomicAdd32(&local->numLeases, (uint32_t)-1);
+      lease->page=-1;
     }
   }
   return ret;
 }
 
 bool sharedImageOutBuffer(struct SharedImage *image, void **imageData, uint32_t *availablePixels)
+{
+  bool ret=sharedImageOutBufferBytes(image, imageData, availablePixels);
+  if(ret && availablePixels)
+    *availablePixels/=sizeof(uint32_t);
+  return ret;
+}
+
+// Readers of sharedImagePeek see the page as torn from here until sharedImageEndWrite
+static void sharedImageBeginWrite(volatile SharedImagePageHeader *header)
+{
+  uint32_t sequence=sharedMemAtomicLoad32(&header->pageSequence);
+  if(!(sequence&1))
+  {
+    sharedMemAtomicStore32(&header->pageSequence, sequence+1);
+    sharedMemAtomicFence(); // Before any write to the page
+  }
+}
+
+static void sharedImageEndWrite(volatile SharedImagePageHeader *header)
+{
+  uint32_t sequence=sharedMemAtomicLoad32(&header->pageSequence);
+  if(sequence&1)
+    sharedMemAtomicStore32(&header->pageSequence, sequence+1);
+}
+
+bool sharedImageOutBufferBytes(struct SharedImage *image, void **imageData, uint32_t *availableBytes)
+{
+  return sharedImageOutBufferFit(image, 0, imageData, availableBytes);
+}
+
+bool sharedImageOutBufferFit(struct SharedImage *image, uint32_t neededBytes, void **imageData, uint32_t *availableBytes)
 {
   bool ret=false;
   if(sharedImageCheckInitialized(image))
   {
     struct SharedMemory *shared=(struct SharedMemory *)image;
-    int32_t page=sharedMemGetFreePage(shared, 0);
+    SharedImageLocal *local=(SharedImageLocal *)sharedMemLocal(shared);
+    int32_t page=-1;
+    if(((SharedImageHeader *)sharedMemHeader(shared))->mode==SharedImageModeTriple) // The back page is always available
+    {
+      page=(local->backPage>=0)?local->backPage:SHAREDIMAGE_TRIPLE_BACK;
+      if(sharedMemPageSize(shared, (uint32_t)page)<neededBytes)
+        page=-1;
+    }
+    else // Smallest free page that fits, standard pages come first
+    {
+      for(int32_t free=sharedMemGetFreePage(shared, 0);free>=0;free=sharedMemGetFreePage(shared, free+1))
+      {
+        uint32_t size=sharedMemPageSize(shared, (uint32_t)free);
+        if(size>=neededBytes && (page<0 || size<sharedMemPageSize(shared, (uint32_t)page)))
+          page=free;
+      }
+    }
     if(page>=0)
     {
-      SharedImageLocal *local=(SharedImageLocal *)sharedMemLocal(shared);
       local->lastPage=page;
+      sharedImageBeginWrite((volatile SharedImagePageHeader *)sharedMemPageHeader(shared, page));
+      ((volatile SharedImagePageHeader *)sharedMemPageHeader(shared, page))->metadataBytes=0;
       ret=true;
+      SHAREDMEM_TRACE_EVENT(shared, SharedMemTraceAcquire, page);
       if(imageData)
         *imageData=(void *)sharedMemPageData(shared, page);
-      if(availablePixels)
-        *availablePixels=sharedMemInfo(shared)->pageSize/sizeof(uint32_t);
+      if(availableBytes)
+        *availableBytes=sharedMemPageSize(shared, (uint32_t)page);
+    }
+  }
+  return ret;
+}
+
+// Consumer state announced through the same notification as released buffers
+typedef struct
+{
+  uint32_t requests;
+  uint32_t consumers;
+  uint32_t preferenceSequence;
+  uint32_t roiSequence;
+} SharedImageSignals;
+
+static void sharedImageReadSignals(struct SharedMemory *shared, SharedImageSignals *signals)
+{
+  volatile SharedImageHeader *header=(volatile SharedImageHeader *)sharedMemHeader(shared);
+  signals->requests=sharedMemAtomicLoad32(&header->requests);
+  signals->consumers=sharedMemAtomicLoad32(&header->consumers);
+  signals->preferenceSequence=sharedMemAtomicLoad32(&header->preferenceSequence);
+  signals->roiSequence=sharedMemAtomicLoad32(&header->roiSequence);
+}
+
+bool sharedImageOutBufferWait(struct SharedImage *image, void **imageData, uint32_t *availableBytes, uint64_t deadlineUs, uint64_t *waitedUs)
+{
+  uint64_t start=sharedMemTimestampUs(), now=start;
+  bool ret=sharedImageOutBufferBytes(image, imageData, availableBytes);
+  bool signaled=false;
+  SharedImageSignals before, after;
+  if(!ret && sharedImageCheckInitialized(image))
+    sharedImageReadSignals((struct SharedMemory *)image, &before);
+  while(!ret && !signaled && now<deadlineUs && sharedImageCheckInitialized(image))
+  {
+    uint64_t timeoutMs=(deadlineUs-now+999)/1000; // Rounded up, so the deadline is never missed by a shorter wait
+    sharedMemWaitNotify((struct SharedMemory *)image, (uint32_t)(timeoutMs<INT32_MAX?timeoutMs:INT32_MAX));
+    ret=sharedImageOutBufferBytes(image, imageData, availableBytes);
+    if(!ret) // The notification was consumed, so the caller is given the chance to handle what it was for
+    {
+      sharedImageReadSignals((struct SharedMemory *)image, &after);
+      signaled=(memcmp(&before, &after, sizeof(before))!=0);
     }
+    now=sharedMemTimestampUs();
   }
+  if(waitedUs)
+    *waitedUs=now-start;
   return ret;
 }
 
 bool sharedImageSend(struct SharedImage *image, const SharedImageSetting *setting)
+{
+  return sharedImageSendDirty(image, setting, NULL, 0);
+}
+
+// Bytes of a pixel for formats where a rectangle is a set of byte ranges, 0 for the others
+static uint32_t sharedImagePixelBytes(uint32_t format)
+{
+  uint32_t ret=0;
+  if(format!=SharedImageFormatYUYV && format!=SharedImageFormatNV12 && format!=SharedImageFormatI420)
+    ret=sharedImageFormatMinBytesPerLine(format, 1);
+  return ret;
+}
+
+static bool sharedImageSameSetting(const SharedImageSetting *a, const SharedImageSetting *b)
+{
+  return a->width==b->width && a->height==b->height && a->bytesPerLine==b->bytesPerLine && a->format==b->format;
+}
+
+static void sharedImageCopyRect(volatile uint8_t *to, const volatile uint8_t *from, const SharedImageSetting *setting, const SharedImageRect *rect)
+{
+  uint32_t pixelBytes=sharedImagePixelBytes(setting->format);
+  size_t offset=(size_t)rect->y*setting->bytesPerLine+(size_t)rect->x*pixelBytes;
+  for(uint32_t y=0;y<rect->height;y++, offset+=setting->bytesPerLine)
+    memcpy((void *)(to+offset), (const void *)(from+offset), (size_t)rect->width*pixelBytes);
+}
+
+// Bytes from the start of the buffer to the end of the last plane
+static uint64_t sharedImagePlanesBytes(const volatile SharedImagePageHeader *header)
+{
+  uint64_t ret=0;
+  for(uint32_t i=0;i<header->numPlanes && i<SHAREDIMAGE_MAX_PLANES;i++)
+  {
+    SharedImageSetting setting=header->planes[i].setting;
+    uint64_t end=header->planes[i].offset+sharedImageFrameBytes(&setting);
+    if(end>ret)
+      ret=end;
+  }
+  return ret;
+}
+
+// Brings page up to date with the frame in previous page
+static void sharedImageCopyForward(struct SharedMemory *shared, SharedImageLocal *local, int32_t page, int32_t previous)
+{
+  volatile SharedImagePageHeader *to=(volatile SharedImagePageHeader *)sharedMemPageHeader(shared, page);
+  volatile SharedImagePageHeader *from=(volatile SharedImagePageHeader *)sharedMemPageHeader(shared, previous);
+  SharedImageSetting setting=from->setting, toSetting=to->setting;
+  uint64_t last=from->info.sequence, first=to->info.sequence+1;
+  // A page never sent has no frame to update (pageSequence is 1 after sharedImageBeginWrite)
+  bool empty=(sharedMemAtomicLoad32(&to->pageSequence)<=1);
+  // Dirty rectangles refer to the first plane at offset 0, pyramid levels are built again by the generator
+  bool full=empty || !sharedImageSameSetting(&setting, &toSetting) || from->numPlanes!=1+from->numLevels || from->planes[0].offset || to->planes[0].offset || first>last || last-first>=SHAREDIMAGE_DIRTY_HISTORY || !sharedImagePixelBytes(setting.format);
+  for(uint64_t sequence=first;!full && sequence<=last;sequence++)
+  {
+    const SharedImageDirtyHistory *history=&local->history[sequence%SHAREDIMAGE_DIRTY_HISTORY];
+    full=(history->sequence!=sequence || !history->numRects);
+  }
+  if(full) // The page was chosen to fit the previous frame (see sharedImageOutBufferDelta)
+    memcpy((void *)sharedMemPageData(shared, page), (const void *)sharedMemPageData(shared, previous), (size_t)sharedImagePlanesBytes(from));
+  else
+  {
+    for(uint64_t sequence=first;sequence<=last;sequence++)
+    {
+      const SharedImageDirtyHistory *history=&local->history[sequence%SHAREDIMAGE_DIRTY_HISTORY];
+      for(uint32_t i=0;i<history->numRects;i++)
+        sharedImageCopyRect((volatile uint8_t *)sharedMemPageData(shared, page), (const volatile uint8_t *)sharedMemPageData(shared, previous), &setting, &history->rects[i]);
+    }
+  }
+  to->setting=setting;
+  to->numPlanes=from->numPlanes;
+  to->numLevels=from->numLevels;
+  for(uint32_t i=0;i<from->numPlanes && i<SHAREDIMAGE_MAX_PLANES;i++)
+    to->planes[i]=from->planes[i];
+  to->info.sequence=last;
+  to->info.timestampUs=from->info.timestampUs;
+}
+
+bool sharedImageOutBufferDelta(struct SharedImage *image, void **imageData, uint32_t *availableBytes)
 {
   bool ret=false;
   if(sharedImageCheckInitialized(image))
   {
     struct SharedMemory *shared=(struct SharedMemory *)image;
     SharedImageLocal *local=(SharedImageLocal *)sharedMemLocal(shared);
-    if(local->lastPage>=0)
+    // A frame from a large page may not fit a standard one, so the page must hold the whole previous frame.
+    // Sends validate planes against the page, so the previous frame never exceeds a page size
+    uint64_t neededBytes=(local->previousPage>=0)?sharedImagePlanesBytes((volatile SharedImagePageHeader *)sharedMemPageHeader(shared, local->previousPage)):0;
+    ret=sharedImageOutBufferFit(image, (uint32_t)neededBytes, imageData, availableBytes);
+    if(ret && local->previousPage>=0 && local->previousPage!=local->lastPage)
+      sharedImageCopyForward(shared, local, local->lastPage, local->previousPage);
+    else if(!ret && neededBytes)
+      sharedMemSetError(shared, "No free buffer can hold the previous frame");
+  }
+  return ret;
+}
+
+// Checks that planes are valid, fit the buffer and do not overlap
+static bool sharedImageValidPlanes(const SharedImagePlane *planes, uint32_t numPlanes, uint32_t pageSize)
+{
+  bool ret=(planes && numPlanes>=1 && numPlanes<=SHAREDIMAGE_MAX_PLANES);
+  for(uint32_t i=0;ret && i<numPlanes;i++)
+  {
+    uint64_t bytes=sharedImageFrameBytes(&planes[i].setting);
+    ret=(bytes && planes[i].offset+bytes<=pageSize);
+    for(uint32_t j=0;ret && j<i;j++)
+      ret=(planes[i].offset>=planes[j].offset+sharedImageFrameBytes(&planes[j].setting) || planes[j].offset>=planes[i].offset+bytes);
+  }
+  return ret;
+}
+
+// info forwards sequence and timestamp of a frame from another channel, NULL for a new frame
+static bool sharedImageSendFrame(struct SharedImage *image, const SharedImagePlane *planes, uint32_t numPlanes, uint32_t numLevels, const SharedImageRect *rects, uint32_t numRects, bool partial, const SharedImageFrameInfo *info)
+{
+  bool ret=false;
+  if(sharedImageCheckInitialized(image))
+  {
+    struct SharedMemory *shared=(struct SharedMemory *)image;
+    SharedImageLocal *local=(SharedImageLocal *)sharedMemLocal(shared);
+    if(local->lastPage>=0 && local->streamPage<0 && sharedImageValidPlanes(planes, numPlanes, sharedMemPageSize(shared, (uint32_t)local->lastPage)))
     {
+      const SharedImageSetting *setting=&planes[0].setting;
       volatile SharedImagePageHeader *header=(volatile SharedImagePageHeader *)sharedMemPageHeader(shared, local->lastPage);
+      volatile SharedImageHeader *imageHeader=(volatile SharedImageHeader *)sharedMemHeader(shared);
+      uint32_t requests=sharedMemAtomicLoad32(&imageHeader->requests); // Requests posted until now are served by this frame
+      uint64_t sequence=imageHeader->nextSequence;
+      if(info && info->sequence>sequence) // Consumers find the newest frame by sequence, so it never goes back
+        sequence=info->sequence;
+      imageHeader->nextSequence=sequence+1;
+      SharedImageDirtyHistory *history=&local->history[sequence%SHAREDIMAGE_DIRTY_HISTORY];
+      history->sequence=sequence;
+      history->numRects=0;
+      if(rects && numRects<=SHAREDIMAGE_MAX_DIRTY_RECTS && numPlanes==1+numLevels && !planes[0].offset && local->previousPage>=0 && sharedImagePixelBytes(setting->format))
+      {
+        volatile SharedImagePageHeader *previous=(volatile SharedImagePageHeader *)sharedMemPageHeader(shared, local->previousPage);
+        SharedImageSetting previousSetting=previous->setting;
+        if(previous->numPlanes==1+previous->numLevels && !previous->planes[0].offset && sharedImageSameSetting(setting, &previousSetting))
+        {
+          for(uint32_t i=0;i<numRects;i++) // Clipped to the image, empty ones are skipped
+          {
+            SharedImageRect rect=rects[i];
+            if(rect.x<setting->width && rect.y<setting->height && rect.width && rect.height)
+            {
+              if(rect.width>setting->width-rect.x)
+                rect.width=setting->width-rect.x;
+              if(rect.height>setting->height-rect.y)
+                rect.height=setting->height-rect.y;
+              history->rects[history->numRects++]=rect;
+            }
+          }
+          if(!history->numRects) // Nothing changed, sends an empty rectangle since none means the whole frame
+            memset(&history->rects[history->numRects++], 0, sizeof(SharedImageRect));
+        }
+      }
       header->setting=*setting;
-      sharedMemSendData(shared, local->lastPage);
+      header->numPlanes=numPlanes;
+      header->numLevels=numLevels;
+      for(uint32_t i=0;i<numPlanes;i++)
+        header->planes[i]=planes[i];
+      header->info.sequence=sequence;
+      local->lastSendUs=sharedMemTimestampUs();
+      header->info.timestampUs=info?info->timestampUs:local->lastSendUs;
+      sharedMemAtomicStore32(&imageHeader->servedRequests, requests);
+      header->numDirtyRects=history->numRects;
+      for(uint32_t i=0;i<history->numRects;i++)
+        header->dirtyRects[i]=history->rects[i];
+      header->rowsDone=partial?0:setting->height;
+      local->previousPage=local->lastPage;
+      if(partial)
+        local->streamPage=local->lastPage;
+      else
+        sharedImageEndWrite(header);
+      if(imageHeader->mode==SharedImageModeTriple) // Publishes the back page as middle one and gets the old middle page
+      {
+        SHAREDMEM_TRACE_EVENT(shared, SharedMemTraceSend, local->lastPage);
+        local->backPage=(int32_t)(sharedMemAtomicExchange32(&imageHeader->triple, (uint32_t)local->lastPage|SHAREDIMAGE_TRIPLE_FRESH)&3);
+        sharedMemNotify(shared);
+      }
+      else
+        sharedMemSendData(shared, local->lastPage);
       local->lastPage=-1;
       ret=true;
     }
@@ -159,24 +724,735 @@ bool sharedImageSend(struct SharedImage *image, const SharedImageSetting *settin
   return ret;
 }
 
-bool sharedImageDestroy(struct SharedImage *image)
+bool sharedImageSendDirty(struct SharedImage *image, const SharedImageSetting *setting, const SharedImageRect *rects, uint32_t numRects)
 {
-  return sharedMemDestroy((struct SharedMemory *)image);
+  SharedImagePlane plane;
+  plane.setting=*setting;
+  plane.offset=0;
+  return sharedImageSendFrame(image, &plane, 1, 0, rects, numRects, false, NULL);
 }
 
-#if defined(SHAREDMEM_WIN32)
-void *sharedImageNotificationHandle(struct SharedImage *image)
+bool sharedImageSendForward(struct SharedImage *image, const SharedImageSetting *setting, const SharedImageFrameInfo *info)
 {
-  return sharedMemNotificationHandle((struct SharedMemory *)image);
+  bool ret=false;
+  if(setting && info)
+  {
+    SharedImagePlane plane;
+    plane.setting=*setting;
+    plane.offset=0;
+    ret=sharedImageSendFrame(image, &plane, 1, 0, NULL, 0, false, info);
+  }
+  return ret;
 }
-#endif
 
-const char *sharedImageGetError(struct SharedImage *image)
+bool sharedImageSendPlanes(struct SharedImage *image, const SharedImagePlane *planes, uint32_t numPlanes)
 {
-  return sharedMemGetError((struct SharedMemory *)image);
+  return sharedImageSendFrame(image, planes, numPlanes, 0, NULL, 0, false, NULL);
 }
 
-bool sharedImageWaitNotify(struct SharedImage *image, uint32_t timeoutMs)
+bool sharedImageSendPyramid(struct SharedImage *image, const SharedImagePlane *levels, uint32_t numLevels, const SharedImageRect *rects, uint32_t numRects)
 {
-  return sharedMemWaitNotify((struct SharedMemory *)image, timeoutMs);
+  return sharedImageSendFrame(image, levels, numLevels, numLevels?numLevels-1:0, rects, numRects, false, NULL);
+}
+
+bool sharedImageSendPartial(struct SharedImage *image, const SharedImageSetting *setting)
+{
+  SharedImagePlane plane;
+  plane.setting=*setting;
+  plane.offset=0;
+  return sharedImageSendFrame(image, &plane, 1, 0, NULL, 0, true, NULL);
+}
+
+bool sharedImageSendRows(struct SharedImage *image, uint32_t rowsDone)
+{
+  bool ret=false;
+  if(sharedImageCheckInitialized(image))
+  {
+    struct SharedMemory *shared=(struct SharedMemory *)image;
+    SharedImageLocal *local=(SharedImageLocal *)sharedMemLocal(shared);
+    if(local->streamPage>=0)
+    {
+      volatile SharedImagePageHeader *header=(volatile SharedImagePageHeader *)sharedMemPageHeader(shared, local->streamPage);
+      uint32_t height=header->setting.height;
+      bool complete=(rowsDone>=height);
+      if(complete) // The generator can send again
+      {
+        rowsDone=height;
+        local->streamPage=-1;
+      }
+      if(rowsDone>header->rowsDone)
+        sharedMemAtomicStore32(&header->rowsDone, rowsDone); // Rows written before are visible to the consumer
+      if(complete)
+        sharedImageEndWrite(header);
+      ret=sharedMemNotify(shared);
+    }
+  }
+  return ret;
+}
+
+SharedImagePeekResult sharedImagePeek(struct SharedImage *image, void *buffer, uint64_t bufferSize, SharedImageSetting *setting, SharedImageFrameInfo *info)
+{
+  SharedImagePeekResult ret=SharedImagePeekNoFrame;
+  if(sharedImageCheckInitialized(image) && setting)
+  {
+    struct SharedMemory *shared=(struct SharedMemory *)image;
+    volatile SharedImagePageHeader *header=NULL;
+    int32_t page=-1;
+    uint64_t sequence=0;
+    sharedMemAtomicStore64(&((volatile SharedImageHeader *)sharedMemHeader(shared))->consumerActivityUs, sharedMemTimestampUs());
+    for(int32_t i=0;i<(int32_t)sharedMemInfo(shared)->numPages;i++) // Newest complete frame, whoever owns the page
+    {
+      volatile SharedImagePageHeader *pageHeader=(volatile SharedImagePageHeader *)sharedMemPageHeader(shared, i);
+      uint32_t pageSequence=sharedMemAtomicLoad32(&pageHeader->pageSequence);
+      if(pageSequence && !(pageSequence&1) && (page<0 || pageHeader->info.sequence>sequence))
+      {
+        page=i;
+        header=pageHeader;
+        sequence=pageHeader->info.sequence;
+      }
+    }
+    if(page>=0)
+    {
+      uint32_t pageSequence=sharedMemAtomicLoad32(&header->pageSequence);
+      ret=SharedImagePeekTorn;
+      if(!(pageSequence&1))
+      {
+        setting->width=header->setting.width;
+        setting->height=header->setting.height;
+        setting->bytesPerLine=header->setting.bytesPerLine;
+        setting->format=header->setting.format;
+        SharedImageFrameInfo frameInfo;
+        frameInfo.sequence=header->info.sequence;
+        frameInfo.timestampUs=header->info.timestampUs;
+        uint64_t offset=header->planes[0].offset;
+        uint64_t bytes=sharedImageFrameBytes(setting);
+        // Values may be torn: checked against the page before copying
+        bool fits=(buffer && bytes && bytes<=bufferSize && offset+bytes<=sharedMemPageSize(shared, (uint32_t)page));
+        if(fits)
+          memcpy(buffer, (const void *)((volatile uint8_t *)sharedMemPageData(shared, page)+offset), (size_t)bytes);
+        sharedMemAtomicFence();
+        if(sharedMemAtomicLoad32(&header->pageSequence)==pageSequence)
+        {
+          ret=fits?SharedImagePeekOk:SharedImagePeekTooSmall;
+          if(info)
+            *info=frameInfo;
+        }
+      }
+    }
+  }
+  return ret;
+}
+
+uint32_t sharedImageRowsDone(struct SharedImage *image)
+{
+  uint32_t ret=0;
+  if(sharedImageCheckInitialized(image))
+  {
+    struct SharedMemory *shared=(struct SharedMemory *)image;
+    SharedImageLocal *local=(SharedImageLocal *)sharedMemLocal(shared);
+    if(local->lastPage>=0)
+      ret=sharedMemAtomicLoad32(&((volatile SharedImagePageHeader *)sharedMemPageHeader(shared, local->lastPage))->rowsDone);
+  }
+  return ret;
+}
+
+bool sharedImageSendStripes(struct SharedImage *image, const SharedImageSetting *setting, uint32_t numStripes)
+{
+  bool ret=false;
+  if(sharedImageCheckInitialized(image) && setting)
+  {
+    struct SharedMemory *shared=(struct SharedMemory *)image;
+    SharedImageLocal *local=(SharedImageLocal *)sharedMemLocal(shared);
+    SharedImagePlane plane;
+    plane.setting=*setting;
+    plane.offset=0;
+    if(local->lastPage>=0 && numStripes>=1 && numStripes<=setting->height && !sharedMemAtomicLoad32(&local->stripesPending) && sharedImageValidPlanes(&plane, 1, sharedMemPageSize(shared, (uint32_t)local->lastPage)))
+    {
+      local->stripeSetting=*setting;
+      local->numStripes=numStripes;
+      sharedMemAtomicStore32(&local->stripesPending, numStripes); // Published to the workers by the caller
+      ret=true;
+    }
+  }
+  return ret;
+}
+
+bool sharedImageStripeRows(struct SharedImage *image, uint32_t stripe, SharedImageRect *rect)
+{
+  bool ret=false;
+  if(sharedImageCheckInitialized(image) && rect)
+  {
+    SharedImageLocal *local=(SharedImageLocal *)sharedMemLocal((struct SharedMemory *)image);
+    const SharedImageSetting *setting=&local->stripeSetting;
+    if(stripe<local->numStripes)
+    {
+      // Chroma of 4:2:0 formats covers two rows, so stripes start on even rows
+      uint32_t align=(setting->format==SharedImageFormatNV12 || setting->format==SharedImageFormatI420)?2:1;
+      uint32_t top=(uint32_t)((uint64_t)setting->height*stripe/local->numStripes)/align*align;
+      uint32_t bottom=(stripe+1==local->numStripes)?setting->height:(uint32_t)((uint64_t)setting->height*(stripe+1)/local->numStripes)/align*align;
+      rect->x=0;
+      rect->y=top;
+      rect->width=setting->width;
+      rect->height=bottom-top;
+      ret=true;
+    }
+  }
+  return ret;
+}
+
+bool sharedImageStripeDone(struct SharedImage *image)
+{
+  bool ret=false;
+  if(sharedImageCheckInitialized(image))
+  {
+    SharedImageLocal *local=(SharedImageLocal *)sharedMemLocal((struct SharedMemory *)image);
+    uint32_t pending=sharedMemAtomicLoad32(&local->stripesPending);
+    // Extra calls find no pending stripe and leave the counter alone
+    while(pending && !sharedMemAtomicCompareExchange32(&local->stripesPending, pending, pending-1))
+      pending=sharedMemAtomicLoad32(&local->stripesPending);
+    if(pending==1) // Last stripe, writes of the other workers are visible
+      ret=sharedImageSend(image, &local->stripeSetting);
+  }
+  return ret;
+}
+
+uint32_t sharedImageNumLevels(struct SharedImage *image)
+{
+  uint32_t ret=0;
+  if(sharedImageCheckInitialized(image))
+  {
+    struct SharedMemory *shared=(struct SharedMemory *)image;
+    SharedImageLocal *local=(SharedImageLocal *)sharedMemLocal(shared);
+    if(local->lastPage>=0)
+    {
+      const SharedImagePageHeader *header=(const SharedImagePageHeader *)sharedMemPageHeader(shared, local->lastPage);
+      ret=(header->numLevels<header->numPlanes && header->numPlanes<=SHAREDIMAGE_MAX_PLANES)?header->numLevels+1:1;
+    }
+  }
+  return ret;
+}
+
+const void *sharedImageLevel(struct SharedImage *image, uint32_t level, const SharedImageSetting **setting)
+{
+  const void *ret=NULL;
+  if(level<sharedImageNumLevels(image))
+  {
+    struct SharedMemory *shared=(struct SharedMemory *)image;
+    SharedImageLocal *local=(SharedImageLocal *)sharedMemLocal(shared);
+    const SharedImagePageHeader *header=(const SharedImagePageHeader *)sharedMemPageHeader(shared, local->lastPage);
+    ret=(const void *)((const volatile uint8_t *)sharedMemPageData(shared, local->lastPage)+header->planes[level].offset);
+    if(setting)
+      *setting=&header->planes[level].setting;
+  }
+  return ret;
+}
+
+bool sharedImageReceivePlanes(struct SharedImage *image, void **frameData, const SharedImagePlane **planes, uint32_t *numPlanes)
+{
+  bool ret=sharedImageReceive(image, NULL, NULL);
+  if(ret)
+  {
+    struct SharedMemory *shared=(struct SharedMemory *)image;
+    SharedImageLocal *local=(SharedImageLocal *)sharedMemLocal(shared);
+    SharedImagePageHeader *header=(SharedImagePageHeader *)sharedMemPageHeader(shared, local->lastPage);
+    if(frameData)
+      *frameData=(void *)sharedMemPageData(shared, local->lastPage);
+    if(planes)
+      *planes=header->planes;
+    if(numPlanes)
+      *numPlanes=header->numPlanes;
+  }
+  return ret;
+}
+
+uint64_t sharedImageLayoutPlanes(SharedImagePlane *planes, uint32_t numPlanes)
+{
+  uint64_t ret=0;
+  bool valid=true;
+  for(uint32_t i=0;valid && i<numPlanes;i++)
+  {
+    uint64_t bytes=sharedImageFrameBytes(&planes[i].setting);
+    ret=(ret+SHAREDIMAGE_PLANE_ALIGN-1)/SHAREDIMAGE_PLANE_ALIGN*SHAREDIMAGE_PLANE_ALIGN;
+    planes[i].offset=(uint32_t)ret;
+    ret+=bytes;
+    valid=(bytes!=0 && ret<=UINT32_MAX);
+  }
+  return valid?ret:0;
+}
+
+bool sharedImageDestroy(struct SharedImage *image)
+{
+  struct SharedMemory *shared=(struct SharedMemory *)image;
+  SharedImageLocal *local=shared?(SharedImageLocal *)sharedMemLocal(shared):NULL;
+  if(local && local->attached) // The generator is notified when the last consumer leaves
+  {
+    volatile SharedImageHeader *header=(volatile SharedImageHeader *)sharedMemHeader(shared);
+    if(sharedMemAtomicAdd32(&header->consumers, (uint32_t)-1)==1)
+      sharedMemNotify(shared);
+  }
+  return sharedMemDestroy(shared);
+}
+
+#if defined(SHAREDMEM_WIN32)
+void *sharedImageNotificationHandle(struct SharedImage *image)
+{
+  return sharedMemNotificationHandle((struct SharedMemory *)image);
+}
+#endif
+
+const char *sharedImageGetError(struct SharedImage *image)
+{
+  return sharedMemGetError((struct SharedMemory *)image);
+}
+
+bool sharedImageWaitNotify(struct SharedImage *image, uint32_t timeoutMs)
+{
+  return sharedMemWaitNotify((struct SharedMemory *)image, timeoutMs);
+}
+
+bool sharedImageRequestFrame(struct SharedImage *image, uint64_t maxAgeUs)
+{
+  bool ret=false;
+  if(sharedImageCheckInitialized(image))
+  {
+    struct SharedMemory *shared=(struct SharedMemory *)image;
+    volatile SharedImageHeader *header=(volatile SharedImageHeader *)sharedMemHeader(shared);
+    uint64_t now=sharedMemTimestampUs();
+    sharedMemAtomicStore64(&header->consumerActivityUs, now);
+    sharedMemAtomicStore64(&header->requestNotBeforeUs, (maxAgeUs<now)?now-maxAgeUs:0);
+    sharedMemAtomicAdd32(&header->requests, 1);
+    ret=sharedMemNotify(shared);
+  }
+  return ret;
+}
+
+bool sharedImageFrameRequested(struct SharedImage *image)
+{
+  bool ret=false;
+  if(sharedImageCheckInitialized(image))
+  {
+    struct SharedMemory *shared=(struct SharedMemory *)image;
+    SharedImageLocal *local=(SharedImageLocal *)sharedMemLocal(shared);
+    volatile SharedImageHeader *header=(volatile SharedImageHeader *)sharedMemHeader(shared);
+    uint32_t requests=sharedMemAtomicLoad32(&header->requests);
+    if(requests!=sharedMemAtomicLoad32(&header->servedRequests))
+    {
+      ret=(local->lastSendUs<sharedMemAtomicLoad64(&header->requestNotBeforeUs) || !local->lastSendUs);
+      if(!ret) // The last frame is recent enough, so the request is served without sending again
+        sharedMemAtomicStore32(&header->servedRequests, requests);
+    }
+  }
+  return ret;
+}
+
+uint32_t sharedImageNumConsumers(struct SharedImage *image)
+{
+  uint32_t ret=0;
+  if(sharedImageCheckInitialized(image))
+    ret=sharedMemAtomicLoad32(&((volatile SharedImageHeader *)sharedMemHeader((struct SharedMemory *)image))->consumers);
+  return ret;
+}
+
+uint64_t sharedImageConsumerActivityUs(struct SharedImage *image)
+{
+  uint64_t ret=0;
+  if(sharedImageCheckInitialized(image))
+    ret=sharedMemAtomicLoad64(&((volatile SharedImageHeader *)sharedMemHeader((struct SharedMemory *)image))->consumerActivityUs);
+  return ret;
+}
+
+// Waits until no update is in progress and returns the even sequence. A sequence that stays odd for
+// SHAREDIMAGE_UPDATE_STALE_US is taken as left by a consumer that died while writing, and is closed:
+// the fields keep what that consumer wrote until then, each one still a valid value
+static uint32_t sharedImageStableSequence(volatile uint32_t *sequence)
+{
+  uint32_t ret=sharedMemAtomicLoad32(sequence);
+  uint64_t oddSinceUs=sharedMemTimestampUs();
+  while(ret&1)
+  {
+    uint32_t current;
+    if(sharedMemTimestampUs()-oddSinceUs>=SHAREDIMAGE_UPDATE_STALE_US)
+      sharedMemAtomicCompareExchange32(sequence, ret, ret+1); // Fails if the writer ended meanwhile
+    else
+      sharedImageYield();
+    current=sharedMemAtomicLoad32(sequence);
+    if(current!=ret) // Another update, the bound starts again
+      oddSinceUs=sharedMemTimestampUs();
+    ret=current;
+  }
+  return ret;
+}
+
+// Odd sequence while writing, excludes other consumers and tells the generator to read again.
+// Returns the even sequence the update started from
+static uint32_t sharedImageBeginUpdate(volatile uint32_t *sequence)
+{
+  uint32_t ret=sharedImageStableSequence(sequence);
+  while(!sharedMemAtomicCompareExchange32(sequence, ret, ret+1))
+    ret=sharedImageStableSequence(sequence);
+  return ret;
+}
+
+// False if the update was closed by another process because it took longer than SHAREDIMAGE_UPDATE_STALE_US
+static bool sharedImageEndUpdate(volatile uint32_t *sequence, uint32_t start)
+{
+  return sharedMemAtomicCompareExchange32(sequence, start+1, start+2);
+}
+
+bool sharedImageSetPreference(struct SharedImage *image, const SharedImagePreference *preference)
+{
+  bool ret=false;
+  if(sharedImageCheckInitialized(image))
+  {
+    struct SharedMemory *shared=(struct SharedMemory *)image;
+    volatile SharedImageHeader *header=(volatile SharedImageHeader *)sharedMemHeader(shared);
+    uint32_t sequence=sharedImageBeginUpdate(&header->preferenceSequence);
+    header->preference.width=preference?preference->width:0;
+    header->preference.height=preference?preference->height:0;
+    header->preference.format=preference?preference->format:SHAREDIMAGE_ANY_FORMAT;
+    header->preference.frameIntervalUs=preference?preference->frameIntervalUs:0;
+    ret=sharedImageEndUpdate(&header->preferenceSequence, sequence) && sharedMemNotify(shared);
+  }
+  return ret;
+}
+
+bool sharedImageGetPreference(struct SharedImage *image, SharedImagePreference *preference)
+{
+  bool ret=false;
+  if(sharedImageCheckInitialized(image) && preference)
+  {
+    struct SharedMemory *shared=(struct SharedMemory *)image;
+    SharedImageLocal *local=(SharedImageLocal *)sharedMemLocal(shared);
+    volatile SharedImageHeader *header=(volatile SharedImageHeader *)sharedMemHeader(shared);
+    for(uint32_t i=0;i<SHAREDIMAGE_PREFERENCE_RETRIES && !ret;i++)
+    {
+      uint32_t sequence=sharedImageStableSequence(&header->preferenceSequence);
+      preference->width=header->preference.width;
+      preference->height=header->preference.height;
+      preference->format=header->preference.format;
+      preference->frameIntervalUs=header->preference.frameIntervalUs;
+      sharedMemAtomicFence();
+      ret=(sharedMemAtomicLoad32(&header->preferenceSequence)==sequence);
+      if(ret)
+        local->preferenceSeen=sequence;
+    }
+  }
+  return ret;
+}
+
+bool sharedImagePreferenceChanged(struct SharedImage *image)
+{
+  bool ret=false;
+  if(sharedImageCheckInitialized(image))
+  {
+    struct SharedMemory *shared=(struct SharedMemory *)image;
+    SharedImageLocal *local=(SharedImageLocal *)sharedMemLocal(shared);
+    ret=(sharedMemAtomicLoad32(&((volatile SharedImageHeader *)sharedMemHeader(shared))->preferenceSequence)!=local->preferenceSeen);
+  }
+  return ret;
+}
+
+bool sharedImageSetRois(struct SharedImage *image, const SharedImageRect *rects, uint32_t numRects)
+{
+  bool ret=false;
+  if(sharedImageCheckInitialized(image) && numRects<=SHAREDIMAGE_MAX_ROIS && (rects || !numRects))
+  {
+    struct SharedMemory *shared=(struct SharedMemory *)image;
+    volatile SharedImageHeader *header=(volatile SharedImageHeader *)sharedMemHeader(shared);
+    uint32_t sequence=sharedImageBeginUpdate(&header->roiSequence);
+    header->numRois=numRects;
+    for(uint32_t i=0;i<numRects;i++)
+      header->rois[i]=rects[i];
+    ret=sharedImageEndUpdate(&header->roiSequence, sequence) && sharedMemNotify(shared);
+  }
+  return ret;
+}
+
+bool sharedImageGetRois(struct SharedImage *image, SharedImageRect *rects, uint32_t *numRects)
+{
+  bool ret=false;
+  if(sharedImageCheckInitialized(image) && rects && numRects)
+  {
+    struct SharedMemory *shared=(struct SharedMemory *)image;
+    SharedImageLocal *local=(SharedImageLocal *)sharedMemLocal(shared);
+    volatile SharedImageHeader *header=(volatile SharedImageHeader *)sharedMemHeader(shared);
+    for(uint32_t i=0;i<SHAREDIMAGE_PREFERENCE_RETRIES && !ret;i++)
+    {
+      uint32_t sequence=sharedImageStableSequence(&header->roiSequence);
+      uint32_t num=header->numRois;
+      *numRects=(num<=SHAREDIMAGE_MAX_ROIS)?num:SHAREDIMAGE_MAX_ROIS;
+      for(uint32_t j=0;j<*numRects;j++)
+        rects[j]=header->rois[j];
+      sharedMemAtomicFence();
+      ret=(sharedMemAtomicLoad32(&header->roiSequence)==sequence);
+      if(ret)
+        local->roisSeen=sequence;
+    }
+  }
+  return ret;
+}
+
+bool sharedImageRoiBounds(struct SharedImage *image, SharedImageRect *bounds)
+{
+  bool ret=false;
+  SharedImageRect rects[SHAREDIMAGE_MAX_ROIS];
+  uint32_t numRects;
+  if(bounds && sharedImageGetRois(image, rects, &numRects))
+  {
+    uint64_t right=0, bottom=0;
+    for(uint32_t i=0;i<numRects;i++)
+    {
+      if(rects[i].width && rects[i].height)
+      {
+        if(!ret || rects[i].x<bounds->x)
+          bounds->x=rects[i].x;
+        if(!ret || rects[i].y<bounds->y)
+          bounds->y=rects[i].y;
+        if((uint64_t)rects[i].x+rects[i].width>right)
+          right=(uint64_t)rects[i].x+rects[i].width;
+        if((uint64_t)rects[i].y+rects[i].height>bottom)
+          bottom=(uint64_t)rects[i].y+rects[i].height;
+        ret=true;
+      }
+    }
+    if(ret)
+    {
+      bounds->width=(uint32_t)(right-bounds->x);
+      bounds->height=(uint32_t)(bottom-bounds->y);
+    }
+  }
+  return ret;
+}
+
+bool sharedImageRoisChanged(struct SharedImage *image)
+{
+  bool ret=false;
+  if(sharedImageCheckInitialized(image))
+  {
+    struct SharedMemory *shared=(struct SharedMemory *)image;
+    SharedImageLocal *local=(SharedImageLocal *)sharedMemLocal(shared);
+    ret=(sharedMemAtomicLoad32(&((volatile SharedImageHeader *)sharedMemHeader(shared))->roiSequence)!=local->roisSeen);
+  }
+  return ret;
+}
+
+bool sharedImageCopyRoi(struct SharedImage *image, const SharedImageRect *rect, void *buffer, uint64_t bufferSize, SharedImageSetting *setting)
+{
+  bool ret=false;
+  struct SharedMemory *shared=(struct SharedMemory *)image;
+  SharedImageLocal *local=(SharedImageLocal *)sharedMemLocal(shared);
+  if(setting)
+    memset(setting, 0, sizeof(*setting));
+  if(sharedImageCheckInitialized(image) && local->lastPage>=0 && rect && setting)
+  {
+    volatile SharedImagePageHeader *header=(volatile SharedImagePageHeader *)sharedMemPageHeader(shared, local->lastPage);
+    SharedImageSetting frame=*(const SharedImageSetting *)&header->setting;
+    uint64_t offset=header->planes[0].offset, frameBytes=sharedImageFrameBytes(&frame);
+    uint32_t pixelBytes=sharedImagePixelBytes(frame.format);
+    // The header is written by the other process, so the frame is checked against the page before reading rows
+    bool valid=(frameBytes && offset+frameBytes<=sharedMemPageSize(shared, (uint32_t)local->lastPage));
+    if(valid && pixelBytes && rect->x<frame.width && rect->y<frame.height) // Clipped to the frame
+    {
+      setting->width=(rect->width<frame.width-rect->x)?rect->width:frame.width-rect->x;
+      setting->height=(rect->height<frame.height-rect->y)?rect->height:frame.height-rect->y;
+      setting->bytesPerLine=setting->width*pixelBytes;
+      setting->format=frame.format;
+      if(buffer && (uint64_t)setting->bytesPerLine*setting->height<=bufferSize)
+      {
+        const volatile uint8_t *from=(const volatile uint8_t *)sharedMemPageData(shared, local->lastPage)+offset+(size_t)rect->y*frame.bytesPerLine+(size_t)rect->x*pixelBytes;
+        for(uint32_t y=0;y<setting->height;y++)
+          memcpy((uint8_t *)buffer+(size_t)y*setting->bytesPerLine, (const void *)(from+(size_t)y*frame.bytesPerLine), setting->bytesPerLine);
+        ret=true;
+      }
+    }
+  }
+  return ret;
+}
+
+uint32_t sharedImageMode(struct SharedImage *image)
+{
+  uint32_t ret=SharedImageModeLatest;
+  if(sharedImageCheckInitialized(image))
+    ret=((SharedImageHeader *)sharedMemHeader((struct SharedMemory *)image))->mode;
+  return ret;
+}
+
+bool sharedImageQueueFull(struct SharedImage *image)
+{
+  bool ret=false;
+  if(sharedImageCheckInitialized(image))
+  {
+    struct SharedMemory *shared=(struct SharedMemory *)image;
+    SharedImageLocal *local=(SharedImageLocal *)sharedMemLocal(shared);
+    if(((SharedImageHeader *)sharedMemHeader(shared))->mode!=SharedImageModeTriple)
+      ret=(local->lastPage<0 && sharedMemGetFreePage(shared, 0)<0);
+  }
+  return ret;
+}
+
+uint32_t sharedImageFormatMinBytesPerLine(uint32_t format, uint32_t width)
+{
+  uint32_t ret=0;
+  switch(format)
+  {
+    case SharedImageFormatGray8:
+    case SharedImageFormatNV12:
+    case SharedImageFormatI420:
+      ret=width;
+      break;
+    case SharedImageFormatGray16:
+      ret=width*2;
+      break;
+    case SharedImageFormatYUYV:
+      ret=(width+1)/2*4;
+      break;
+    case SharedImageFormatRGB24:
+    case SharedImageFormatBGR24:
+      ret=width*3;
+      break;
+    case SharedImageFormatBGRA:
+    case SharedImageFormatRGBA:
+      ret=width*4;
+      break;
+    case SharedImageFormatRGBA16F:
+      ret=width*8;
+      break;
+    case SharedImageFormatRGBA32F:
+      ret=width*16;
+      break;
+  }
+  return ret;
+}
+
+uint64_t sharedImageFrameBytes(const SharedImageSetting *setting)
+{
+  uint64_t ret=0;
+  uint32_t minBytesPerLine=sharedImageFormatMinBytesPerLine(setting->format, setting->width);
+  if(minBytesPerLine && setting->bytesPerLine>=minBytesPerLine)
+  {
+    uint64_t chromaLines=(setting->height+1)/2;
+    ret=(uint64_t)setting->bytesPerLine*setting->height;
+    if(setting->format==SharedImageFormatNV12)
+      ret+=setting->bytesPerLine*chromaLines;
+    else if(setting->format==SharedImageFormatI420)
+      ret+=2*((setting->bytesPerLine+1)/2)*chromaLines;
+  }
+  return ret;
+}
+
+uint32_t sharedImagePageSize(struct SharedImage *image)
+{
+  const SharedMemInfo *info=sharedMemInfo((struct SharedMemory *)image);
+  return info?info->pageSize:0;
+}
+
+const SharedImageFrameInfo *sharedImageFrameInfo(struct SharedImage *image)
+{
+  const SharedImageFrameInfo *ret=NULL;
+  if(sharedImageCheckInitialized(image))
+  {
+    struct SharedMemory *shared=(struct SharedMemory *)image;
+    SharedImageLocal *local=(SharedImageLocal *)sharedMemLocal(shared);
+    if(local->lastPage>=0)
+      ret=(const SharedImageFrameInfo *)&((SharedImagePageHeader *)sharedMemPageHeader(shared, local->lastPage))->info;
+  }
+  return ret;
+}
+
+uint32_t sharedImageDirtyRects(struct SharedImage *image, const SharedImageRect **rects)
+{
+  uint32_t ret=0;
+  if(sharedImageCheckInitialized(image))
+  {
+    struct SharedMemory *shared=(struct SharedMemory *)image;
+    SharedImageLocal *local=(SharedImageLocal *)sharedMemLocal(shared);
+    if(local->lastPage>=0 && local->previousReceived)
+    {
+      SharedImagePageHeader *header=(SharedImagePageHeader *)sharedMemPageHeader(shared, local->lastPage);
+      if(header->info.sequence==local->previousSequence+1) // Rectangles are relative to the previous frame only
+      {
+        ret=header->numDirtyRects;
+        if(rects)
+          *rects=header->dirtyRects;
+      }
+    }
+  }
+  return ret;
+}
+
+static uint32_t sharedImageMetadataRecordBytes(uint32_t length)
+{
+  return (uint32_t)sizeof(SharedImageMetadata)+(length+SHAREDIMAGE_METADATA_ALIGN-1)/SHAREDIMAGE_METADATA_ALIGN*SHAREDIMAGE_METADATA_ALIGN;
+}
+
+uint32_t sharedImageMetadataCapacity(struct SharedImage *image)
+{
+  const SharedMemInfo *info=sharedMemInfo((struct SharedMemory *)image);
+  return (info && info->pageHeaderSize>sizeof(SharedImagePageHeader))?info->pageHeaderSize-(uint32_t)sizeof(SharedImagePageHeader):0;
+}
+
+void *sharedImageMetadataAdd(struct SharedImage *image, uint32_t type, uint32_t length)
+{
+  void *ret=NULL;
+  if(sharedImageCheckInitialized(image))
+  {
+    struct SharedMemory *shared=(struct SharedMemory *)image;
+    SharedImageLocal *local=(SharedImageLocal *)sharedMemLocal(shared);
+    if(local->lastPage>=0)
+    {
+      volatile SharedImagePageHeader *header=(volatile SharedImagePageHeader *)sharedMemPageHeader(shared, local->lastPage);
+      uint64_t used=header->metadataBytes;
+      if(length<=UINT32_MAX-2*SHAREDIMAGE_METADATA_ALIGN && used+sharedImageMetadataRecordBytes(length)<=sharedImageMetadataCapacity(image))
+      {
+        SharedImageMetadata *record=(SharedImageMetadata *)((uint8_t *)header+sizeof(SharedImagePageHeader)+used);
+        record->type=type;
+        record->length=length;
+        header->metadataBytes=(uint32_t)(used+sharedImageMetadataRecordBytes(length));
+        ret=record+1;
+      }
+    }
+  }
+  return ret;
+}
+
+const SharedImageMetadata *sharedImageMetadataNext(struct SharedImage *image, const SharedImageMetadata *previous)
+{
+  const SharedImageMetadata *ret=NULL;
+  if(sharedImageCheckInitialized(image))
+  {
+    struct SharedMemory *shared=(struct SharedMemory *)image;
+    SharedImageLocal *local=(SharedImageLocal *)sharedMemLocal(shared);
+    if(local->lastPage>=0)
+    {
+      const SharedImagePageHeader *header=(const SharedImagePageHeader *)sharedMemPageHeader(shared, local->lastPage);
+      const uint8_t *area=(const uint8_t *)header+sizeof(SharedImagePageHeader);
+      uint64_t used=header->metadataBytes, offset=0;
+      if(used>sharedImageMetadataCapacity(image)) // Never trusts the other process
+        used=sharedImageMetadataCapacity(image);
+      if(previous)
+        offset=(uint64_t)((const uint8_t *)previous-area)+sizeof(SharedImageMetadata)+(previous->length+(uint64_t)SHAREDIMAGE_METADATA_ALIGN-1)/SHAREDIMAGE_METADATA_ALIGN*SHAREDIMAGE_METADATA_ALIGN;
+      if(offset+sizeof(SharedImageMetadata)<=used)
+      {
+        const SharedImageMetadata *record=(const SharedImageMetadata *)(area+offset);
+        if(offset+sizeof(SharedImageMetadata)+record->length<=used)
+          ret=record;
+      }
+    }
+  }
+  return ret;
+}
+
+const void *sharedImageMetadataFind(struct SharedImage *image, uint32_t type, uint32_t *length)
+{
+  const SharedImageMetadata *record=sharedImageMetadataNext(image, NULL);
+  while(record && record->type!=type)
+    record=sharedImageMetadataNext(image, record);
+  if(record && length)
+    *length=record->length;
+  return record?(const void *)(record+1):NULL;
+}
+
+uint64_t sharedImageTimestampUs(void)
+{
+  return sharedMemTimestampUs();
 }
@@ -23,19 +23,155 @@ extern "C"
 {
 #endif
 
+/// @brief Alignment of image buffers in newly created shared images
+#define SHAREDIMAGE_PAGE_ALIGN 4096
+/// @brief Maximum number of dirty rectangles of a frame
+#define SHAREDIMAGE_MAX_DIRTY_RECTS 16
+/// @brief Maximum number of planes of a frame
+#define SHAREDIMAGE_MAX_PLANES 4
+/// @brief Alignment of planes placed by sharedImageLayoutPlanes
+#define SHAREDIMAGE_PLANE_ALIGN 64
+/// @brief Deadline of sharedImageOutBufferWait that never expires
+#define SHAREDIMAGE_WAIT_FOREVER UINT64_MAX
+/// @brief Maximum number of regions of interest of a shared image
+#define SHAREDIMAGE_MAX_ROIS 8
+/// @brief Format of SharedImagePreference accepting any format
+#define SHAREDIMAGE_ANY_FORMAT 0xFFFFFFFF
+
 /** @struct SharedMemory
  *  @brief Opaque pointer representing a shared image object
  */
 struct SharedImage;
 
+/**
+ * @brief Pixel formats of a shared image
+ *
+ * Planar formats store the planes one after the other in the same buffer: bytesPerLine is the stride of the first plane.
+ */
+typedef enum
+{
+  SharedImageFormatBGRA=0,  ///< 32 bits per pixel, bytes B,G,R,A (QImage::Format_ARGB32 on little endian hosts)
+  SharedImageFormatGray8,   ///< 8 bits per pixel
+  SharedImageFormatGray16,  ///< 16 bits per pixel, host byte order
+  SharedImageFormatRGB24,   ///< 24 bits per pixel, bytes R,G,B
+  SharedImageFormatBGR24,   ///< 24 bits per pixel, bytes B,G,R
+  SharedImageFormatRGBA,    ///< 32 bits per pixel, bytes R,G,B,A
+  SharedImageFormatRGBA16F, ///< 64 bits per pixel, half float R,G,B,A
+  SharedImageFormatRGBA32F, ///< 128 bits per pixel, float R,G,B,A
+  SharedImageFormatYUYV,    ///< 4:2:2 packed, bytes Y0,U,Y1,V for each couple of pixels
+  SharedImageFormatNV12,    ///< 4:2:0, Y plane followed by interleaved U,V plane of (height+1)/2 lines with the same stride
+  SharedImageFormatI420,    ///< 4:2:0, Y plane followed by U and V planes of (height+1)/2 lines with half stride
+  SharedImageFormatCount
+} SharedImageFormat;
+
 /// @brief Settings for a shared image
 typedef struct
 {
   uint32_t width;
   uint32_t height;
   uint32_t bytesPerLine;
+  uint32_t format;       ///< One of SharedImageFormat, 0 (BGRA) if not set
 } SharedImageSetting;
 
+/**
+ * @brief An image inside a multi-plane frame
+ *
+ * Each plane has its own format, size and stride, and lives at offset bytes from the start of the buffer.
+ */
+typedef struct
+{
+  SharedImageSetting setting;
+  uint32_t offset; ///< Offset of plane data from the start of the buffer, in bytes
+} SharedImagePlane;
+
+/// @brief Delivery modes of a shared image
+typedef enum
+{
+  SharedImageModeLatest=0, ///< The consumer always receives the newest frame, older frames are dropped
+  SharedImageModeFifo,     ///< Frames are delivered in order without drops, the generator waits when the queue is full
+  SharedImageModeTriple    ///< Lock-free triple buffer with latest-frame semantic, the generator never waits (always 3 buffers)
+} SharedImageMode;
+
+/// @brief Configuration of a new shared image
+typedef struct
+{
+  uint32_t numBytes;   ///< Number of bytes allocated for each image buffer
+  uint32_t numBuffers; ///< Number of image buffers (minimum 2, 0 for default). In FIFO mode the queue depth is numBuffers-1, ignored in triple buffer mode
+  uint32_t mode;       ///< One of SharedImageMode
+  uint32_t metadataBytes; ///< Bytes reserved in each buffer for metadata records (see sharedImageMetadataAdd), 0 for none
+  uint32_t largeBytes; ///< Number of bytes allocated for each large buffer
+  uint32_t numLargeBuffers; ///< Number of large buffers in addition to numBuffers (see sharedImageOutBufferFit), ignored in triple buffer mode
+} SharedImageConfig;
+
+/// @brief Information stamped by the library on each sent frame
+typedef struct
+{
+  uint64_t sequence;    ///< Sequence number, increased by one for each frame sent on the shared image (see sharedImageSendForward)
+  uint64_t timestampUs; ///< Time of send, see sharedImageTimestampUs; for forwarded frames the one of the original send
+} SharedImageFrameInfo;
+
+/// @brief Rectangle of an image, in pixels
+typedef struct
+{
+  uint32_t x;
+  uint32_t y;
+  uint32_t width;
+  uint32_t height;
+} SharedImageRect;
+
+/**
+ * @brief Frames a consumer would like to receive, published with sharedImageSetPreference
+ *
+ * It is a hint: the generator may ignore it, and consumers must handle any frame.
+ */
+typedef struct
+{
+  uint32_t width;           ///< Preferred width, 0 for any
+  uint32_t height;          ///< Preferred height, 0 for any
+  uint32_t format;          ///< Preferred SharedImageFormat, SHAREDIMAGE_ANY_FORMAT for any
+  uint32_t frameIntervalUs; ///< Preferred time between frames, 0 for as fast as possible
+} SharedImagePreference;
+
+/// @brief Types of metadata records, values up to SharedImageMetadataUser are reserved
+typedef enum
+{
+  SharedImageMetadataExposureUs=1,  ///< uint32_t, exposure time in microseconds
+  SharedImageMetadataGain,          ///< float, linear gain
+  SharedImageMetadataSensorTimestamp, ///< uint64_t, capture time in the clock of the sensor, in nanoseconds
+  SharedImageMetadataRoiTag,        ///< SharedImageRect followed by a UTF-8 tag (not terminated)
+  SharedImageMetadataUser=0x10000   ///< First type available to applications
+} SharedImageMetadataType;
+
+/// @brief Header of a metadata record, followed by length bytes of data aligned to 8 bytes
+typedef struct
+{
+  uint32_t type;   ///< One of SharedImageMetadataType or an application type
+  uint32_t length; ///< Bytes of data
+} SharedImageMetadata;
+
+/// @brief Results of sharedImagePeek
+typedef enum
+{
+  SharedImagePeekNoFrame=0, ///< No frame was sent yet
+  SharedImagePeekOk,        ///< The frame was copied
+  SharedImagePeekTorn,      ///< The generator reused the page while it was read, retry
+  SharedImagePeekTooSmall   ///< The frame does not fit the buffer, setting holds its layout
+} SharedImagePeekResult;
+
+/**
+ * @brief A frame held by the consumer, see sharedImageAcquire
+ *
+ * Data of plane i is at frameData+planes[i].offset. All fields are valid until the lease is released.
+ */
+typedef struct
+{
+  void *frameData;                  ///< Start of the frame buffer
+  const SharedImagePlane *planes;   ///< Planes of the frame
+  uint32_t numPlanes;               ///< Number of planes
+  const SharedImageFrameInfo *info; ///< Sequence and timestamp of the frame
+  int32_t page;                     ///< Page held by the lease, -1 if the lease is not valid
+} SharedImageLease;
+
 /**
  * @brief Creates a shared image object
  *
@@ -48,6 +184,32 @@ typedef struct
  */
 bool sharedImageCreate(const char *utf8Name, struct SharedImage **image, uint32_t numPixels, bool generator);
 
+/**
+ * @brief Creates a shared image object with buffers of a given size in bytes
+ *
+ * Same as sharedImageCreate, but buffers are sized for any format (see sharedImageFrameBytes).
+ * @param utf8Name Name of the shared object
+ * @param image Pointer that will receive a pointer to the created object
+ * @param numBytes Number of bytes that should be allocated for each image
+ * @param generator True if we are creating the generator object, false if the consumer is being created
+ * @return True on success
+ */
+bool sharedImageCreateBytes(const char *utf8Name, struct SharedImage **image, uint32_t numBytes, bool generator);
+
+/**
+ * @brief Creates a shared image object with a configuration
+ *
+ * The configuration is used only if the shared image is created by this call: when it already exists
+ * (the other process created it) its mode and number of buffers are the ones chosen by the creator.
+ * Note that even on error an object may be returned and it can be only checked for error
+ * @param utf8Name Name of the shared object
+ * @param config Configuration of the shared image
+ * @param image Pointer that will receive a pointer to the created object
+ * @param generator True if we are creating the generator object, false if the consumer is being created
+ * @return True on success
+ */
+bool sharedImageCreateConfig(const char *utf8Name, const SharedImageConfig *config, struct SharedImage **image, bool generator);
+
 /**
  * @brief Destroys a shared image object
  * @param image The object to destroy
@@ -78,6 +240,9 @@ bool sharedImageReceive(struct SharedImage *image, void **imageData, const Share
 
 /**
  * @brief Called by producer to returns an output buffer for the generated image
+ *
+ * In FIFO mode false is returned when the queue is full (see sharedImageQueueFull): the consumer notifies
+ * the generator each time it releases a buffer, so sharedImageWaitNotify can be used to wait for one.
  * @param image Shared image object
  * @param imageData Pointer to the returned pointer to output buffer that should be used
  * @param availablePixels Pointer that will be filled with number of pixels available in
@@ -85,16 +250,258 @@ bool sharedImageReceive(struct SharedImage *image, void **imageData, const Share
  */
 bool sharedImageOutBuffer(struct SharedImage *image, void **imageData, uint32_t *availablePixels);
 
+/**
+ * @brief Called by producer to returns an output buffer for the generated image
+ *
+ * Same as sharedImageOutBuffer, with the size of the buffer in bytes.
+ * @param image Shared image object
+ * @param imageData Pointer to the returned pointer to output buffer that should be used
+ * @param availableBytes Pointer that will be filled with number of bytes available in the buffer
+ * @return True if a send buffer is available to generator
+ */
+bool sharedImageOutBufferBytes(struct SharedImage *image, void **imageData, uint32_t *availableBytes);
+
+/**
+ * @brief Called by producer to get the smallest output buffer holding a frame
+ *
+ * Shared images created with large buffers (see SharedImageConfig) have buffers of two sizes, so a channel
+ * sending both small previews and large stills does not need to size all the buffers for the stills.
+ * sharedImageOutBufferBytes returns any free buffer, standard ones first.
+ * @param image Shared image object
+ * @param neededBytes Size of the frame, in bytes
+ * @param imageData Pointer to the returned pointer to output buffer that should be used
+ * @param availableBytes Pointer that will be filled with number of bytes available in the buffer
+ * @return True if a free buffer of at least neededBytes is available to generator
+ */
+bool sharedImageOutBufferFit(struct SharedImage *image, uint32_t neededBytes, void **imageData, uint32_t *availableBytes);
+
+/**
+ * @brief Called by producer to get an output buffer, waiting until the consumer releases one
+ *
+ * Same as sharedImageOutBufferBytes, but when all buffers are in use the call sleeps on the notifications
+ * of the consumer instead of failing, so a producer can run as fast as the consumer allows without polling.
+ * The wait ends early when the consumer signals something else through the same notification: a frame request,
+ * a consumer arriving or leaving, a new preference or new regions of interest. The caller then checks them
+ * (sharedImageFrameRequested, sharedImageNumConsumers, sharedImagePreferenceChanged, sharedImageRoisChanged) and calls again.
+ * @param image Shared image object
+ * @param imageData Pointer to the returned pointer to output buffer that should be used
+ * @param availableBytes Pointer that will be filled with number of bytes available in the buffer
+ * @param deadlineUs Time to give up, in the clock of sharedImageTimestampUs (SHAREDIMAGE_WAIT_FOREVER to wait without limit)
+ * @param waitedUs Will be filled with the time spent waiting for the consumer (backpressure), may be NULL
+ * @return True if a send buffer is available to generator, false if the deadline expired or the consumer signaled something else
+ */
+bool sharedImageOutBufferWait(struct SharedImage *image, void **imageData, uint32_t *availableBytes, uint64_t deadlineUs, uint64_t *waitedUs);
+
 /**
  * @brief Sends an image from producer to the consumer
  *
  * Use this function after sucessufully getting a output buffer with sharedImageOutBuffer
  * @param image Shared image object
  * @param setting Settings for the image that was put in the buffer
- * @return True on success
+ * @return True on success, false if the setting is not valid or the image does not fit the buffer
  */
 bool sharedImageSend(struct SharedImage *image, const SharedImageSetting *setting);
 
+/**
+ * @brief Sends an image received from another channel, keeping its sequence and timestamp
+ *
+ * Meant for bridges and relays, so that consumers see the sequence and timestamp of the original frame.
+ * A sequence not greater than the ones already sent is replaced by the next one, as consumers rely on increasing sequences.
+ * @param image Shared image object
+ * @param setting Settings for the image that was put in the buffer
+ * @param info Sequence and timestamp of the original frame
+ * @return True on success, false if the setting is not valid or the image does not fit the buffer
+ */
+bool sharedImageSendForward(struct SharedImage *image, const SharedImageSetting *setting, const SharedImageFrameInfo *info);
+
+/**
+ * @brief Called by producer to get an output buffer holding the previous frame
+ *
+ * Same as sharedImageOutBufferBytes, but the buffer is brought up to date with the last sent frame,
+ * copying only the regions changed since the buffer was last used (as told by sharedImageSendDirty).
+ * The producer then needs to write only the changed regions and send them with sharedImageSendDirty.
+ * Regions are tracked for formats with whole bytes per pixel: for YUV formats the whole frame is copied.
+ * The buffer is one that can hold the previous frame, see sharedImageOutBufferFit.
+ * @param image Shared image object
+ * @param imageData Pointer to the returned pointer to output buffer that should be used
+ * @param availableBytes Pointer that will be filled with number of bytes available in the buffer
+ * @return True if a send buffer is available to generator, false with an error if no free buffer can hold the previous frame
+ */
+bool sharedImageOutBufferDelta(struct SharedImage *image, void **imageData, uint32_t *availableBytes);
+
+/**
+ * @brief Sends an image from producer to the consumer, telling which regions changed from the previous frame
+ *
+ * The rectangles are stored with the frame and passed to the consumer (see sharedImageDirtyRects).
+ * With no rectangles, more than SHAREDIMAGE_MAX_DIRTY_RECTS or a setting different from the previous frame the whole frame is considered changed.
+ * @param image Shared image object
+ * @param setting Settings for the image that was put in the buffer
+ * @param rects Changed regions, clipped to the image
+ * @param numRects Number of rectangles
+ * @return True on success, false if the setting is not valid or the image does not fit the buffer
+ */
+bool sharedImageSendDirty(struct SharedImage *image, const SharedImageSetting *setting, const SharedImageRect *rects, uint32_t numRects);
+
+/**
+ * @brief Sends a frame made of several planes from producer to the consumer
+ *
+ * All the planes are written in the same buffer (returned by sharedImageOutBufferBytes) and published together,
+ * so the consumer always gets a consistent set. Consumers using sharedImageReceive see the first plane only.
+ * @param image Shared image object
+ * @param planes Planes of the frame, see sharedImageLayoutPlanes to place them
+ * @param numPlanes Number of planes, from 1 to SHAREDIMAGE_MAX_PLANES
+ * @return True on success, false if a plane is not valid, planes overlap or do not fit the buffer
+ */
+bool sharedImageSendPlanes(struct SharedImage *image, const SharedImagePlane *planes, uint32_t numPlanes);
+
+/**
+ * @brief Receives a frame on consumer side and holds it until sharedImageRelease
+ *
+ * Unlike sharedImageReceive, the frame stays valid after the next receive or acquire, so a consumer can hold
+ * several frames at once (e.g. to process them in a pipeline) without copying them. Frames are returned as
+ * sharedImageReceive does: the newest one in latest mode, dropping older ones, the oldest one in FIFO mode.
+ * Each held frame is a buffer the generator cannot use, so the number of leases is limited (see sharedImageSetMaxLeases).
+ * Leases are acquired by a single thread, and can be released in any order from any thread. Not supported in triple buffer mode.
+ * @param image Shared image object (consumer)
+ * @param lease Will be filled with the frame, page is -1 on failure
+ * @return True if a frame was acquired, false if no new frame is available or all the leases are in use
+ */
+bool sharedImageAcquire(struct SharedImage *image, SharedImageLease *lease);
+
+/**
+ * @brief Releases a frame acquired with sharedImageAcquire, giving the buffer back to the generator
+ * @param image Shared image object (consumer)
+ * @param lease Lease to release, its page is set to -1
+ * @return True on success, false if the lease is not valid
+ */
+bool sharedImageRelease(struct SharedImage *image, SharedImageLease *lease);
+
+/**
+ * @brief Limits the number of frames held by leases
+ *
+ * The limit is never more than the number of buffers minus one, which is also the default.
+ * @param image Shared image object (consumer)
+ * @param maxLeases Maximum number of leases, 0 for the default
+ * @return True if the limit is maxLeases, false if it was clamped
+ */
+bool sharedImageSetMaxLeases(struct SharedImage *image, uint32_t maxLeases);
+
+/**
+ * @brief Receives a frame on consumer side, with all its planes
+ *
+ * Same as sharedImageReceive, frames sent with a single image are returned as one plane at offset 0.
+ * Data of plane i is at frameData+planes[i].offset. The returned values will be valid until the next successful receive.
+ * @param image Shared image object
+ * @param frameData Pointer to returned buffer
+ * @param planes Will be filled with a pointer to the planes of the frame
+ * @param numPlanes Will be filled with the number of planes
+ * @return True on success
+ */
+bool sharedImageReceivePlanes(struct SharedImage *image, void **frameData, const SharedImagePlane **planes, uint32_t *numPlanes);
+
+/**
+ * @brief Sends an image from producer to the consumer together with downscaled copies of it
+ *
+ * Same as sharedImageSendDirty, levels[0] is the image and the following levels are copies with
+ * half the size of the previous one (see sharedImageBuildPyramid). Consumers that show a small view
+ * can read only the level they need with sharedImageLevel. Dirty rectangles refer to levels[0].
+ * @param image Shared image object
+ * @param levels Levels of the image, levels[0] must be at offset 0
+ * @param numLevels Number of levels, from 1 to SHAREDIMAGE_MAX_PLANES
+ * @param rects Changed regions, clipped to the image
+ * @param numRects Number of rectangles
+ * @return True on success, false if a level is not valid, levels overlap or do not fit the buffer
+ */
+bool sharedImageSendPyramid(struct SharedImage *image, const SharedImagePlane *levels, uint32_t numLevels, const SharedImageRect *rects, uint32_t numRects);
+
+/**
+ * @brief Sends a frame before it is written, so the consumer can process rows as they are completed
+ *
+ * The buffer returned by sharedImageOutBuffer is published at once with no completed rows. The generator then
+ * keeps writing it from top to bottom, publishing progress with sharedImageSendRows; the frame is complete
+ * when all its rows are done, and no other frame can be sent before. Consumers that do not check
+ * sharedImageRowsDone should not receive from images sending partial frames.
+ * @param image Shared image object (generator)
+ * @param setting Settings of the frame
+ * @return True on success, false if the setting is not valid, the image does not fit the buffer or a partial frame is not complete
+ */
+bool sharedImageSendPartial(struct SharedImage *image, const SharedImageSetting *setting);
+
+/**
+ * @brief Publishes the rows written in the frame sent with sharedImageSendPartial
+ *
+ * The consumer is notified, so the number of calls per frame trades latency for overhead.
+ * @param image Shared image object (generator)
+ * @param rowsDone Number of rows written from the top of the frame (with their chroma for 4:2:0 formats), the height of the frame to complete it
+ * @return True on success, false if no partial frame is being written
+ */
+bool sharedImageSendRows(struct SharedImage *image, uint32_t rowsDone);
+
+/**
+ * @brief Prepares the buffer returned by sharedImageOutBuffer to be filled by several threads
+ *
+ * The frame is split in numStripes horizontal stripes (see sharedImageStripeRows). Each worker fills its stripes
+ * and calls sharedImageStripeDone for each of them; the call completing the last stripe sends the frame,
+ * so nobody has to wait for the workers. The send runs on the thread of that worker: until it returns true,
+ * only sharedImageStripeRows and sharedImageStripeDone may be called on the image, from any thread. The worker
+ * must then let the producer thread know (e.g. through the queue feeding the workers) before the producer
+ * uses the image again.
+ * @param image Shared image object (generator)
+ * @param setting Settings of the frame
+ * @param numStripes Number of stripes, from 1 to the height of the frame
+ * @return True on success, false if no buffer was acquired, the setting is not valid or stripes are already pending
+ */
+bool sharedImageSendStripes(struct SharedImage *image, const SharedImageSetting *setting, uint32_t numStripes);
+
+/**
+ * @brief Returns the rows of a stripe of the frame prepared with sharedImageSendStripes
+ *
+ * Stripes have about the same height and cover the frame. For NV12 and I420 they start on even rows,
+ * and the worker also fills the chroma rows of its stripe.
+ * @param image Shared image object (generator)
+ * @param stripe Index of stripe, from 0 to numStripes-1
+ * @param rect Will be filled with the rows of the stripe
+ * @return True on success
+ */
+bool sharedImageStripeRows(struct SharedImage *image, uint32_t stripe, SharedImageRect *rect);
+
+/**
+ * @brief Marks a stripe as filled, can be called from any thread
+ *
+ * Must be called exactly once for each stripe, calls beyond the number of stripes return false.
+ * @param image Shared image object (generator)
+ * @return True if this call completed the frame and sent it, false if the send failed or other stripes are pending
+ */
+bool sharedImageStripeDone(struct SharedImage *image);
+
+/**
+ * @brief Returns the number of levels of the frame returned by the last successful call to sharedImageReceive
+ * @param image Shared image object (consumer)
+ * @return Number of levels, 1 for frames sent without pyramid, 0 if no frame was received
+ */
+uint32_t sharedImageNumLevels(struct SharedImage *image);
+
+/**
+ * @brief Returns a level of the frame returned by the last successful call to sharedImageReceive
+ *
+ * The returned pointers have the same validity of the image data.
+ * @param image Shared image object (consumer)
+ * @param level Level, 0 for the full resolution image
+ * @param setting Will be filled with a pointer to the settings of the level
+ * @return Pointer to data of the level, NULL if the level does not exist
+ */
+const void *sharedImageLevel(struct SharedImage *image, uint32_t level, const SharedImageSetting **setting);
+
+/**
+ * @brief Places planes one after the other in a buffer
+ *
+ * Sets the offset of each plane, aligned to SHAREDIMAGE_PLANE_ALIGN.
+ * @param planes Planes, with setting already filled
+ * @param numPlanes Number of planes
+ * @return Bytes needed for all the planes, 0 if a setting is not valid
+ */
+uint64_t sharedImageLayoutPlanes(SharedImagePlane *planes, uint32_t numPlanes);
+
 /**
  * @brief Waits for a notification
  * @param shared Shared memory
@@ -103,6 +510,260 @@ bool sharedImageSend(struct SharedImage *image, const SharedImageSetting *settin
  */
 bool sharedImageWaitNotify(struct SharedImage *image, uint32_t timeoutMs);
 
+/**
+ * @brief Asks the generator for a frame (pull mode)
+ *
+ * Generators that render on demand check sharedImageFrameRequested and render only when a consumer asked,
+ * instead of producing frames nobody will look at. The generator is notified, and the frame is
+ * received as usual. A new request replaces a pending one.
+ * @param image Shared image object (consumer)
+ * @param maxAgeUs The request is satisfied by a frame sent at most maxAgeUs before this call, 0 for a frame sent after it
+ * @return True on success
+ */
+bool sharedImageRequestFrame(struct SharedImage *image, uint64_t maxAgeUs);
+
+/**
+ * @brief Checks if the consumer asked for a frame that was not sent yet
+ *
+ * The request is served by the next successful send, or at once if the last sent frame is recent enough for it.
+ * Use sharedImageWaitNotify to wait for requests.
+ * @param image Shared image object (generator)
+ * @return True if a frame should be rendered and sent
+ */
+bool sharedImageFrameRequested(struct SharedImage *image);
+
+/**
+ * @brief Returns the number of consumers attached to a shared image
+ *
+ * Consumers are counted from their first successful call until sharedImageDestroy. The generator is notified
+ * when the first consumer arrives and when the last one leaves, so it can sleep in sharedImageWaitNotify
+ * while nobody is watching. A consumer that crashed is never removed, see sharedImageConsumerActivityUs.
+ * @param image Shared image object
+ * @return Number of attached consumers
+ */
+uint32_t sharedImageNumConsumers(struct SharedImage *image);
+
+/**
+ * @brief Returns the time of the last activity of consumers
+ *
+ * Updated on attach, on each sharedImageReceive (even without a new frame) and on each sharedImageRequestFrame.
+ * @param image Shared image object
+ * @return Timestamp in sharedImageTimestampUs time base, 0 if no consumer was ever attached
+ */
+uint64_t sharedImageConsumerActivityUs(struct SharedImage *image);
+
+/**
+ * @brief Publishes the frames the consumer would like to receive
+ *
+ * A consumer showing a scaled down view publishes its size, so generators that can render at any size
+ * send only the needed pixels. The generator is notified. With more consumers, the last preference wins.
+ * @param image Shared image object (consumer)
+ * @param preference Wanted frames, NULL to clear the preference
+ * @return True on success, false if the update was stalled for so long that another process took it as abandoned
+ */
+bool sharedImageSetPreference(struct SharedImage *image, const SharedImagePreference *preference);
+
+/**
+ * @brief Reads the preference published by the consumer
+ *
+ * If no preference was published, all fields are "any". Waits while a consumer is writing the preference;
+ * an update left by a consumer that died while writing is closed after a fraction of a second.
+ * @param image Shared image object (generator)
+ * @param preference Will be filled with the preference
+ * @return True on success, false if the preference kept changing while being read
+ */
+bool sharedImageGetPreference(struct SharedImage *image, SharedImagePreference *preference);
+
+/**
+ * @brief Checks if the consumer published a preference not yet read with sharedImageGetPreference
+ * @param image Shared image object (generator)
+ * @return True if the preference changed
+ */
+bool sharedImagePreferenceChanged(struct SharedImage *image);
+
+/**
+ * @brief Publishes the regions of the frame the consumer looks at
+ *
+ * Generators may skip rendering or copying outside the regions (see sharedImageRoiBounds), so the consumer
+ * must not rely on pixels outside them. The generator is notified. With more consumers, the last call wins.
+ * @param image Shared image object (consumer)
+ * @param rects Regions of interest, in pixels of the first plane
+ * @param numRects Number of regions, up to SHAREDIMAGE_MAX_ROIS; 0 if the whole frame is used
+ * @return True on success, false if the parameters are not valid or the update was stalled for so long that another process took it as abandoned
+ */
+bool sharedImageSetRois(struct SharedImage *image, const SharedImageRect *rects, uint32_t numRects);
+
+/**
+ * @brief Reads the regions of interest published by the consumer
+ * @param image Shared image object (generator)
+ * @param rects Array of SHAREDIMAGE_MAX_ROIS rectangles, will be filled with the regions
+ * @param numRects Will be filled with the number of regions, 0 if the whole frame is used
+ * @return True on success, false if the regions kept changing while being read
+ */
+bool sharedImageGetRois(struct SharedImage *image, SharedImageRect *rects, uint32_t *numRects);
+
+/**
+ * @brief Returns the bounding rectangle of the regions of interest published by the consumer
+ *
+ * A generator that cannot skip single regions renders or copies only this rectangle.
+ * @param image Shared image object (generator)
+ * @param bounds Will be filled with the union of the regions
+ * @return True if bounds is valid, false if the whole frame is used
+ */
+bool sharedImageRoiBounds(struct SharedImage *image, SharedImageRect *bounds);
+
+/**
+ * @brief Checks if the consumer published regions of interest not yet read with sharedImageGetRois
+ * @param image Shared image object (generator)
+ * @return True if the regions changed
+ */
+bool sharedImageRoisChanged(struct SharedImage *image);
+
+/**
+ * @brief Copies a region of the last received frame in a compact buffer
+ *
+ * The region is clipped to the frame, and lines are packed in buffer. Formats with chroma subsampling are not supported.
+ * If the region does not fit the buffer, false is returned and setting is filled with the needed layout.
+ * @param image Shared image object (consumer)
+ * @param rect Region to copy
+ * @param buffer Destination buffer
+ * @param bufferSize Size of destination buffer, in bytes
+ * @param setting Will be filled with the layout of the region in buffer, width 0 if the region is empty or the frame not supported
+ * @return True if the region was copied
+ */
+bool sharedImageCopyRoi(struct SharedImage *image, const SharedImageRect *rect, void *buffer, uint64_t bufferSize, SharedImageSetting *setting);
+
+/**
+ * @brief Returns the delivery mode of a shared image
+ * @param image Shared image object
+ * @return One of SharedImageMode
+ */
+uint32_t sharedImageMode(struct SharedImage *image);
+
+/**
+ * @brief Checks if the generator has no free buffer because all of them are queued or held by the consumer
+ * @param image Shared image object (generator)
+ * @return True if the queue is full
+ */
+bool sharedImageQueueFull(struct SharedImage *image);
+
+/**
+ * @brief Returns the minimum bytesPerLine for a format
+ * @param format One of SharedImageFormat
+ * @param width Width of image, in pixels
+ * @return Bytes of a line of the first plane, 0 if format is not valid
+ */
+uint32_t sharedImageFormatMinBytesPerLine(uint32_t format, uint32_t width);
+
+/**
+ * @brief Returns the size of an image, including all planes
+ * @param setting Settings of the image
+ * @return Size of image in bytes, 0 if the setting is not valid
+ */
+uint64_t sharedImageFrameBytes(const SharedImageSetting *setting);
+
+/**
+ * @brief Returns the size of the standard image buffers, in bytes
+ *
+ * The size is a multiple of SHAREDIMAGE_PAGE_ALIGN for shared images created by this version of the library.
+ * Large buffers (see SharedImageConfig) are bigger, sharedImageOutBufferBytes returns the size of each acquired buffer.
+ * @param image Shared image object
+ * @return Size of buffer, 0 on error
+ */
+uint32_t sharedImagePageSize(struct SharedImage *image);
+
+/**
+ * @brief Copies the newest frame without receiving it
+ *
+ * The page is read under its sequence counter and never owned, so the generator is never held back:
+ * if it starts writing the page during the copy, the result is SharedImagePeekTorn and the buffer content
+ * must be discarded. Frames received or peeked before can be returned again, see info->sequence.
+ * Only the first plane is copied, as a packed frame with the bytesPerLine of the frame.
+ * @param image Shared image object (consumer)
+ * @param buffer Destination buffer
+ * @param bufferSize Size of destination buffer, in bytes
+ * @param setting Will be filled with the layout of the frame
+ * @param info Will be filled with the information of the frame, may be NULL
+ * @return Result of the copy, setting and info are valid for SharedImagePeekOk and SharedImagePeekTooSmall
+ */
+SharedImagePeekResult sharedImagePeek(struct SharedImage *image, void *buffer, uint64_t bufferSize, SharedImageSetting *setting, SharedImageFrameInfo *info);
+
+/**
+ * @brief Returns the rows already written of the frame returned by the last successful call to sharedImageReceive
+ *
+ * Frames are complete when rows done is the height of the frame, which is always the case
+ * for frames not sent with sharedImageSendPartial. Rows done never decrease.
+ * @param image Shared image object (consumer)
+ * @return Number of rows that can be read from the top of the frame, 0 if no frame was received
+ */
+uint32_t sharedImageRowsDone(struct SharedImage *image);
+
+/**
+ * @brief Returns the information of the frame returned by the last successful call to sharedImageReceive
+ *
+ * The returned pointer has the same validity of the image data.
+ * @param image Shared image object (consumer)
+ * @return Pointer to the frame information, NULL if no frame was received
+ */
+const SharedImageFrameInfo *sharedImageFrameInfo(struct SharedImage *image);
+
+/**
+ * @brief Returns the regions changed from the frame received before the last one
+ *
+ * If frames were skipped (latest frame modes) or the producer did not tell the changed regions 0 is returned:
+ * the whole frame should be considered changed. The returned pointer has the same validity of the image data.
+ * @param image Shared image object (consumer)
+ * @param rects Will be filled with a pointer to the changed regions
+ * @return Number of rectangles, 0 if the whole frame changed
+ */
+uint32_t sharedImageDirtyRects(struct SharedImage *image, const SharedImageRect **rects);
+
+/**
+ * @brief Adds a metadata record to the frame being prepared
+ *
+ * Call after getting an output buffer and before sending it: the returned area is inside the shared buffer,
+ * the caller writes the data there. Records are cleared each time an output buffer is returned.
+ * @param image Shared image object (generator)
+ * @param type Type of record, one of SharedImageMetadataType or an application type
+ * @param length Bytes of data of the record
+ * @return Pointer to the data of the record, NULL if there is no output buffer or no room left
+ */
+void *sharedImageMetadataAdd(struct SharedImage *image, uint32_t type, uint32_t length);
+
+/**
+ * @brief Iterates the metadata records of the frame returned by the last successful call to sharedImageReceive
+ *
+ * Data of a record follows its header: (const void *)(record+1). The returned pointer has the same validity of the image data.
+ * @param image Shared image object (consumer)
+ * @param previous Record returned by the previous call, NULL to get the first one
+ * @return Next record, NULL if there are no more records
+ */
+const SharedImageMetadata *sharedImageMetadataNext(struct SharedImage *image, const SharedImageMetadata *previous);
+
+/**
+ * @brief Finds the first metadata record of a type in the frame returned by the last successful call to sharedImageReceive
+ * @param image Shared image object (consumer)
+ * @param type Type of record
+ * @param length Will be filled with the length of data, may be NULL
+ * @return Pointer to data of the record, NULL if not found
+ */
+const void *sharedImageMetadataFind(struct SharedImage *image, uint32_t type, uint32_t *length);
+
+/**
+ * @brief Returns the bytes available for metadata records in each frame
+ * @param image Shared image object
+ * @return Capacity in bytes, including record headers
+ */
+uint32_t sharedImageMetadataCapacity(struct SharedImage *image);
+
+/**
+ * @brief Returns the clock used for frame timestamps
+ *
+ * The clock is monotonic and common to all processes of the system.
+ * @return Time in microseconds
+ */
+uint64_t sharedImageTimestampUs(void);
+
 /** @fn void sharedImageNotificationHandle(struct SharedImage *image)
  * @brief Returns an architecture-dependent notification handle
  */
@@ -110,6 +771,62 @@ bool sharedImageWaitNotify(struct SharedImage *image, uint32_t timeoutMs);
 void *sharedImageNotificationHandle(struct SharedImage *image);
 #endif
 
+#if defined(SHAREDMEM_LINUX)
+/**
+ * @brief Creates an anonymous shared image object
+ *
+ * The object has no global name: it should be passed to the other process with sharedImageSendToSocket.
+ * Note that even on error an object may be returned and it can be only checked for error
+ * @param image Pointer that will receive a pointer to the created object
+ * @param numPixels Number of pixels that should be allocated for each image
+ * @param generator True if we are creating the generator object, false if the consumer is being created
+ * @return True on success
+ */
+bool sharedImageCreateAnonymous(struct SharedImage **image, uint32_t numPixels, bool generator);
+
+/**
+ * @brief Creates an anonymous shared image object with buffers of a given size in bytes
+ * @param image Pointer that will receive a pointer to the created object
+ * @param numBytes Number of bytes that should be allocated for each image
+ * @param generator True if we are creating the generator object, false if the consumer is being created
+ * @return True on success
+ */
+bool sharedImageCreateAnonymousBytes(struct SharedImage **image, uint32_t numBytes, bool generator);
+
+/**
+ * @brief Creates an anonymous shared image object with a configuration
+ * @param config Configuration of the shared image
+ * @param image Pointer that will receive a pointer to the created object
+ * @param generator True if we are creating the generator object, false if the consumer is being created
+ * @return True on success
+ */
+bool sharedImageCreateAnonymousConfig(const SharedImageConfig *config, struct SharedImage **image, bool generator);
+
+/**
+ * @brief Passes an anonymous shared image to the other process over a connected AF_UNIX socket
+ * @param image Shared image object created with sharedImageCreateAnonymous
+ * @param socketFd Connected AF_UNIX socket
+ * @return True on success
+ */
+bool sharedImageSendToSocket(struct SharedImage *image, int socketFd);
+
+/**
+ * @brief Attaches to a shared image sent by the other process with sharedImageSendToSocket
+ *
+ * The attached object is the generator if the sender is the consumer and vice versa.
+ * Note that even on error an object may be returned and it can be only checked for error
+ * @param socketFd Connected AF_UNIX socket
+ * @param image Pointer that will receive a pointer to the attached object
+ * @return True on success
+ */
+bool sharedImageAttachFromSocket(int socketFd, struct SharedImage **image);
+
+/**
+ * @brief Returns a descriptor that becomes readable when a notification is pending
+ */
+int sharedImageNotificationFd(struct SharedImage *image);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
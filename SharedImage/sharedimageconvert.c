@@ -0,0 +1,913 @@
+/*
+ * This file is part of SharedImageIPC.
+ *
+ * (c) Marzocchi Alessandro
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#include "sharedimageconvert.h"
+#include "internal/sharedimageparallel.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+  #define CONVERT_X86
+  #include <immintrin.h>
+  #if defined(_MSC_VER)
+    #include <intrin.h>
+    #define CONVERT_TARGET(isa)
+  #else
+    #include <cpuid.h>
+    #define CONVERT_TARGET(isa) __attribute__((target(isa)))
+  #endif
+#endif
+
+#define CONVERT_STRIPE_BYTES (1u<<20) // Frames bigger than this are split in stripes
+#define CONVERT_MIN_STRIPE_LINES 16
+#define CONVERT_STREAM_BYTES (512u<<10) // Copies bigger than this use non-temporal stores
+#define CONVERT_MIN_STRIPE_COPY (256u<<10)
+
+// Lines of the planes of an image row (planes after the first one are chroma planes)
+typedef struct
+{
+  const uint8_t *plane[3];
+} ConvertLine;
+
+typedef void (*ConvertRowFunction)(const ConvertLine *source, uint8_t *destination, uint32_t width);
+
+typedef struct
+{
+  uint32_t sourceFormat;
+  uint32_t destinationFormat;
+  ConvertRowFunction kernels[4]; // Indexed by SharedImageSimdLevel, NULL to use a lower level
+} ConvertEntry;
+
+typedef void (*ConvertCopyFunction)(uint8_t *destination, const uint8_t *source, size_t bytes);
+
+// Averages 2x2 blocks of two source lines in width destination pixels
+typedef void (*ConvertHalfFunction)(const uint8_t *line0, const uint8_t *line1, uint8_t *destination, uint32_t width);
+
+typedef struct
+{
+  ConvertRowFunction kernel; // NULL for repacking
+  const uint8_t *source;
+  const SharedImageSetting *sourceSetting;
+  uint8_t *destination;
+  const SharedImageSetting *destinationSetting;
+} ConvertJob;
+
+typedef struct
+{
+  ConvertCopyFunction copy;
+  uint8_t *destination;
+  const uint8_t *source;
+  size_t bytes;
+} ConvertCopyJob;
+
+typedef struct
+{
+  ConvertHalfFunction kernel;
+  const uint8_t *source;
+  uint32_t sourceBytesPerLine;
+  uint8_t *destination;
+  uint32_t destinationBytesPerLine;
+  uint32_t width;
+  uint32_t height;
+} ConvertHalfJob;
+
+static volatile int convertDetectedLevel=-1;
+static volatile int convertWantedLevel=SharedImageSimdAVX512;
+static volatile uint32_t convertThreads=0;
+
+static uint8_t convertClamp(int32_t value)
+{
+  return (uint8_t)(value<0?0:(value>255?255:value));
+}
+
+// BT.601 limited range with 6 bits of fraction, the same arithmetic of the vector kernels
+static void convertYuvPixel(int32_t y, int32_t u, int32_t v, uint8_t *destination, bool bgra)
+{
+  int32_t c=(y-16)*75+32, d=u-128, e=v-128;
+  uint8_t r=convertClamp((c+102*e)>>6);
+  uint8_t g=convertClamp((c-25*d-52*e)>>6);
+  uint8_t b=convertClamp((c+129*d)>>6);
+  destination[0]=bgra?b:r;
+  destination[1]=g;
+  destination[2]=bgra?r:b;
+  destination[3]=255;
+}
+
+static void convertSwapRBScalar(const ConvertLine *source, uint8_t *destination, uint32_t width)
+{
+  const uint8_t *s=source->plane[0];
+  for(uint32_t x=0;x<width;x++, s+=4, destination+=4)
+  {
+    uint8_t first=s[0];
+    destination[0]=s[2];
+    destination[1]=s[1];
+    destination[2]=first;
+    destination[3]=s[3];
+  }
+}
+
+static void convertGray16To8Scalar(const ConvertLine *source, uint8_t *destination, uint32_t width)
+{
+  const uint16_t *s=(const uint16_t *)source->plane[0];
+  for(uint32_t x=0;x<width;x++)
+    destination[x]=(uint8_t)(s[x]>>8);
+}
+
+static void convertGray8To16Scalar(const ConvertLine *source, uint8_t *destination, uint32_t width)
+{
+  uint16_t *d=(uint16_t *)destination;
+  for(uint32_t x=0;x<width;x++)
+    d[x]=(uint16_t)(source->plane[0][x]*257);
+}
+
+static void convertGray8To32Scalar(const ConvertLine *source, uint8_t *destination, uint32_t width)
+{
+  for(uint32_t x=0;x<width;x++, destination+=4)
+  {
+    destination[0]=destination[1]=destination[2]=source->plane[0][x];
+    destination[3]=255;
+  }
+}
+
+static void convert24To32Scalar(const ConvertLine *source, uint8_t *destination, uint32_t width)
+{
+  const uint8_t *s=source->plane[0];
+  for(uint32_t x=0;x<width;x++, s+=3, destination+=4)
+  {
+    destination[0]=s[0];
+    destination[1]=s[1];
+    destination[2]=s[2];
+    destination[3]=255;
+  }
+}
+
+static void convert24To32SwapScalar(const ConvertLine *source, uint8_t *destination, uint32_t width)
+{
+  const uint8_t *s=source->plane[0];
+  for(uint32_t x=0;x<width;x++, s+=3, destination+=4)
+  {
+    destination[0]=s[2];
+    destination[1]=s[1];
+    destination[2]=s[0];
+    destination[3]=255;
+  }
+}
+
+static void convertBgraToGrayScalar(const ConvertLine *source, uint8_t *destination, uint32_t width)
+{
+  const uint8_t *s=source->plane[0];
+  for(uint32_t x=0;x<width;x++, s+=4)
+    destination[x]=(uint8_t)((s[2]*77+s[1]*150+s[0]*29+128)>>8);
+}
+
+static void convertRgbaToGrayScalar(const ConvertLine *source, uint8_t *destination, uint32_t width)
+{
+  const uint8_t *s=source->plane[0];
+  for(uint32_t x=0;x<width;x++, s+=4)
+    destination[x]=(uint8_t)((s[0]*77+s[1]*150+s[2]*29+128)>>8);
+}
+
+static void convertNv12Tail(const ConvertLine *source, uint8_t *destination, uint32_t x, uint32_t width, bool bgra)
+{
+  for(;x<width;x++)
+    convertYuvPixel(source->plane[0][x], source->plane[1][x&~1u], source->plane[1][x|1u], destination+x*4, bgra);
+}
+
+static void convertNv12ToBgraScalar(const ConvertLine *source, uint8_t *destination, uint32_t width)
+{
+  convertNv12Tail(source, destination, 0, width, true);
+}
+
+static void convertNv12ToRgbaScalar(const ConvertLine *source, uint8_t *destination, uint32_t width)
+{
+  convertNv12Tail(source, destination, 0, width, false);
+}
+
+static void convertI420ToBgraScalar(const ConvertLine *source, uint8_t *destination, uint32_t width)
+{
+  for(uint32_t x=0;x<width;x++)
+    convertYuvPixel(source->plane[0][x], source->plane[1][x/2], source->plane[2][x/2], destination+x*4, true);
+}
+
+static void convertI420ToRgbaScalar(const ConvertLine *source, uint8_t *destination, uint32_t width)
+{
+  for(uint32_t x=0;x<width;x++)
+    convertYuvPixel(source->plane[0][x], source->plane[1][x/2], source->plane[2][x/2], destination+x*4, false);
+}
+
+static void convertYuyvToBgraScalar(const ConvertLine *source, uint8_t *destination, uint32_t width)
+{
+  const uint8_t *s=source->plane[0];
+  for(uint32_t x=0;x<width;x++)
+    convertYuvPixel(s[x*2], s[(x&~1u)*2+1], s[(x&~1u)*2+3], destination+x*4, true);
+}
+
+static void convertYuyvToRgbaScalar(const ConvertLine *source, uint8_t *destination, uint32_t width)
+{
+  const uint8_t *s=source->plane[0];
+  for(uint32_t x=0;x<width;x++)
+    convertYuvPixel(s[x*2], s[(x&~1u)*2+1], s[(x&~1u)*2+3], destination+x*4, false);
+}
+
+static void convertHalf8(const uint8_t *line0, const uint8_t *line1, uint8_t *destination, uint32_t width, uint32_t channels)
+{
+  for(uint32_t x=0;x<width;x++)
+  {
+    for(uint32_t c=0;c<channels;c++)
+    {
+      uint32_t i=x*2*channels+c;
+      destination[x*channels+c]=(uint8_t)((line0[i]+line0[i+channels]+line1[i]+line1[i+channels]+2)>>2);
+    }
+  }
+}
+
+static void convertHalf8x1Scalar(const uint8_t *line0, const uint8_t *line1, uint8_t *destination, uint32_t width)
+{
+  convertHalf8(line0, line1, destination, width, 1);
+}
+
+static void convertHalf8x3Scalar(const uint8_t *line0, const uint8_t *line1, uint8_t *destination, uint32_t width)
+{
+  convertHalf8(line0, line1, destination, width, 3);
+}
+
+static void convertHalf8x4Scalar(const uint8_t *line0, const uint8_t *line1, uint8_t *destination, uint32_t width)
+{
+  convertHalf8(line0, line1, destination, width, 4);
+}
+
+static void convertHalf16x1Scalar(const uint8_t *line0, const uint8_t *line1, uint8_t *destination, uint32_t width)
+{
+  const uint16_t *a=(const uint16_t *)line0, *b=(const uint16_t *)line1;
+  uint16_t *d=(uint16_t *)destination;
+  for(uint32_t x=0;x<width;x++)
+    d[x]=(uint16_t)(((uint32_t)a[x*2]+a[x*2+1]+b[x*2]+b[x*2+1]+2)>>2);
+}
+
+#if defined(CONVERT_X86)
+CONVERT_TARGET("sse2") static void convertHalf8x1Sse2(const uint8_t *line0, const uint8_t *line1, uint8_t *destination, uint32_t width)
+{
+  const __m128i low=_mm_set1_epi16(0xFF), round=_mm_set1_epi16(2);
+  uint32_t x=0;
+  for(;x+8<=width;x+=8)
+  {
+    __m128i a=_mm_loadu_si128((const __m128i *)(line0+x*2)), b=_mm_loadu_si128((const __m128i *)(line1+x*2));
+    __m128i sum=_mm_add_epi16(_mm_add_epi16(_mm_and_si128(a, low), _mm_srli_epi16(a, 8)), _mm_add_epi16(_mm_and_si128(b, low), _mm_srli_epi16(b, 8)));
+    sum=_mm_srli_epi16(_mm_add_epi16(sum, round), 2);
+    _mm_storel_epi64((__m128i *)(destination+x), _mm_packus_epi16(sum, sum));
+  }
+  convertHalf8x1Scalar(line0+x*2, line1+x*2, destination+x, width-x);
+}
+
+CONVERT_TARGET("sse2") static void convertHalf8x4Sse2(const uint8_t *line0, const uint8_t *line1, uint8_t *destination, uint32_t width)
+{
+  const __m128i zero=_mm_setzero_si128(), round=_mm_set1_epi16(2);
+  uint32_t x=0;
+  for(;x+2<=width;x+=2)
+  {
+    __m128i a=_mm_loadu_si128((const __m128i *)(line0+x*8)), b=_mm_loadu_si128((const __m128i *)(line1+x*8));
+    __m128i first=_mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)); // Source pixels 0 and 1
+    __m128i second=_mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)); // Source pixels 2 and 3
+    first=_mm_add_epi16(first, _mm_srli_si128(first, 8));
+    second=_mm_add_epi16(second, _mm_srli_si128(second, 8));
+    __m128i sum=_mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(first, second), round), 2);
+    _mm_storel_epi64((__m128i *)(destination+x*4), _mm_packus_epi16(sum, sum));
+  }
+  convertHalf8x4Scalar(line0+x*8, line1+x*8, destination+x*4, width-x);
+}
+
+CONVERT_TARGET("sse2") static void convertSwapRBSse2(const ConvertLine *source, uint8_t *destination, uint32_t width)
+{
+  const uint8_t *s=source->plane[0];
+  const __m128i keep=_mm_set1_epi32((int)0xFF00FF00), low=_mm_set1_epi32(0xFF);
+  uint32_t x=0;
+  for(;x+4<=width;x+=4)
+  {
+    __m128i v=_mm_loadu_si128((const __m128i *)(s+x*4));
+    __m128i swapped=_mm_or_si128(_mm_and_si128(v, keep), _mm_or_si128(_mm_and_si128(_mm_srli_epi32(v, 16), low), _mm_slli_epi32(_mm_and_si128(v, low), 16)));
+    _mm_storeu_si128((__m128i *)(destination+x*4), swapped);
+  }
+  ConvertLine tail={{s+x*4, NULL, NULL}};
+  convertSwapRBScalar(&tail, destination+x*4, width-x);
+}
+
+CONVERT_TARGET("sse2") static void convertGray16To8Sse2(const ConvertLine *source, uint8_t *destination, uint32_t width)
+{
+  const uint8_t *s=source->plane[0];
+  uint32_t x=0;
+  for(;x+16<=width;x+=16)
+  {
+    __m128i a=_mm_srli_epi16(_mm_loadu_si128((const __m128i *)(s+x*2)), 8);
+    __m128i b=_mm_srli_epi16(_mm_loadu_si128((const __m128i *)(s+x*2+16)), 8);
+    _mm_storeu_si128((__m128i *)(destination+x), _mm_packus_epi16(a, b));
+  }
+  ConvertLine tail={{s+x*2, NULL, NULL}};
+  convertGray16To8Scalar(&tail, destination+x, width-x);
+}
+
+CONVERT_TARGET("sse2") static void convertGray8To32Sse2(const ConvertLine *source, uint8_t *destination, uint32_t width)
+{
+  const uint8_t *s=source->plane[0];
+  const __m128i alpha=_mm_set1_epi8((char)0xFF);
+  uint32_t x=0;
+  for(;x+16<=width;x+=16)
+  {
+    __m128i g=_mm_loadu_si128((const __m128i *)(s+x));
+    __m128i gg=_mm_unpacklo_epi8(g, g), ga=_mm_unpacklo_epi8(g, alpha);
+    _mm_storeu_si128((__m128i *)(destination+x*4), _mm_unpacklo_epi16(gg, ga));
+    _mm_storeu_si128((__m128i *)(destination+x*4+16), _mm_unpackhi_epi16(gg, ga));
+    gg=_mm_unpackhi_epi8(g, g);
+    ga=_mm_unpackhi_epi8(g, alpha);
+    _mm_storeu_si128((__m128i *)(destination+x*4+32), _mm_unpacklo_epi16(gg, ga));
+    _mm_storeu_si128((__m128i *)(destination+x*4+48), _mm_unpackhi_epi16(gg, ga));
+  }
+  ConvertLine tail={{s+x, NULL, NULL}};
+  convertGray8To32Scalar(&tail, destination+x*4, width-x);
+}
+
+// Converts 8 pixels, y is 16 bits per pixel, u and v are already replicated for each pixel
+CONVERT_TARGET("sse2") static inline void convertYuvSse2(__m128i y, __m128i u, __m128i v, uint8_t *destination, bool bgra)
+{
+  __m128i c=_mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(y, _mm_set1_epi16(16)), _mm_set1_epi16(75)), _mm_set1_epi16(32));
+  __m128i d=_mm_sub_epi16(u, _mm_set1_epi16(128)), e=_mm_sub_epi16(v, _mm_set1_epi16(128));
+  __m128i r=_mm_srai_epi16(_mm_adds_epi16(c, _mm_mullo_epi16(e, _mm_set1_epi16(102))), 6);
+  __m128i g=_mm_srai_epi16(_mm_subs_epi16(_mm_subs_epi16(c, _mm_mullo_epi16(d, _mm_set1_epi16(25))), _mm_mullo_epi16(e, _mm_set1_epi16(52))), 6);
+  __m128i b=_mm_srai_epi16(_mm_adds_epi16(c, _mm_mullo_epi16(d, _mm_set1_epi16(129))), 6);
+  __m128i first=_mm_packus_epi16(bgra?b:r, bgra?b:r), second=_mm_packus_epi16(g, g), third=_mm_packus_epi16(bgra?r:b, bgra?r:b);
+  __m128i low=_mm_unpacklo_epi8(first, second), high=_mm_unpacklo_epi8(third, _mm_set1_epi8((char)0xFF));
+  _mm_storeu_si128((__m128i *)destination, _mm_unpacklo_epi16(low, high));
+  _mm_storeu_si128((__m128i *)(destination+16), _mm_unpackhi_epi16(low, high));
+}
+
+CONVERT_TARGET("sse2") static inline void convertNv12Sse2(const ConvertLine *source, uint8_t *destination, uint32_t width, bool bgra)
+{
+  const __m128i zero=_mm_setzero_si128(), low=_mm_set1_epi32(0xFFFF);
+  uint32_t x=0;
+  for(;x+8<=width;x+=8)
+  {
+    __m128i y=_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(source->plane[0]+x)), zero);
+    __m128i uv=_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(source->plane[1]+x)), zero);
+    __m128i u=_mm_and_si128(uv, low), v=_mm_srli_epi32(uv, 16);
+    convertYuvSse2(y, _mm_or_si128(u, _mm_slli_epi32(u, 16)), _mm_or_si128(v, _mm_slli_epi32(v, 16)), destination+x*4, bgra);
+  }
+  convertNv12Tail(source, destination, x, width, bgra);
+}
+
+CONVERT_TARGET("sse2") static void convertNv12ToBgraSse2(const ConvertLine *source, uint8_t *destination, uint32_t width)
+{
+  convertNv12Sse2(source, destination, width, true);
+}
+
+CONVERT_TARGET("sse2") static void convertNv12ToRgbaSse2(const ConvertLine *source, uint8_t *destination, uint32_t width)
+{
+  convertNv12Sse2(source, destination, width, false);
+}
+
+CONVERT_TARGET("avx2") static void convertSwapRBAvx2(const ConvertLine *source, uint8_t *destination, uint32_t width)
+{
+  const uint8_t *s=source->plane[0];
+  const __m256i keep=_mm256_set1_epi32((int)0xFF00FF00), low=_mm256_set1_epi32(0xFF);
+  uint32_t x=0;
+  for(;x+8<=width;x+=8)
+  {
+    __m256i v=_mm256_loadu_si256((const __m256i *)(s+x*4));
+    __m256i swapped=_mm256_or_si256(_mm256_and_si256(v, keep), _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(v, 16), low), _mm256_slli_epi32(_mm256_and_si256(v, low), 16)));
+    _mm256_storeu_si256((__m256i *)(destination+x*4), swapped);
+  }
+  ConvertLine tail={{s+x*4, NULL, NULL}};
+  convertSwapRBScalar(&tail, destination+x*4, width-x);
+}
+
+CONVERT_TARGET("avx2") static void convertGray16To8Avx2(const ConvertLine *source, uint8_t *destination, uint32_t width)
+{
+  const uint8_t *s=source->plane[0];
+  uint32_t x=0;
+  for(;x+32<=width;x+=32)
+  {
+    __m256i a=_mm256_srli_epi16(_mm256_loadu_si256((const __m256i *)(s+x*2)), 8);
+    __m256i b=_mm256_srli_epi16(_mm256_loadu_si256((const __m256i *)(s+x*2+32)), 8);
+    _mm256_storeu_si256((__m256i *)(destination+x), _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), _MM_SHUFFLE(3, 1, 2, 0)));
+  }
+  ConvertLine tail={{s+x*2, NULL, NULL}};
+  convertGray16To8Scalar(&tail, destination+x, width-x);
+}
+
+CONVERT_TARGET("avx2") static void convertGray8To32Avx2(const ConvertLine *source, uint8_t *destination, uint32_t width)
+{
+  const uint8_t *s=source->plane[0];
+  const __m256i alpha=_mm256_set1_epi32((int)0xFF000000);
+  // Each lane replicates 4 of the 16 loaded pixels, -128 clears the alpha byte
+  const __m256i low=_mm256_setr_epi8(0, 0, 0, -128, 1, 1, 1, -128, 2, 2, 2, -128, 3, 3, 3, -128, 4, 4, 4, -128, 5, 5, 5, -128, 6, 6, 6, -128, 7, 7, 7, -128);
+  const __m256i high=_mm256_add_epi8(low, _mm256_set1_epi8(8));
+  uint32_t x=0;
+  for(;x+16<=width;x+=16)
+  {
+    __m256i g=_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(s+x)));
+    _mm256_storeu_si256((__m256i *)(destination+x*4), _mm256_or_si256(_mm256_shuffle_epi8(g, low), alpha));
+    _mm256_storeu_si256((__m256i *)(destination+x*4+32), _mm256_or_si256(_mm256_shuffle_epi8(g, high), alpha));
+  }
+  ConvertLine tail={{s+x, NULL, NULL}};
+  convertGray8To32Scalar(&tail, destination+x*4, width-x);
+}
+
+// Converts 16 pixels, see convertYuvSse2
+CONVERT_TARGET("avx2") static inline void convertYuvAvx2(__m256i y, __m256i u, __m256i v, uint8_t *destination, bool bgra)
+{
+  __m256i c=_mm256_add_epi16(_mm256_mullo_epi16(_mm256_sub_epi16(y, _mm256_set1_epi16(16)), _mm256_set1_epi16(75)), _mm256_set1_epi16(32));
+  __m256i d=_mm256_sub_epi16(u, _mm256_set1_epi16(128)), e=_mm256_sub_epi16(v, _mm256_set1_epi16(128));
+  __m256i r=_mm256_srai_epi16(_mm256_adds_epi16(c, _mm256_mullo_epi16(e, _mm256_set1_epi16(102))), 6);
+  __m256i g=_mm256_srai_epi16(_mm256_subs_epi16(_mm256_subs_epi16(c, _mm256_mullo_epi16(d, _mm256_set1_epi16(25))), _mm256_mullo_epi16(e, _mm256_set1_epi16(52))), 6);
+  __m256i b=_mm256_srai_epi16(_mm256_adds_epi16(c, _mm256_mullo_epi16(d, _mm256_set1_epi16(129))), 6);
+  __m256i first=_mm256_packus_epi16(bgra?b:r, bgra?b:r), second=_mm256_packus_epi16(g, g), third=_mm256_packus_epi16(bgra?r:b, bgra?r:b);
+  __m256i low=_mm256_unpacklo_epi8(first, second), high=_mm256_unpacklo_epi8(third, _mm256_set1_epi8((char)0xFF));
+  __m256i pixelsLow=_mm256_unpacklo_epi16(low, high), pixelsHigh=_mm256_unpackhi_epi16(low, high); // Pixels 0-3,8-11 and 4-7,12-15
+  _mm256_storeu_si256((__m256i *)destination, _mm256_permute2x128_si256(pixelsLow, pixelsHigh, 0x20));
+  _mm256_storeu_si256((__m256i *)(destination+32), _mm256_permute2x128_si256(pixelsLow, pixelsHigh, 0x31));
+}
+
+CONVERT_TARGET("avx2") static inline void convertNv12Avx2(const ConvertLine *source, uint8_t *destination, uint32_t width, bool bgra)
+{
+  const __m256i low=_mm256_set1_epi32(0xFFFF);
+  uint32_t x=0;
+  for(;x+16<=width;x+=16)
+  {
+    __m256i y=_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(source->plane[0]+x)));
+    __m256i uv=_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(source->plane[1]+x)));
+    __m256i u=_mm256_and_si256(uv, low), v=_mm256_srli_epi32(uv, 16);
+    convertYuvAvx2(y, _mm256_or_si256(u, _mm256_slli_epi32(u, 16)), _mm256_or_si256(v, _mm256_slli_epi32(v, 16)), destination+x*4, bgra);
+  }
+  convertNv12Tail(source, destination, x, width, bgra);
+}
+
+CONVERT_TARGET("avx2") static void convertNv12ToBgraAvx2(const ConvertLine *source, uint8_t *destination, uint32_t width)
+{
+  convertNv12Avx2(source, destination, width, true);
+}
+
+CONVERT_TARGET("avx2") static void convertNv12ToRgbaAvx2(const ConvertLine *source, uint8_t *destination, uint32_t width)
+{
+  convertNv12Avx2(source, destination, width, false);
+}
+
+CONVERT_TARGET("avx2") static void convertHalf8x1Avx2(const uint8_t *line0, const uint8_t *line1, uint8_t *destination, uint32_t width)
+{
+  const __m256i low=_mm256_set1_epi16(0xFF), round=_mm256_set1_epi16(2);
+  uint32_t x=0;
+  for(;x+16<=width;x+=16)
+  {
+    __m256i a=_mm256_loadu_si256((const __m256i *)(line0+x*2)), b=_mm256_loadu_si256((const __m256i *)(line1+x*2));
+    __m256i sum=_mm256_add_epi16(_mm256_add_epi16(_mm256_and_si256(a, low), _mm256_srli_epi16(a, 8)), _mm256_add_epi16(_mm256_and_si256(b, low), _mm256_srli_epi16(b, 8)));
+    sum=_mm256_srli_epi16(_mm256_add_epi16(sum, round), 2);
+    sum=_mm256_permute4x64_epi64(_mm256_packus_epi16(sum, sum), _MM_SHUFFLE(3, 1, 2, 0));
+    _mm_storeu_si128((__m128i *)(destination+x), _mm256_castsi256_si128(sum));
+  }
+  convertHalf8x1Scalar(line0+x*2, line1+x*2, destination+x, width-x);
+}
+
+CONVERT_TARGET("avx2") static void convertHalf8x4Avx2(const uint8_t *line0, const uint8_t *line1, uint8_t *destination, uint32_t width)
+{
+  const __m256i zero=_mm256_setzero_si256(), round=_mm256_set1_epi16(2);
+  uint32_t x=0;
+  for(;x+4<=width;x+=4)
+  {
+    __m256i a=_mm256_loadu_si256((const __m256i *)(line0+x*8)), b=_mm256_loadu_si256((const __m256i *)(line1+x*8));
+    __m256i first=_mm256_add_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero)); // Source pixels 0,1 and 4,5
+    __m256i second=_mm256_add_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero)); // Source pixels 2,3 and 6,7
+    first=_mm256_add_epi16(first, _mm256_srli_si256(first, 8));
+    second=_mm256_add_epi16(second, _mm256_srli_si256(second, 8));
+    __m256i sum=_mm256_srli_epi16(_mm256_add_epi16(_mm256_unpacklo_epi64(first, second), round), 2);
+    sum=_mm256_permute4x64_epi64(_mm256_packus_epi16(sum, sum), _MM_SHUFFLE(3, 1, 2, 0));
+    _mm_storeu_si128((__m128i *)(destination+x*4), _mm256_castsi256_si128(sum));
+  }
+  convertHalf8x4Scalar(line0+x*8, line1+x*8, destination+x*4, width-x);
+}
+
+CONVERT_TARGET("avx512f,avx512bw") static void convertSwapRBAvx512(const ConvertLine *source, uint8_t *destination, uint32_t width)
+{
+  const uint8_t *s=source->plane[0];
+  const __m512i keep=_mm512_set1_epi32((int)0xFF00FF00), low=_mm512_set1_epi32(0xFF);
+  uint32_t x=0;
+  for(;x+16<=width;x+=16)
+  {
+    __m512i v=_mm512_loadu_si512((const void *)(s+x*4));
+    __m512i swapped=_mm512_or_si512(_mm512_and_si512(v, keep), _mm512_or_si512(_mm512_and_si512(_mm512_srli_epi32(v, 16), low), _mm512_slli_epi32(_mm512_and_si512(v, low), 16)));
+    _mm512_storeu_si512((void *)(destination+x*4), swapped);
+  }
+  ConvertLine tail={{s+x*4, NULL, NULL}};
+  convertSwapRBScalar(&tail, destination+x*4, width-x);
+}
+
+CONVERT_TARGET("avx512f,avx512bw") static void convertGray16To8Avx512(const ConvertLine *source, uint8_t *destination, uint32_t width)
+{
+  const uint8_t *s=source->plane[0];
+  uint32_t x=0;
+  for(;x+32<=width;x+=32)
+  {
+    __m512i v=_mm512_srli_epi16(_mm512_loadu_si512((const void *)(s+x*2)), 8);
+    _mm256_storeu_si256((__m256i *)(destination+x), _mm512_cvtepi16_epi8(v));
+  }
+  ConvertLine tail={{s+x*2, NULL, NULL}};
+  convertGray16To8Scalar(&tail, destination+x, width-x);
+}
+
+// Non-temporal copies: the head is copied up to the alignment of destination, streaming stores are ordered by the final fence
+CONVERT_TARGET("sse2") static void convertStreamSse2(uint8_t *destination, const uint8_t *source, size_t bytes)
+{
+  size_t head=(16-((uintptr_t)destination&15))&15;
+  if(head>bytes)
+    head=bytes;
+  memcpy(destination, source, head);
+  destination+=head;
+  source+=head;
+  bytes-=head;
+  for(;bytes>=64;bytes-=64, destination+=64, source+=64)
+  {
+    __m128i a=_mm_loadu_si128((const __m128i *)source), b=_mm_loadu_si128((const __m128i *)(source+16));
+    __m128i c=_mm_loadu_si128((const __m128i *)(source+32)), d=_mm_loadu_si128((const __m128i *)(source+48));
+    _mm_stream_si128((__m128i *)destination, a);
+    _mm_stream_si128((__m128i *)(destination+16), b);
+    _mm_stream_si128((__m128i *)(destination+32), c);
+    _mm_stream_si128((__m128i *)(destination+48), d);
+  }
+  _mm_sfence();
+  memcpy(destination, source, bytes);
+}
+
+CONVERT_TARGET("avx2") static void convertStreamAvx2(uint8_t *destination, const uint8_t *source, size_t bytes)
+{
+  size_t head=(32-((uintptr_t)destination&31))&31;
+  if(head>bytes)
+    head=bytes;
+  memcpy(destination, source, head);
+  destination+=head;
+  source+=head;
+  bytes-=head;
+  for(;bytes>=128;bytes-=128, destination+=128, source+=128)
+  {
+    __m256i a=_mm256_loadu_si256((const __m256i *)source), b=_mm256_loadu_si256((const __m256i *)(source+32));
+    __m256i c=_mm256_loadu_si256((const __m256i *)(source+64)), d=_mm256_loadu_si256((const __m256i *)(source+96));
+    _mm256_stream_si256((__m256i *)destination, a);
+    _mm256_stream_si256((__m256i *)(destination+32), b);
+    _mm256_stream_si256((__m256i *)(destination+64), c);
+    _mm256_stream_si256((__m256i *)(destination+96), d);
+  }
+  _mm_sfence();
+  memcpy(destination, source, bytes);
+}
+
+CONVERT_TARGET("avx512f") static void convertStreamAvx512(uint8_t *destination, const uint8_t *source, size_t bytes)
+{
+  size_t head=(64-((uintptr_t)destination&63))&63;
+  if(head>bytes)
+    head=bytes;
+  memcpy(destination, source, head);
+  destination+=head;
+  source+=head;
+  bytes-=head;
+  for(;bytes>=256;bytes-=256, destination+=256, source+=256)
+  {
+    __m512i a=_mm512_loadu_si512((const void *)source), b=_mm512_loadu_si512((const void *)(source+64));
+    __m512i c=_mm512_loadu_si512((const void *)(source+128)), d=_mm512_loadu_si512((const void *)(source+192));
+    _mm512_stream_si512((void *)destination, a);
+    _mm512_stream_si512((void *)(destination+64), b);
+    _mm512_stream_si512((void *)(destination+128), c);
+    _mm512_stream_si512((void *)(destination+192), d);
+  }
+  _mm_sfence();
+  memcpy(destination, source, bytes);
+}
+  #define CONVERT_KERNELS(scalar, sse2, avx2, avx512) {scalar, sse2, avx2, avx512}
+#else
+  #define CONVERT_KERNELS(scalar, sse2, avx2, avx512) {scalar, NULL, NULL, NULL}
+#endif
+
+static void convertCopyScalar(uint8_t *destination, const uint8_t *source, size_t bytes)
+{
+  memcpy(destination, source, bytes);
+}
+
+static const struct
+{
+  uint32_t format;
+  ConvertHalfFunction kernels[4];
+} convertHalfEntries[]=
+{
+  {SharedImageFormatBGRA, CONVERT_KERNELS(convertHalf8x4Scalar, convertHalf8x4Sse2, convertHalf8x4Avx2, NULL)},
+  {SharedImageFormatRGBA, CONVERT_KERNELS(convertHalf8x4Scalar, convertHalf8x4Sse2, convertHalf8x4Avx2, NULL)},
+  {SharedImageFormatGray8, CONVERT_KERNELS(convertHalf8x1Scalar, convertHalf8x1Sse2, convertHalf8x1Avx2, NULL)},
+  {SharedImageFormatRGB24, CONVERT_KERNELS(convertHalf8x3Scalar, NULL, NULL, NULL)},
+  {SharedImageFormatBGR24, CONVERT_KERNELS(convertHalf8x3Scalar, NULL, NULL, NULL)},
+  {SharedImageFormatGray16, CONVERT_KERNELS(convertHalf16x1Scalar, NULL, NULL, NULL)}
+};
+
+static const ConvertCopyFunction convertCopyKernels[4]=CONVERT_KERNELS(convertCopyScalar, convertStreamSse2, convertStreamAvx2, convertStreamAvx512);
+
+static const ConvertEntry convertEntries[]=
+{
+  {SharedImageFormatBGRA, SharedImageFormatRGBA, CONVERT_KERNELS(convertSwapRBScalar, convertSwapRBSse2, convertSwapRBAvx2, convertSwapRBAvx512)},
+  {SharedImageFormatRGBA, SharedImageFormatBGRA, CONVERT_KERNELS(convertSwapRBScalar, convertSwapRBSse2, convertSwapRBAvx2, convertSwapRBAvx512)},
+  {SharedImageFormatGray16, SharedImageFormatGray8, CONVERT_KERNELS(convertGray16To8Scalar, convertGray16To8Sse2, convertGray16To8Avx2, convertGray16To8Avx512)},
+  {SharedImageFormatGray8, SharedImageFormatGray16, CONVERT_KERNELS(convertGray8To16Scalar, NULL, NULL, NULL)},
+  {SharedImageFormatGray8, SharedImageFormatBGRA, CONVERT_KERNELS(convertGray8To32Scalar, convertGray8To32Sse2, convertGray8To32Avx2, NULL)},
+  {SharedImageFormatGray8, SharedImageFormatRGBA, CONVERT_KERNELS(convertGray8To32Scalar, convertGray8To32Sse2, convertGray8To32Avx2, NULL)},
+  {SharedImageFormatBGR24, SharedImageFormatBGRA, CONVERT_KERNELS(convert24To32Scalar, NULL, NULL, NULL)},
+  {SharedImageFormatRGB24, SharedImageFormatRGBA, CONVERT_KERNELS(convert24To32Scalar, NULL, NULL, NULL)},
+  {SharedImageFormatRGB24, SharedImageFormatBGRA, CONVERT_KERNELS(convert24To32SwapScalar, NULL, NULL, NULL)},
+  {SharedImageFormatBGR24, SharedImageFormatRGBA, CONVERT_KERNELS(convert24To32SwapScalar, NULL, NULL, NULL)},
+  {SharedImageFormatBGRA, SharedImageFormatGray8, CONVERT_KERNELS(convertBgraToGrayScalar, NULL, NULL, NULL)},
+  {SharedImageFormatRGBA, SharedImageFormatGray8, CONVERT_KERNELS(convertRgbaToGrayScalar, NULL, NULL, NULL)},
+  {SharedImageFormatNV12, SharedImageFormatBGRA, CONVERT_KERNELS(convertNv12ToBgraScalar, convertNv12ToBgraSse2, convertNv12ToBgraAvx2, NULL)},
+  {SharedImageFormatNV12, SharedImageFormatRGBA, CONVERT_KERNELS(convertNv12ToRgbaScalar, convertNv12ToRgbaSse2, convertNv12ToRgbaAvx2, NULL)},
+  {SharedImageFormatI420, SharedImageFormatBGRA, CONVERT_KERNELS(convertI420ToBgraScalar, NULL, NULL, NULL)},
+  {SharedImageFormatI420, SharedImageFormatRGBA, CONVERT_KERNELS(convertI420ToRgbaScalar, NULL, NULL, NULL)},
+  {SharedImageFormatYUYV, SharedImageFormatBGRA, CONVERT_KERNELS(convertYuyvToBgraScalar, NULL, NULL, NULL)},
+  {SharedImageFormatYUYV, SharedImageFormatRGBA, CONVERT_KERNELS(convertYuyvToRgbaScalar, NULL, NULL, NULL)}
+};
+
+#if defined(CONVERT_X86)
+static void convertCpuid(uint32_t leaf, uint32_t subleaf, uint32_t regs[4])
+{
+#if defined(_MSC_VER)
+  __cpuidex((int *)regs, (int)leaf, (int)subleaf);
+#else
+  __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static uint64_t convertXgetbv(void)
+{
+#if defined(_MSC_VER)
+  return _xgetbv(0);
+#else
+  uint32_t eax, edx;
+  __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return ((uint64_t)edx<<32)|eax;
+#endif
+}
+#endif
+
+static int convertDetect(void)
+{
+  int ret=SharedImageSimdScalar;
+#if defined(CONVERT_X86)
+  uint32_t regs[4], maxLeaf;
+  convertCpuid(0, 0, regs);
+  maxLeaf=regs[0];
+  convertCpuid(1, 0, regs);
+  if(regs[3]&(1u<<26))
+    ret=SharedImageSimdSSE2;
+  if(maxLeaf>=7 && (regs[2]&(1u<<27)) && (regs[2]&(1u<<28))) // OSXSAVE and AVX
+  {
+    uint64_t xcr0=convertXgetbv();
+    convertCpuid(7, 0, regs);
+    if((xcr0&0x6)==0x6 && (regs[1]&(1u<<5))) // YMM state enabled by the OS
+      ret=SharedImageSimdAVX2;
+    if(ret==SharedImageSimdAVX2 && (xcr0&0xE6)==0xE6 && (regs[1]&(1u<<16)) && (regs[1]&(1u<<30))) // ZMM state, AVX512F and AVX512BW
+      ret=SharedImageSimdAVX512;
+  }
+#endif
+  return ret;
+}
+
+SharedImageSimdLevel sharedImageConvertSimdLevel(void)
+{
+  if(convertDetectedLevel<0)
+    convertDetectedLevel=convertDetect();
+  return (SharedImageSimdLevel)(convertWantedLevel<convertDetectedLevel?convertWantedLevel:convertDetectedLevel);
+}
+
+void sharedImageConvertSetSimdLevel(SharedImageSimdLevel level)
+{
+  // The level indexes the kernel tables, values out of the enumeration are clamped
+  if((int)level<SharedImageSimdScalar)
+    convertWantedLevel=SharedImageSimdScalar;
+  else if((int)level>SharedImageSimdAVX512)
+    convertWantedLevel=SharedImageSimdAVX512;
+  else
+    convertWantedLevel=level;
+}
+
+void sharedImageConvertSetThreads(uint32_t numThreads)
+{
+  convertThreads=numThreads;
+}
+
+static const ConvertEntry *convertFind(uint32_t sourceFormat, uint32_t destinationFormat)
+{
+  const ConvertEntry *ret=NULL;
+  for(size_t i=0;i<sizeof(convertEntries)/sizeof(convertEntries[0]) && !ret;i++)
+  {
+    if(convertEntries[i].sourceFormat==sourceFormat && convertEntries[i].destinationFormat==destinationFormat)
+      ret=&convertEntries[i];
+  }
+  return ret;
+}
+
+bool sharedImageConvertSupported(uint32_t sourceFormat, uint32_t destinationFormat)
+{
+  return (sourceFormat==destinationFormat && sourceFormat<SharedImageFormatCount) || convertFind(sourceFormat, destinationFormat);
+}
+
+// Returns how many stripes to use for a job that can be split at most in maxStripes parts
+static uint32_t convertNumStripes(uint64_t maxStripes)
+{
+  uint32_t ret=1;
+  if(convertThreads!=1)
+  {
+    ret=sharedImageParallelThreads();
+    if(convertThreads && ret>convertThreads)
+      ret=convertThreads;
+    if(ret>maxStripes)
+      ret=(uint32_t)maxStripes;
+    if(!ret)
+      ret=1;
+  }
+  return ret;
+}
+
+// Returns the lines of row y, chroma planes follow the layout described in sharedimage.h
+static void convertLine(const uint8_t *data, const SharedImageSetting *setting, uint32_t y, ConvertLine *line)
+{
+  size_t lumaSize=(size_t)setting->bytesPerLine*setting->height;
+  size_t chromaBytesPerLine=(setting->format==SharedImageFormatI420)?(setting->bytesPerLine+1)/2:setting->bytesPerLine;
+  size_t chromaSize=chromaBytesPerLine*((setting->height+1)/2);
+  line->plane[0]=data+(size_t)y*setting->bytesPerLine;
+  line->plane[1]=data+lumaSize+(y/2)*chromaBytesPerLine;
+  line->plane[2]=line->plane[1]+chromaSize;
+}
+
+static void convertStripe(void *context, uint32_t stripe, uint32_t numStripes)
+{
+  const ConvertJob *job=(const ConvertJob *)context;
+  const SharedImageSetting *source=job->sourceSetting, *destination=job->destinationSetting;
+  // Stripes start on even lines, so chroma lines of 4:2:0 formats belong to a single stripe
+  uint32_t lines=(source->height+1)/2;
+  uint32_t first=lines*stripe/numStripes*2, last=lines*(stripe+1)/numStripes*2;
+  if(last>source->height)
+    last=source->height;
+  for(uint32_t y=first;y<last;y++)
+  {
+    ConvertLine sourceLine, destinationLine;
+    convertLine(job->source, source, y, &sourceLine);
+    convertLine(job->destination, destination, y, &destinationLine);
+    if(job->kernel)
+      job->kernel(&sourceLine, (uint8_t *)destinationLine.plane[0], source->width);
+    else // Repacking
+    {
+      memcpy((uint8_t *)destinationLine.plane[0], sourceLine.plane[0], sharedImageFormatMinBytesPerLine(source->format, source->width));
+      if((y&1)==0 && source->format==SharedImageFormatNV12)
+        memcpy((uint8_t *)destinationLine.plane[1], sourceLine.plane[1], (source->width+1)/2*2);
+      else if((y&1)==0 && source->format==SharedImageFormatI420)
+      {
+        memcpy((uint8_t *)destinationLine.plane[1], sourceLine.plane[1], (source->width+1)/2);
+        memcpy((uint8_t *)destinationLine.plane[2], sourceLine.plane[2], (source->width+1)/2);
+      }
+    }
+  }
+}
+
+bool sharedImageConvert(const void *source, const SharedImageSetting *sourceSetting, void *destination, const SharedImageSetting *destinationSetting)
+{
+  bool ret=false;
+  const ConvertEntry *entry=NULL;
+  if(!source || !destination || !sourceSetting || !destinationSetting || sourceSetting->width!=destinationSetting->width || sourceSetting->height!=destinationSetting->height)
+  {
+  }
+  else if(!sharedImageFrameBytes(sourceSetting) || !sharedImageFrameBytes(destinationSetting))
+  {
+  }
+  else if(sourceSetting->format==destinationSetting->format || (entry=convertFind(sourceSetting->format, destinationSetting->format))!=NULL)
+  {
+    ConvertJob job;
+    uint64_t bytes=sharedImageFrameBytes(sourceSetting)+sharedImageFrameBytes(destinationSetting);
+    uint32_t numStripes=1;
+    job.kernel=NULL;
+    for(int level=sharedImageConvertSimdLevel();entry && level>=0 && !job.kernel;level--)
+      job.kernel=entry->kernels[level];
+    if(entry && !job.kernel) // Every conversion has a scalar kernel
+      job.kernel=entry->kernels[0];
+    job.source=(const uint8_t *)source;
+    job.sourceSetting=sourceSetting;
+    job.destination=(uint8_t *)destination;
+    job.destinationSetting=destinationSetting;
+    if(bytes>=CONVERT_STRIPE_BYTES)
+      numStripes=convertNumStripes(sourceSetting->height/CONVERT_MIN_STRIPE_LINES);
+    sharedImageParallelRun(convertStripe, &job, numStripes);
+    ret=true;
+  }
+  return ret;
+}
+
+bool sharedImageReceiveConverted(struct SharedImage *image, void *buffer, uint64_t bufferSize, uint32_t format, uint32_t bytesPerLine, SharedImageSetting *setting)
+{
+  bool ret=false;
+  void *data;
+  const SharedImageSetting *frameSetting;
+  if(sharedImageReceive(image, &data, &frameSetting))
+  {
+    SharedImageSetting bufferSetting;
+    bufferSetting.width=frameSetting->width;
+    bufferSetting.height=frameSetting->height;
+    bufferSetting.bytesPerLine=bytesPerLine?bytesPerLine:sharedImageFormatMinBytesPerLine(format, frameSetting->width);
+    bufferSetting.format=format;
+    if(!sharedImageConvertSupported(frameSetting->format, format))
+      bufferSetting.bytesPerLine=0;
+    else if(sharedImageFrameBytes(&bufferSetting) && sharedImageFrameBytes(&bufferSetting)<=bufferSize)
+      ret=sharedImageConvert(data, frameSetting, buffer, &bufferSetting);
+    if(setting)
+      *setting=bufferSetting;
+  }
+  return ret;
+}
+
+// Offset of the first cache line of destination starting at or after offset
+static size_t convertLineBoundary(const ConvertCopyJob *job, size_t offset)
+{
+  uintptr_t start=(uintptr_t)job->destination;
+  size_t ret=(size_t)(((start+offset+63)&~(uintptr_t)63)-start);
+  return ret<job->bytes?ret:job->bytes;
+}
+
+static void convertCopyStripe(void *context, uint32_t stripe, uint32_t numStripes)
+{
+  const ConvertCopyJob *job=(const ConvertCopyJob *)context;
+  // Stripes start on cache lines of the destination, so no line is written by two threads
+  size_t size=job->bytes/numStripes;
+  size_t first=stripe?convertLineBoundary(job, size*stripe):0;
+  size_t last=(stripe+1==numStripes)?job->bytes:convertLineBoundary(job, size*(stripe+1));
+  job->copy(job->destination+first, job->source+first, last-first);
+}
+
+void sharedImageCopy(void *destination, const void *source, size_t bytes)
+{
+  if(bytes<CONVERT_STREAM_BYTES)
+    memcpy(destination, source, bytes);
+  else
+  {
+    ConvertCopyJob job;
+    job.copy=NULL;
+    for(int level=sharedImageConvertSimdLevel();level>=0 && !job.copy;level--)
+      job.copy=convertCopyKernels[level];
+    job.destination=(uint8_t *)destination;
+    job.source=(const uint8_t *)source;
+    job.bytes=bytes;
+    sharedImageParallelRun(convertCopyStripe, &job, convertNumStripes(bytes/CONVERT_MIN_STRIPE_COPY));
+  }
+}
+
+static void convertHalfStripe(void *context, uint32_t stripe, uint32_t numStripes)
+{
+  const ConvertHalfJob *job=(const ConvertHalfJob *)context;
+  uint32_t first=(uint32_t)((uint64_t)job->height*stripe/numStripes), last=(uint32_t)((uint64_t)job->height*(stripe+1)/numStripes);
+  for(uint32_t y=first;y<last;y++)
+  {
+    const uint8_t *line=job->source+(size_t)y*2*job->sourceBytesPerLine;
+    job->kernel(line, line+job->sourceBytesPerLine, job->destination+(size_t)y*job->destinationBytesPerLine, job->width);
+  }
+}
+
+uint32_t sharedImageBuildPyramid(void *buffer, uint32_t bufferSize, SharedImagePlane *levels, uint32_t numLevels)
+{
+  uint32_t ret=0;
+  uint64_t end=(levels && numLevels)?levels[0].offset+sharedImageFrameBytes(&levels[0].setting):0;
+  if(levels && numLevels && end>levels[0].offset && end<=bufferSize)
+  {
+    ConvertHalfJob job;
+    bool fits=true;
+    job.kernel=NULL;
+    for(size_t i=0;i<sizeof(convertHalfEntries)/sizeof(convertHalfEntries[0]);i++)
+    {
+      for(int level=sharedImageConvertSimdLevel();convertHalfEntries[i].format==levels[0].setting.format && level>=0 && !job.kernel;level--)
+        job.kernel=convertHalfEntries[i].kernels[level];
+    }
+    for(ret=1;job.kernel && fits && ret<numLevels && ret<SHAREDIMAGE_MAX_PLANES && levels[ret-1].setting.width>=2 && levels[ret-1].setting.height>=2;)
+    {
+      const SharedImagePlane *parent=&levels[ret-1];
+      SharedImagePlane *level=&levels[ret];
+      level->setting.width=parent->setting.width/2;
+      level->setting.height=parent->setting.height/2;
+      level->setting.format=parent->setting.format;
+      level->setting.bytesPerLine=(sharedImageFormatMinBytesPerLine(level->setting.format, level->setting.width)+15)&~15u;
+      level->offset=(uint32_t)((end+SHAREDIMAGE_PLANE_ALIGN-1)/SHAREDIMAGE_PLANE_ALIGN*SHAREDIMAGE_PLANE_ALIGN);
+      end=level->offset+sharedImageFrameBytes(&level->setting);
+      fits=(end<=bufferSize);
+      if(fits)
+      {
+        job.source=(const uint8_t *)buffer+parent->offset;
+        job.sourceBytesPerLine=parent->setting.bytesPerLine;
+        job.destination=(uint8_t *)buffer+level->offset;
+        job.destinationBytesPerLine=level->setting.bytesPerLine;
+        job.width=level->setting.width;
+        job.height=level->setting.height;
+        sharedImageParallelRun(convertHalfStripe, &job, (sharedImageFrameBytes(&parent->setting)>=CONVERT_STRIPE_BYTES)?convertNumStripes(job.height/CONVERT_MIN_STRIPE_LINES):1);
+        ret++;
+      }
+    }
+  }
+  return ret;
+}
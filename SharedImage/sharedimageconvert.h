@@ -0,0 +1,129 @@
+/*
+ * This file is part of SharedImageIPC.
+ *
+ * (c) Marzocchi Alessandro
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+/**
+ * @file
+ * @brief Pixel format conversion and stride repacking of shared images
+ *
+ * Supported conversions (besides repacking any format to a different bytesPerLine):
+ * - BGRA <-> RGBA
+ * - GRAY16 -> GRAY8, GRAY8 -> GRAY16
+ * - GRAY8, RGB24, BGR24, YUYV, NV12, I420 -> BGRA or RGBA
+ * - BGRA, RGBA -> GRAY8
+ *
+ * YUV formats are BT.601 limited range, chroma is upsampled by replication.
+ * Kernels are chosen at runtime among scalar, SSE2, AVX2 and AVX-512 versions (see sharedImageConvertSimdLevel),
+ * all of them produce exactly the same result. Large frames are split in stripes processed by a pool of threads.
+ *
+ * sharedImageCopy is the plain copy counterpart, meant for filling the pages returned by sharedImageOutBuffer,
+ * sharedImageBuildPyramid builds the downscaled levels sent with sharedImageSendPyramid.
+ */
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "sharedimage.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/// @brief Instruction sets used by conversion kernels
+typedef enum
+{
+  SharedImageSimdScalar=0,
+  SharedImageSimdSSE2,
+  SharedImageSimdAVX2,
+  SharedImageSimdAVX512 ///< AVX-512 F and BW
+} SharedImageSimdLevel;
+
+/**
+ * @brief Checks if a conversion is supported
+ * @param sourceFormat Format of source image
+ * @param destinationFormat Format of destination image
+ * @return True if supported
+ */
+bool sharedImageConvertSupported(uint32_t sourceFormat, uint32_t destinationFormat);
+
+/**
+ * @brief Converts an image
+ *
+ * Source and destination must have the same width and height.
+ * @param source Source image data
+ * @param sourceSetting Layout of source image
+ * @param destination Destination image data
+ * @param destinationSetting Layout of destination image
+ * @return True on success, false if the conversion is not supported or the settings are not valid
+ */
+bool sharedImageConvert(const void *source, const SharedImageSetting *sourceSetting, void *destination, const SharedImageSetting *destinationSetting);
+
+/**
+ * @brief Receives an image converting it in a buffer of the caller
+ *
+ * The received page is released as soon as it is converted (with the next successful receive, as usual).
+ * If the frame does not fit the buffer or cannot be converted, false is returned and setting is filled
+ * with the layout that would be needed (bytesPerLine 0 if the conversion is not supported).
+ * @param image Shared image object (consumer)
+ * @param buffer Destination buffer
+ * @param bufferSize Size of destination buffer, in bytes
+ * @param format Wanted format, one of SharedImageFormat
+ * @param bytesPerLine Wanted bytesPerLine, 0 for packed lines
+ * @param setting Will be filled with the layout of the image in buffer
+ * @return True if an image was received and converted
+ */
+bool sharedImageReceiveConverted(struct SharedImage *image, void *buffer, uint64_t bufferSize, uint32_t format, uint32_t bytesPerLine, SharedImageSetting *setting);
+
+/**
+ * @brief Copies a frame, usually into a page of a shared image
+ *
+ * Large copies use non-temporal stores, so the frame does not evict the cache of the producer that will
+ * never read it again, and are split among threads like conversions. Small copies are a plain memcpy.
+ * @param destination Destination buffer
+ * @param source Source buffer, must not overlap destination
+ * @param bytes Number of bytes to copy
+ */
+void sharedImageCopy(void *destination, const void *source, size_t bytes);
+
+/**
+ * @brief Builds downscaled levels of an image for sharedImageSendPyramid
+ *
+ * Each level is half the size of the previous one (2x2 box filter, odd last row and column dropped) and is placed
+ * after it in buffer. Levels are built for BGRA, RGBA, RGB24, BGR24, GRAY8 and GRAY16 images, while they fit the buffer.
+ * @param buffer Buffer holding the image, usually returned by sharedImageOutBufferBytes
+ * @param bufferSize Size of buffer, in bytes
+ * @param levels levels[0] describes the image, the following ones are filled
+ * @param numLevels Number of wanted levels including the image, up to SHAREDIMAGE_MAX_PLANES
+ * @return Number of valid levels in levels (1 if no level was built), 0 if levels[0] is not valid
+ */
+uint32_t sharedImageBuildPyramid(void *buffer, uint32_t bufferSize, SharedImagePlane *levels, uint32_t numLevels);
+
+/**
+ * @brief Returns the instruction set used by conversion kernels
+ */
+SharedImageSimdLevel sharedImageConvertSimdLevel(void);
+
+/**
+ * @brief Limits the instruction set used by conversion kernels
+ *
+ * Used for benchmarks and tests. The level is clamped to the one supported by the CPU,
+ * values outside SharedImageSimdLevel to the nearest valid one.
+ * @param level Maximum level
+ */
+void sharedImageConvertSetSimdLevel(SharedImageSimdLevel level);
+
+/**
+ * @brief Sets the maximum number of threads used for a conversion or a copy
+ * @param numThreads Number of threads, 0 for automatic
+ */
+void sharedImageConvertSetThreads(uint32_t numThreads);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,234 @@
+/*
+ * This file is part of SharedImageIPC.
+ *
+ * (c) Marzocchi Alessandro
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#include "sharedimagesync.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CLEAR_ERROR(object) object->message[0]='\0'
+#define SET_ERROR(object, ...) snprintf(object->message, sizeof(object->message), __VA_ARGS__)
+
+typedef struct
+{
+  struct SharedImage *image;
+  SharedImageLease held[SHAREDIMAGESYNC_MAX_HELD]; // Frames waiting for a set, oldest first from index first
+  uint32_t first;
+  uint32_t numHeld;
+  uint64_t lastTimestampUs; // Timestamp of the newest frame acquired
+  bool seen;
+  uint64_t dropped;
+} SharedImageSyncChannel;
+
+struct SharedImageSync
+{
+  char message[128];
+  uint32_t numChannels;
+  uint64_t toleranceUs;
+  uint32_t maxHeld;
+  SharedImageSyncChannel channels[SHAREDIMAGESYNC_MAX_CHANNELS];
+};
+
+static uint64_t syncOldestUs(const SharedImageSyncChannel *channel)
+{
+  return channel->held[channel->first].info->timestampUs;
+}
+
+static void syncPop(SharedImageSyncChannel *channel, SharedImageLease *lease)
+{
+  *lease=channel->held[channel->first];
+  channel->held[channel->first].page=-1;
+  channel->first=(channel->first+1)%SHAREDIMAGESYNC_MAX_HELD;
+  channel->numHeld--;
+}
+
+static void syncDrop(SharedImageSyncChannel *channel)
+{
+  SharedImageLease lease;
+  syncPop(channel, &lease);
+  sharedImageRelease(channel->image, &lease);
+  channel->dropped++;
+}
+
+static void syncAcquire(struct SharedImageSync *sync)
+{
+  for(uint32_t i=0;i<sync->numChannels;i++)
+  {
+    SharedImageSyncChannel *channel=&sync->channels[i];
+    SharedImageLease lease;
+    while(channel->numHeld<sync->maxHeld && sharedImageAcquire(channel->image, &lease))
+    {
+      channel->held[(channel->first+channel->numHeld)%SHAREDIMAGESYNC_MAX_HELD]=lease;
+      channel->numHeld++;
+      channel->lastTimestampUs=lease.info->timestampUs;
+      channel->seen=true;
+    }
+  }
+}
+
+bool sharedImageSyncCreate(struct SharedImage *const *images, uint32_t numChannels, uint64_t toleranceUs, uint32_t maxHeld, struct SharedImageSync **sync)
+{
+  bool ret=false;
+  if(sync)
+  {
+    struct SharedImageSync *syncRet=(struct SharedImageSync *)calloc(1, sizeof(struct SharedImageSync));
+    *sync=syncRet;
+    if(!syncRet)
+    {
+    }
+    else if(!images || !numChannels || numChannels>SHAREDIMAGESYNC_MAX_CHANNELS || !maxHeld || maxHeld>SHAREDIMAGESYNC_MAX_HELD)
+      SET_ERROR(syncRet, "Invalid parameters");
+    else
+    {
+      ret=true;
+      syncRet->numChannels=numChannels;
+      syncRet->toleranceUs=toleranceUs;
+      syncRet->maxHeld=maxHeld;
+      for(uint32_t i=0;i<numChannels;i++)
+      {
+        syncRet->channels[i].image=images[i];
+        if(!images[i] || sharedImageMode(images[i])==SharedImageModeTriple)
+          ret=false;
+      }
+      if(!ret)
+        SET_ERROR(syncRet, "Channels must be latest or FIFO consumers");
+    }
+  }
+  return ret;
+}
+
+bool sharedImageSyncNext(struct SharedImageSync *sync, SharedImageLease *set)
+{
+  bool ret=false;
+  if(!sync)
+  {
+  }
+  else if(!set)
+    SET_ERROR(sync, "Invalid parameters");
+  else
+  {
+    bool progress=true;
+    CLEAR_ERROR(sync);
+    while(!ret && progress)
+    {
+      // Channels never have frames older than the oldest one held, or than the newest one seen when they hold none
+      uint64_t newestUs=0;
+      bool complete=true;
+      syncAcquire(sync);
+      for(uint32_t i=0;i<sync->numChannels;i++)
+      {
+        const SharedImageSyncChannel *channel=&sync->channels[i];
+        uint64_t boundUs=channel->numHeld?syncOldestUs(channel):channel->lastTimestampUs;
+        if(!channel->numHeld)
+          complete=false;
+        if((channel->numHeld || channel->seen) && boundUs>newestUs)
+          newestUs=boundUs;
+      }
+      progress=false;
+      for(uint32_t i=0;i<sync->numChannels;i++) // Frames too old for any set
+      {
+        SharedImageSyncChannel *channel=&sync->channels[i];
+        if(channel->numHeld && newestUs-syncOldestUs(channel)>sync->toleranceUs)
+        {
+          syncDrop(channel);
+          progress=true;
+        }
+      }
+      if(!progress && complete)
+      {
+        for(uint32_t i=0;i<sync->numChannels;i++)
+          syncPop(&sync->channels[i], &set[i]);
+        ret=true;
+      }
+      else if(!progress) // A channel is late, the full ones drop their oldest frame to keep receiving
+      {
+        for(uint32_t i=0;i<sync->numChannels;i++)
+        {
+          SharedImageSyncChannel *channel=&sync->channels[i];
+          if(channel->numHeld>=sync->maxHeld)
+          {
+            syncDrop(channel);
+            progress=true;
+          }
+        }
+      }
+    }
+  }
+  return ret;
+}
+
+bool sharedImageSyncRelease(struct SharedImageSync *sync, SharedImageLease *set)
+{
+  bool ret=false;
+  if(!sync)
+  {
+  }
+  else if(!set)
+    SET_ERROR(sync, "Invalid parameters");
+  else
+  {
+    ret=true;
+    for(uint32_t i=0;i<sync->numChannels;i++)
+    {
+      if(set[i].page>=0 && !sharedImageRelease(sync->channels[i].image, &set[i]))
+        ret=false;
+    }
+    if(ret)
+      CLEAR_ERROR(sync);
+    else
+      SET_ERROR(sync, "Invalid lease");
+  }
+  return ret;
+}
+
+bool sharedImageSyncWait(struct SharedImageSync *sync, uint32_t timeoutMs)
+{
+  bool ret=false;
+  if(sync && sync->numChannels)
+  {
+    uint32_t late=0;
+    while(late<sync->numChannels-1 && sync->channels[late].numHeld)
+      late++;
+    ret=sharedImageWaitNotify(sync->channels[late].image, timeoutMs);
+  }
+  return ret;
+}
+
+uint64_t sharedImageSyncDropped(struct SharedImageSync *sync, uint32_t channel)
+{
+  return (sync && channel<sync->numChannels)?sync->channels[channel].dropped:0;
+}
+
+bool sharedImageSyncDestroy(struct SharedImageSync *sync)
+{
+  bool ret=false;
+  if(sync)
+  {
+    ret=true;
+    for(uint32_t i=0;i<sync->numChannels;i++)
+    {
+      SharedImageSyncChannel *channel=&sync->channels[i];
+      while(channel->numHeld)
+      {
+        SharedImageLease lease;
+        syncPop(channel, &lease);
+        if(!sharedImageRelease(channel->image, &lease))
+          ret=false;
+      }
+    }
+    free(sync);
+  }
+  return ret;
+}
+
+const char *sharedImageSyncGetError(struct SharedImageSync *sync)
+{
+  sync->message[sizeof(sync->message)-1]='\0';
+  return sync->message;
+}
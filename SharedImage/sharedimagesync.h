@@ -0,0 +1,110 @@
+/*
+ * This file is part of SharedImageIPC.
+ *
+ * (c) Marzocchi Alessandro
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+/**
+ * @file
+ * @brief Timestamp synchronization of frames received on several shared images
+ *
+ * Stereo and multi-camera rigs publish each camera on its own shared image. A synchronizer acquires frames
+ * from all the channels (see sharedImageAcquire) and returns them as sets whose timestamps differ by at most
+ * a tolerance, one frame per channel. Frames are held through leases, never copied.
+ *
+ * Frames of each channel must be sent with increasing timestamps, from the same clock (see sharedImageTimestampUs).
+ * A frame is dropped when it cannot be part of a set anymore, i.e. when another channel already has a newer frame
+ * beyond the tolerance, or when its channel holds maxHeld frames waiting for a channel that is late.
+ * A synchronizer and the sets it returns are used by a single thread.
+ */
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "sharedimage.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/// @brief Maximum number of synchronized channels
+#define SHAREDIMAGESYNC_MAX_CHANNELS 8
+/// @brief Maximum number of frames waiting for a set on each channel
+#define SHAREDIMAGESYNC_MAX_HELD 8
+
+/** @struct SharedImageSync
+ *  @brief Opaque pointer representing a synchronizer
+ */
+struct SharedImageSync;
+
+/**
+ * @brief Creates a synchronizer
+ *
+ * The shared images are not owned by the synchronizer and must outlive it. They must be consumers
+ * in latest or FIFO mode, and should have at least maxHeld+1 buffers so that the generator is not stalled
+ * while a set is in use.
+ * Note that even on error an object may be returned and it can be only checked for error
+ * @param images Consumer shared images, one for each channel
+ * @param numChannels Number of channels, from 1 to SHAREDIMAGESYNC_MAX_CHANNELS
+ * @param toleranceUs Maximum difference between the timestamps of the frames of a set, in microseconds
+ * @param maxHeld Maximum number of frames waiting for a set on each channel, from 1 to SHAREDIMAGESYNC_MAX_HELD
+ * @param sync Pointer that will receive a pointer to the created object
+ * @return True on success
+ */
+bool sharedImageSyncCreate(struct SharedImage *const *images, uint32_t numChannels, uint64_t toleranceUs, uint32_t maxHeld, struct SharedImageSync **sync);
+
+/**
+ * @brief Returns the next set of frames
+ *
+ * Frames available on the channels are acquired, and the oldest matching set is returned.
+ * The set must be given back with sharedImageSyncRelease.
+ * @param sync Synchronizer
+ * @param set Array of numChannels leases that will be filled with the frames of the set, in channel order
+ * @return True if a set was returned, false if no set is complete yet
+ */
+bool sharedImageSyncNext(struct SharedImageSync *sync, SharedImageLease *set);
+
+/**
+ * @brief Releases the frames of a set returned by sharedImageSyncNext
+ * @param sync Synchronizer
+ * @param set Array of numChannels leases, their pages are set to -1
+ * @return True on success
+ */
+bool sharedImageSyncRelease(struct SharedImageSync *sync, SharedImageLease *set);
+
+/**
+ * @brief Waits for a frame on the channel the next set is waiting for
+ * @param sync Synchronizer
+ * @param timeoutMs Timeout to wait, in milliseconds
+ * @return True if a notification happened
+ */
+bool sharedImageSyncWait(struct SharedImageSync *sync, uint32_t timeoutMs);
+
+/**
+ * @brief Returns the number of frames dropped because they did not match any set
+ * @param sync Synchronizer
+ * @param channel Channel number
+ * @return Number of dropped frames
+ */
+uint64_t sharedImageSyncDropped(struct SharedImageSync *sync, uint32_t channel);
+
+/**
+ * @brief Releases the frames still held and destroys the synchronizer
+ *
+ * Sets returned by sharedImageSyncNext must be released before.
+ * @param sync The object to destroy
+ * @return True on success
+ */
+bool sharedImageSyncDestroy(struct SharedImageSync *sync);
+
+/**
+ * @brief Returns current error message
+ */
+const char *sharedImageSyncGetError(struct SharedImageSync *sync);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,17 @@
+CONFIG -= qt
+
+TEMPLATE = lib
+CONFIG += staticlib
+
+SOURCES += \
+    sharedimagebridge.c
+
+HEADERS += \
+    sharedimagebridge.h
+
+win32:DEFINES += SHAREDMEM_WIN32
+linux:DEFINES += SHAREDMEM_LINUX
+win32:LIBS += -lws2_32
+
+INCLUDEPATH += $$PWD/../SharedMem
+INCLUDEPATH += $$PWD/../SharedImage
@@ -0,0 +1,593 @@
+/*
+ * This file is part of SharedImageIPC.
+ *
+ * (c) Marzocchi Alessandro
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#include "sharedimagebridge.h"
+#include "sharedimage.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(_WIN32)
+  #include <winsock2.h>
+  #include <ws2tcpip.h>
+  typedef SOCKET BridgeSocket;
+  typedef WSABUF BridgeBuffer;
+  #define BRIDGE_INVALID_SOCKET INVALID_SOCKET
+  #define bridgeCloseSocket closesocket
+  #define bridgePoll WSAPoll
+  #define bridgeWouldBlock() (WSAGetLastError()==WSAEWOULDBLOCK)
+  #define BRIDGE_BUFFER_PTR(buffer) ((buffer)->buf)
+  #define BRIDGE_BUFFER_LEN(buffer) ((buffer)->len)
+#else
+  #include <errno.h>
+  #include <fcntl.h>
+  #include <netdb.h>
+  #include <poll.h>
+  #include <unistd.h>
+  #include <arpa/inet.h>
+  #include <netinet/in.h>
+  #include <netinet/tcp.h>
+  #include <sys/socket.h>
+  #include <sys/uio.h>
+  typedef int BridgeSocket;
+  typedef struct iovec BridgeBuffer;
+  #define BRIDGE_INVALID_SOCKET -1
+  #define bridgeCloseSocket close
+  #define bridgePoll poll
+  #define bridgeWouldBlock() (errno==EAGAIN || errno==EWOULDBLOCK || errno==EINTR)
+  #define BRIDGE_BUFFER_PTR(buffer) ((buffer)->iov_base)
+  #define BRIDGE_BUFFER_LEN(buffer) ((buffer)->iov_len)
+#endif
+
+#define CLEAR_ERROR(bridge) bridge->message[0]='\0'
+#define SET_ERROR(bridge, ...) snprintf(bridge->message, sizeof(bridge->message), __VA_ARGS__)
+
+#define SHAREDIMAGEBRIDGE_MAGIC 0x4B8E21F9 // Changed with the header layout, older peers fail with an invalid header
+#define SHAREDIMAGEBRIDGE_MAX_BUFFERS 512 // Buffers passed to a single scatter-gather write (below IOV_MAX)
+#define SHAREDIMAGEBRIDGE_DISCARD_SIZE 65536
+
+// Header preceding every frame on the wire, fields are in network byte order
+typedef struct
+{
+  uint32_t magic;
+  uint32_t sequenceHigh;  // SharedImageFrameInfo of the frame in the source channel, as 32 bit halves
+  uint32_t sequenceLow;
+  uint32_t timestampHigh; // In the clock of the sender host
+  uint32_t timestampLow;
+  uint32_t width;
+  uint32_t height;
+  uint32_t bytesPerLine; // Rows of packed formats are sent without the padding of the shared page
+  uint32_t format;
+  uint32_t payloadSize;
+} SharedImageBridgeFrameHeader;
+
+typedef enum
+{
+  BridgeReceiveHeader,
+  BridgeReceiveWaitPage,
+  BridgeReceivePayload
+} BridgeReceiveState;
+
+struct SharedImageBridge
+{
+  char message[128];
+  bool sender;
+  bool winsock;
+  struct SharedImage *image;
+  SharedImageBridgeSetting setting;
+  SharedImageBridgeStatistics statistics;
+  BridgeSocket listenSocket;
+  BridgeSocket socket;
+  uint16_t port;
+  SharedImageBridgeFrameHeader header;
+  // Sender: buffers of the frame being written
+  BridgeBuffer *buffers;
+  uint32_t numBuffers;
+  uint32_t firstBuffer;
+  uint32_t allocatedBuffers;
+  // Receiver
+  BridgeReceiveState state;
+  uint32_t received;
+  uint8_t *destination;
+  uint8_t *discard;
+  SharedImageSetting frameSetting;
+  SharedImageFrameInfo frameInfo;
+};
+
+static void bridgeSetBuffer(BridgeBuffer *buffer, const void *data, uint32_t size)
+{
+#if defined(_WIN32)
+  buffer->buf=(CHAR *)data;
+  buffer->len=size;
+#else
+  buffer->iov_base=(void *)data;
+  buffer->iov_len=size;
+#endif
+}
+
+static bool bridgeSetNonBlocking(BridgeSocket s)
+{
+#if defined(_WIN32)
+  u_long mode=1;
+  return ioctlsocket(s, FIONBIO, &mode)==0;
+#else
+  int flags=fcntl(s, F_GETFL, 0);
+  return flags>=0 && fcntl(s, F_SETFL, flags|O_NONBLOCK)==0;
+#endif
+}
+
+// Returns >0 if socket is ready, 0 on timeout, <0 on error
+static int bridgeWait(BridgeSocket s, short events, uint32_t timeoutMs)
+{
+  struct pollfd fd;
+  fd.fd=s;
+  fd.events=events;
+  fd.revents=0;
+  return bridgePoll(&fd, 1, (int)timeoutMs);
+}
+
+// Returns bytes written, 0 if the socket would block, -1 on error
+static int64_t bridgeWritev(BridgeSocket s, BridgeBuffer *buffers, uint32_t count)
+{
+  int64_t ret;
+#if defined(_WIN32)
+  DWORD sent=0;
+  if(WSASend(s, buffers, count, &sent, 0, NULL, NULL)==0)
+    ret=sent;
+  else
+    ret=bridgeWouldBlock()?0:-1;
+#else
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov=buffers;
+  msg.msg_iovlen=count;
+  ssize_t sent=sendmsg(s, &msg, MSG_NOSIGNAL);
+  if(sent>=0)
+    ret=sent;
+  else
+    ret=bridgeWouldBlock()?0:-1;
+#endif
+  return ret;
+}
+
+// Returns bytes read, 0 if the socket would block, -1 on error or if connection was closed
+static int64_t bridgeRead(BridgeSocket s, void *data, uint32_t size)
+{
+  int64_t ret=recv(s, (char *)data, size, 0);
+  if(ret==0)
+    ret=-1;
+  else if(ret<0)
+    ret=bridgeWouldBlock()?0:-1;
+  return ret;
+}
+
+static struct SharedImageBridge *bridgeAllocate(struct SharedImage *image, const SharedImageBridgeSetting *setting, bool sender)
+{
+  struct SharedImageBridge *ret=(struct SharedImageBridge *)calloc(1, sizeof(struct SharedImageBridge));
+  if(ret)
+  {
+    ret->sender=sender;
+    ret->image=image;
+    ret->listenSocket=ret->socket=BRIDGE_INVALID_SOCKET;
+    ret->state=BridgeReceiveHeader;
+    if(setting)
+      ret->setting=*setting;
+#if defined(_WIN32)
+    WSADATA wsaData;
+    ret->winsock=(WSAStartup(MAKEWORD(2, 2), &wsaData)==0);
+#endif
+  }
+  return ret;
+}
+
+bool sharedImageBridgeCreateSender(struct SharedImage *source, const char *host, uint16_t port, const SharedImageBridgeSetting *setting, struct SharedImageBridge **bridge)
+{
+  bool ret=false;
+  if(bridge)
+  {
+    struct SharedImageBridge *bridgeRet=bridgeAllocate(source, setting, true);
+    struct addrinfo hints, *result=NULL;
+    char portString[8];
+    *bridge=bridgeRet;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family=AF_UNSPEC;
+    hints.ai_socktype=SOCK_STREAM;
+    snprintf(portString, sizeof(portString), "%u", port);
+    if(!bridgeRet)
+    {
+    }
+    else if(!source || !host)
+      SET_ERROR(bridgeRet, "Invalid parameters");
+    else if(getaddrinfo(host, portString, &hints, &result)!=0 || !result)
+      SET_ERROR(bridgeRet, "Cannot resolve host");
+    else
+    {
+      for(struct addrinfo *addr=result;addr && bridgeRet->socket==BRIDGE_INVALID_SOCKET;addr=addr->ai_next)
+      {
+        BridgeSocket s=socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+        if(s==BRIDGE_INVALID_SOCKET)
+          continue;
+        if(connect(s, addr->ai_addr, (int)addr->ai_addrlen)==0)
+          bridgeRet->socket=s;
+        else
+          bridgeCloseSocket(s);
+      }
+      freeaddrinfo(result);
+      if(bridgeRet->socket==BRIDGE_INVALID_SOCKET)
+        SET_ERROR(bridgeRet, "Cannot connect to %s:%u", host, port);
+      else
+      {
+        int value=1;
+        struct sockaddr_storage local;
+        socklen_t localLength=sizeof(local);
+        setsockopt(bridgeRet->socket, IPPROTO_TCP, TCP_NODELAY, (const char *)&value, sizeof(value));
+        if(bridgeRet->setting.socketBufferSize)
+        {
+          value=(int)bridgeRet->setting.socketBufferSize;
+          setsockopt(bridgeRet->socket, SOL_SOCKET, SO_SNDBUF, (const char *)&value, sizeof(value));
+        }
+        if(getsockname(bridgeRet->socket, (struct sockaddr *)&local, &localLength)==0)
+          bridgeRet->port=ntohs(((struct sockaddr_in *)&local)->sin_port); // Same offset for sockaddr_in6
+        if(!bridgeSetNonBlocking(bridgeRet->socket))
+          SET_ERROR(bridgeRet, "Cannot set socket non-blocking");
+        else
+          ret=true;
+      }
+    }
+  }
+  return ret;
+}
+
+bool sharedImageBridgeCreateReceiver(struct SharedImage *sink, const char *bindAddress, uint16_t port, const SharedImageBridgeSetting *setting, struct SharedImageBridge **bridge)
+{
+  bool ret=false;
+  if(bridge)
+  {
+    struct SharedImageBridge *bridgeRet=bridgeAllocate(sink, setting, false);
+    struct sockaddr_in address;
+    socklen_t addressLength=sizeof(address);
+    int value=1;
+    *bridge=bridgeRet;
+    memset(&address, 0, sizeof(address));
+    address.sin_family=AF_INET;
+    address.sin_port=htons(port);
+    address.sin_addr.s_addr=htonl(INADDR_ANY);
+    if(!bridgeRet)
+    {
+    }
+    else if(!sink)
+      SET_ERROR(bridgeRet, "Invalid parameters");
+    else if(!(bridgeRet->discard=(uint8_t *)malloc(SHAREDIMAGEBRIDGE_DISCARD_SIZE)))
+      SET_ERROR(bridgeRet, "Out of memory");
+    else if(bindAddress && inet_pton(AF_INET, bindAddress, &address.sin_addr)!=1)
+      SET_ERROR(bridgeRet, "Invalid bind address");
+    else if((bridgeRet->listenSocket=socket(AF_INET, SOCK_STREAM, IPPROTO_TCP))==BRIDGE_INVALID_SOCKET)
+      SET_ERROR(bridgeRet, "Cannot create socket");
+    else if(setsockopt(bridgeRet->listenSocket, SOL_SOCKET, SO_REUSEADDR, (const char *)&value, sizeof(value))!=0 ||
+            bind(bridgeRet->listenSocket, (struct sockaddr *)&address, sizeof(address))!=0)
+      SET_ERROR(bridgeRet, "Cannot bind to port %u", port);
+    else if(listen(bridgeRet->listenSocket, 1)!=0 || !bridgeSetNonBlocking(bridgeRet->listenSocket))
+      SET_ERROR(bridgeRet, "Cannot listen on port %u", port);
+    else if(getsockname(bridgeRet->listenSocket, (struct sockaddr *)&address, &addressLength)!=0)
+      SET_ERROR(bridgeRet, "Cannot get listening port");
+    else
+    {
+      bridgeRet->port=ntohs(address.sin_port);
+      ret=true;
+    }
+  }
+  return ret;
+}
+
+uint16_t sharedImageBridgePort(struct SharedImageBridge *bridge)
+{
+  return bridge?bridge->port:0;
+}
+
+static bool bridgePrepareFrame(struct SharedImageBridge *bridge, const uint8_t *data, const SharedImageSetting *setting, const SharedImageFrameInfo *info)
+{
+  bool ret=false;
+  uint32_t rowBytes=sharedImageFormatMinBytesPerLine(setting->format, setting->width);
+  bool planar=(setting->format==SharedImageFormatNV12 || setting->format==SharedImageFormatI420);
+  if(planar) // Planes are sent as they are
+    rowBytes=setting->bytesPerLine;
+  bool packed=(setting->bytesPerLine==rowBytes);
+  uint64_t frameBytes=sharedImageFrameBytes(setting);
+  uint32_t needed=1+(packed?1:setting->height);
+  if(needed>bridge->allocatedBuffers)
+  {
+    BridgeBuffer *buffers=(BridgeBuffer *)realloc(bridge->buffers, needed*sizeof(BridgeBuffer));
+    if(buffers)
+    {
+      bridge->buffers=buffers;
+      bridge->allocatedBuffers=needed;
+    }
+  }
+  if(needed>bridge->allocatedBuffers)
+    SET_ERROR(bridge, "Out of memory");
+  else if(!rowBytes || !frameBytes || !info)
+    SET_ERROR(bridge, "Invalid frame setting");
+  else
+  {
+    bridge->header.magic=htonl(SHAREDIMAGEBRIDGE_MAGIC);
+    bridge->header.sequenceHigh=htonl((uint32_t)(info->sequence>>32));
+    bridge->header.sequenceLow=htonl((uint32_t)info->sequence);
+    bridge->header.timestampHigh=htonl((uint32_t)(info->timestampUs>>32));
+    bridge->header.timestampLow=htonl((uint32_t)info->timestampUs);
+    bridge->header.width=htonl(setting->width);
+    bridge->header.height=htonl(setting->height);
+    bridge->header.bytesPerLine=htonl(rowBytes);
+    bridge->header.format=htonl(setting->format);
+    bridge->header.payloadSize=htonl(packed?(uint32_t)frameBytes:rowBytes*setting->height);
+    bridgeSetBuffer(&bridge->buffers[0], &bridge->header, sizeof(bridge->header));
+    if(packed)
+      bridgeSetBuffer(&bridge->buffers[1], data, (uint32_t)frameBytes);
+    else
+    {
+      for(uint32_t y=0;y<setting->height;y++)
+        bridgeSetBuffer(&bridge->buffers[1+y], data+(size_t)y*setting->bytesPerLine, rowBytes);
+    }
+    bridge->numBuffers=needed;
+    bridge->firstBuffer=0;
+    ret=true;
+  }
+  return ret;
+}
+
+// Skips the written bytes of the current frame, returns true if the frame was completely written
+static bool bridgeAdvance(struct SharedImageBridge *bridge, uint64_t written)
+{
+  while(written && bridge->firstBuffer<bridge->numBuffers)
+  {
+    BridgeBuffer *buffer=&bridge->buffers[bridge->firstBuffer];
+    if(written>=BRIDGE_BUFFER_LEN(buffer))
+    {
+      written-=BRIDGE_BUFFER_LEN(buffer);
+      bridge->firstBuffer++;
+    }
+    else
+    {
+      bridgeSetBuffer(buffer, (const uint8_t *)BRIDGE_BUFFER_PTR(buffer)+written, (uint32_t)(BRIDGE_BUFFER_LEN(buffer)-written));
+      written=0;
+    }
+  }
+  return bridge->firstBuffer>=bridge->numBuffers;
+}
+
+static bool bridgeProcessSender(struct SharedImageBridge *bridge, uint32_t timeoutMs)
+{
+  bool ret=true, progress, anyProgress=false;
+  do
+  {
+    progress=false;
+    if(!bridge->numBuffers)
+    {
+      // Without frame dropping a frame is taken only when it can be sent, so the producer is throttled
+      bool writable=!bridge->setting.dropOnBackpressure || bridgeWait(bridge->socket, POLLOUT, 0)>0;
+      void *data;
+      const SharedImageSetting *setting;
+      if(sharedImageReceive(bridge->image, &data, &setting))
+      {
+        progress=true;
+        if(!writable)
+          bridge->statistics.dropped++;
+        else if(!bridgePrepareFrame(bridge, (const uint8_t *)data, setting, sharedImageFrameInfo(bridge->image)))
+          bridge->statistics.dropped++;
+      }
+    }
+    if(bridge->numBuffers)
+    {
+      uint32_t count=bridge->numBuffers-bridge->firstBuffer;
+      int64_t written=bridgeWritev(bridge->socket, &bridge->buffers[bridge->firstBuffer], count<SHAREDIMAGEBRIDGE_MAX_BUFFERS?count:SHAREDIMAGEBRIDGE_MAX_BUFFERS);
+      if(written<0)
+      {
+        SET_ERROR(bridge, "Connection lost");
+        ret=false;
+      }
+      else if(written>0)
+      {
+        progress=true;
+        bridge->statistics.bytes+=written;
+        if(bridgeAdvance(bridge, written))
+        {
+          bridge->numBuffers=0;
+          bridge->statistics.frames++;
+        }
+      }
+    }
+    anyProgress|=progress;
+  } while(ret && progress);
+  if(ret && !anyProgress && timeoutMs)
+  {
+    if(bridge->numBuffers)
+      bridgeWait(bridge->socket, POLLOUT, timeoutMs);
+    else
+      sharedImageWaitNotify(bridge->image, timeoutMs);
+  }
+  return ret;
+}
+
+static bool bridgeProcessReceiver(struct SharedImageBridge *bridge, uint32_t timeoutMs)
+{
+  bool ret=true, progress, anyProgress=false;
+  if(bridge->socket==BRIDGE_INVALID_SOCKET)
+  {
+    if(bridgeWait(bridge->listenSocket, POLLIN, timeoutMs)>0)
+    {
+      BridgeSocket s=accept(bridge->listenSocket, NULL, NULL);
+      if(s!=BRIDGE_INVALID_SOCKET)
+      {
+        if(bridge->setting.socketBufferSize)
+        {
+          int value=(int)bridge->setting.socketBufferSize;
+          setsockopt(s, SOL_SOCKET, SO_RCVBUF, (const char *)&value, sizeof(value));
+        }
+        if(bridgeSetNonBlocking(s))
+          bridge->socket=s;
+        else
+          bridgeCloseSocket(s);
+      }
+    }
+    anyProgress=true; // Do not wait again below
+  }
+  if(bridge->socket!=BRIDGE_INVALID_SOCKET)
+  {
+    do
+    {
+      progress=false;
+      if(bridge->state==BridgeReceiveHeader)
+      {
+        int64_t n=bridgeRead(bridge->socket, ((uint8_t *)&bridge->header)+bridge->received, sizeof(bridge->header)-bridge->received);
+        if(n<0)
+        {
+          SET_ERROR(bridge, "Connection lost");
+          ret=false;
+        }
+        else if(n>0)
+        {
+          progress=true;
+          bridge->received+=(uint32_t)n;
+          bridge->statistics.bytes+=n;
+          if(bridge->received==sizeof(bridge->header))
+          {
+            bridge->frameSetting.width=ntohl(bridge->header.width);
+            bridge->frameSetting.height=ntohl(bridge->header.height);
+            bridge->frameSetting.bytesPerLine=ntohl(bridge->header.bytesPerLine);
+            bridge->frameSetting.format=ntohl(bridge->header.format);
+            bridge->header.payloadSize=ntohl(bridge->header.payloadSize);
+            bridge->frameInfo.sequence=((uint64_t)ntohl(bridge->header.sequenceHigh)<<32)|ntohl(bridge->header.sequenceLow);
+            bridge->frameInfo.timestampUs=((uint64_t)ntohl(bridge->header.timestampHigh)<<32)|ntohl(bridge->header.timestampLow);
+            if(ntohl(bridge->header.magic)!=SHAREDIMAGEBRIDGE_MAGIC || bridge->header.payloadSize!=sharedImageFrameBytes(&bridge->frameSetting))
+            {
+              SET_ERROR(bridge, "Invalid frame header");
+              ret=false;
+            }
+            else
+            {
+              bridge->state=BridgeReceiveWaitPage;
+              bridge->received=0;
+            }
+          }
+        }
+      }
+      if(ret && bridge->state==BridgeReceiveWaitPage)
+      {
+        void *data;
+        uint32_t availableBytes;
+        if(sharedImageOutBufferBytes(bridge->image, &data, &availableBytes))
+        {
+          bool fits=(availableBytes>=bridge->header.payloadSize);
+          bridge->destination=fits?(uint8_t *)data:NULL;
+          if(!fits)
+            bridge->statistics.dropped++;
+          bridge->state=BridgeReceivePayload;
+          progress=true;
+        }
+        else if(bridge->setting.dropOnBackpressure)
+        {
+          bridge->destination=NULL;
+          bridge->statistics.dropped++;
+          bridge->state=BridgeReceivePayload;
+          progress=true;
+        }
+      }
+      if(ret && bridge->state==BridgeReceivePayload)
+      {
+        int64_t n=0;
+        uint32_t remaining=bridge->header.payloadSize-bridge->received;
+        if(remaining)
+        {
+          if(bridge->destination) // Directly in the shared page
+            n=bridgeRead(bridge->socket, bridge->destination+bridge->received, remaining);
+          else
+            n=bridgeRead(bridge->socket, bridge->discard, remaining<SHAREDIMAGEBRIDGE_DISCARD_SIZE?remaining:SHAREDIMAGEBRIDGE_DISCARD_SIZE);
+        }
+        if(n<0)
+        {
+          SET_ERROR(bridge, "Connection lost");
+          ret=false;
+        }
+        else
+        {
+          bridge->received+=(uint32_t)n;
+          bridge->statistics.bytes+=n;
+          progress|=(n>0);
+          if(bridge->received==bridge->header.payloadSize)
+          {
+            if(bridge->destination)
+            {
+              sharedImageSendForward(bridge->image, &bridge->frameSetting, &bridge->frameInfo);
+              bridge->statistics.frames++;
+            }
+            bridge->state=BridgeReceiveHeader;
+            bridge->received=0;
+            progress=true;
+          }
+        }
+      }
+      anyProgress|=progress;
+    } while(ret && progress);
+    if(ret && !anyProgress && timeoutMs)
+    {
+      if(bridge->state==BridgeReceiveWaitPage)
+        sharedImageWaitNotify(bridge->image, timeoutMs);
+      else
+        bridgeWait(bridge->socket, POLLIN, timeoutMs);
+    }
+  }
+  return ret;
+}
+
+bool sharedImageBridgeProcess(struct SharedImageBridge *bridge, uint32_t timeoutMs)
+{
+  bool ret=false;
+  if(bridge && (bridge->socket!=BRIDGE_INVALID_SOCKET || bridge->listenSocket!=BRIDGE_INVALID_SOCKET))
+  {
+    CLEAR_ERROR(bridge);
+    ret=bridge->sender?bridgeProcessSender(bridge, timeoutMs):bridgeProcessReceiver(bridge, timeoutMs);
+  }
+  return ret;
+}
+
+bool sharedImageBridgeStatistics(struct SharedImageBridge *bridge, SharedImageBridgeStatistics *statistics)
+{
+  bool ret=false;
+  if(bridge && statistics)
+  {
+    *statistics=bridge->statistics;
+    ret=true;
+  }
+  return ret;
+}
+
+bool sharedImageBridgeDestroy(struct SharedImageBridge *bridge)
+{
+  bool ret=false;
+  if(bridge)
+  {
+    if(bridge->socket!=BRIDGE_INVALID_SOCKET)
+      bridgeCloseSocket(bridge->socket);
+    if(bridge->listenSocket!=BRIDGE_INVALID_SOCKET)
+      bridgeCloseSocket(bridge->listenSocket);
+#if defined(_WIN32)
+    if(bridge->winsock)
+      WSACleanup();
+#endif
+    free(bridge->buffers);
+    free(bridge->discard);
+    free(bridge);
+    ret=true;
+  }
+  return ret;
+}
+
+const char *sharedImageBridgeGetError(struct SharedImageBridge *bridge)
+{
+  bridge->message[sizeof(bridge->message)-1]='\0';
+  return bridge->message;
+}
@@ -0,0 +1,129 @@
+/*
+ * This file is part of SharedImageIPC.
+ *
+ * (c) Marzocchi Alessandro
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+/**
+ * @file
+ * @brief Network bridge for shared images
+ *
+ * Forwards the images of a shared image channel to another host over TCP.
+ * The sender side is the consumer of a local channel: each received page is written to the socket with a single
+ * scatter-gather write taken straight from the shared page (no copy to an intermediate buffer).
+ * The receiver side is the generator of a channel on the far side: frame data is read from the socket directly in the output page.
+ * Frames keep the sequence and timestamp of the source channel (see sharedImageSendForward); timestamps are in the clock
+ * of the sender host, so they can be compared with each other but not with the clock of the receiver host.
+ *
+ * Both sides are non-blocking state machines driven by sharedImageBridgeProcess.
+ * A sender and a receiver in the same process (or two processes) can be connected through 127.0.0.1 for testing.
+ */
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+struct SharedImage;
+
+/** @struct SharedImageBridge
+ *  @brief Opaque pointer representing a bridge endpoint
+ */
+struct SharedImageBridge;
+
+/// @brief Settings of a bridge endpoint
+typedef struct
+{
+  /// @brief If true frames are dropped instead of waiting when the peer cannot keep up
+  ///
+  /// On the sender frames are dropped while the socket is not writable, on the receiver while no output page is available.
+  /// If false backpressure is propagated: the sender stops consuming the channel, the receiver stops reading the socket.
+  bool dropOnBackpressure;
+  /// @brief Size of socket buffer (SO_SNDBUF on sender, SO_RCVBUF on receiver), 0 for system default
+  uint32_t socketBufferSize;
+} SharedImageBridgeSetting;
+
+/// @brief Counters of a bridge endpoint
+typedef struct
+{
+  uint64_t frames;  ///< Frames forwarded
+  uint64_t dropped; ///< Frames dropped because of backpressure
+  uint64_t bytes;   ///< Bytes transferred on socket, including headers
+} SharedImageBridgeStatistics;
+
+/**
+ * @brief Creates the sending side of a bridge
+ *
+ * Connects to a receiver. The source object should be a consumer object, it will be used only by sharedImageBridgeProcess.
+ * Note that even on error an object may be returned and it can be only checked for error
+ * @param source Shared image consumer whose frames will be forwarded
+ * @param host Host name or address of the receiver
+ * @param port TCP port of the receiver
+ * @param setting Settings, NULL for default (no frame dropping)
+ * @param bridge Pointer that will receive a pointer to the created object
+ * @return True on success
+ */
+bool sharedImageBridgeCreateSender(struct SharedImage *source, const char *host, uint16_t port, const SharedImageBridgeSetting *setting, struct SharedImageBridge **bridge);
+
+/**
+ * @brief Creates the receiving side of a bridge
+ *
+ * Listens for a sender connection, that will be accepted in sharedImageBridgeProcess. The sink object should be a generator object.
+ * Note that even on error an object may be returned and it can be only checked for error
+ * @param sink Shared image generator where received frames will be published
+ * @param bindAddress Local address to listen on (e.g. "127.0.0.1"), NULL for all addresses
+ * @param port TCP port to listen on, 0 to choose a free one (see sharedImageBridgePort)
+ * @param setting Settings, NULL for default (no frame dropping)
+ * @param bridge Pointer that will receive a pointer to the created object
+ * @return True on success
+ */
+bool sharedImageBridgeCreateReceiver(struct SharedImage *sink, const char *bindAddress, uint16_t port, const SharedImageBridgeSetting *setting, struct SharedImageBridge **bridge);
+
+/**
+ * @brief Returns the local TCP port of a bridge endpoint
+ */
+uint16_t sharedImageBridgePort(struct SharedImageBridge *bridge);
+
+/**
+ * @brief Makes progress on the bridge
+ *
+ * Forwards as much as possible without blocking, then waits at most timeoutMs for something to do.
+ * @param bridge Bridge endpoint
+ * @param timeoutMs Maximum time to wait if no progress can be made, in milliseconds
+ * @return False if the connection failed or was closed
+ */
+bool sharedImageBridgeProcess(struct SharedImageBridge *bridge, uint32_t timeoutMs);
+
+/**
+ * @brief Returns the counters of a bridge endpoint
+ * @param bridge Bridge endpoint
+ * @param statistics Will be filled with the counters
+ * @return True on success
+ */
+bool sharedImageBridgeStatistics(struct SharedImageBridge *bridge, SharedImageBridgeStatistics *statistics);
+
+/**
+ * @brief Destroys a bridge endpoint, closing its sockets
+ *
+ * The shared image object is not destroyed.
+ * @param bridge The object to destroy
+ * @return True on success
+ */
+bool sharedImageBridgeDestroy(struct SharedImageBridge *bridge);
+
+/**
+ * @brief Returns current error message
+ * @param bridge Bridge endpoint
+ * @return Pointer to an error message
+ */
+const char *sharedImageBridgeGetError(struct SharedImageBridge *bridge);
+
+#ifdef __cplusplus
+}
+#endif
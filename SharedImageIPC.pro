@@ -3,15 +3,27 @@ TEMPLATE = subdirs
 SUBDIRS += \
     SharedMem \
     SharedImage \
+    SharedImageBridge \
+    SharedImageRecord \
     TestConsole \
-    TestImage
+    TestImage \
+    Benchmark
 
 SharedMem.subdir = SharedMem
 
 SharedImage.subdir = SharedImage
 
+SharedImageBridge.subdir = SharedImageBridge
+SharedImageBridge.depends = SharedImage
+
+SharedImageRecord.subdir = SharedImageRecord
+SharedImageRecord.depends = SharedImage
+
 TestConsole.subdir= TestConsole
 TestConsole.depends = SharedMem
 
 TestImage.subdir = TestImage
 TestImage.depends = SharedImage
+
+Benchmark.subdir = Benchmark
+Benchmark.depends = SharedImage
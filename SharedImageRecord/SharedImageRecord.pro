@@ -0,0 +1,18 @@
+CONFIG -= qt
+
+TEMPLATE = lib
+CONFIG += staticlib
+
+SOURCES += \
+    sharedimagecapture.c \
+    sharedimagerecord.c
+
+HEADERS += \
+    sharedimagecapture.h \
+    sharedimagerecord.h
+
+win32:DEFINES += SHAREDMEM_WIN32
+linux:DEFINES += SHAREDMEM_LINUX
+
+INCLUDEPATH += $$PWD/../SharedMem
+INCLUDEPATH += $$PWD/../SharedImage
@@ -0,0 +1,438 @@
+/*
+ * This file is part of SharedImageIPC.
+ *
+ * (c) Marzocchi Alessandro
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#if !defined(_WIN32) && !defined(_GNU_SOURCE)
+  #define _GNU_SOURCE // O_DIRECT
+#endif
+#include "sharedimagecapture.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(_WIN32)
+  #include <windows.h>
+  #include <malloc.h>
+#else
+  #include <errno.h>
+  #include <fcntl.h>
+  #include <pthread.h>
+  #include <time.h>
+  #include <unistd.h>
+#endif
+
+#define CLEAR_ERROR(object) object->message[0]='\0'
+#define SET_ERROR(object, ...) snprintf(object->message, sizeof(object->message), __VA_ARGS__)
+
+struct SharedImageCapture
+{
+  char message[128];
+  struct SharedImage *image;
+  uint8_t *headerBuffer; // Header and index as they will be written at file start (dataOffset bytes)
+  SharedImageRecordHeader *header;
+  SharedImageRecordEntry *index;
+  uint64_t nextOffset;
+  bool pending; // A frame is being written, its page is still held
+  bool failed;
+  uint8_t *bounce;
+  uint64_t bounceSize;
+#if defined(_WIN32)
+  HANDLE file;
+  OVERLAPPED overlapped;
+  DWORD requestSize;
+#else
+  int fd;
+  bool threadStarted;
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  const void *requestData;
+  uint64_t requestSize;
+  uint64_t requestOffset;
+  bool requested;
+  bool done;
+  bool result;
+  bool quit;
+#endif
+};
+
+static uint64_t captureAlign(uint64_t value)
+{
+  return (value+SHAREDIMAGERECORD_ALIGN-1)/SHAREDIMAGERECORD_ALIGN*SHAREDIMAGERECORD_ALIGN;
+}
+
+static void *captureAlloc(uint64_t size)
+{
+  void *ret=NULL;
+#if defined(_WIN32)
+  ret=_aligned_malloc((size_t)size, SHAREDIMAGERECORD_ALIGN);
+#else
+  if(posix_memalign(&ret, SHAREDIMAGERECORD_ALIGN, (size_t)size)!=0)
+    ret=NULL;
+#endif
+  if(ret)
+    memset(ret, 0, (size_t)size);
+  return ret;
+}
+
+static void captureFree(void *data)
+{
+#if defined(_WIN32)
+  _aligned_free(data);
+#else
+  free(data);
+#endif
+}
+
+#if defined(_WIN32)
+static bool captureOpen(struct SharedImageCapture *capture, const char *utf8FileName)
+{
+  bool ret=false;
+  wchar_t *name=NULL;
+  int nchars=MultiByteToWideChar(CP_UTF8, 0, utf8FileName, -1, NULL, 0);
+  capture->file=INVALID_HANDLE_VALUE;
+  if(nchars>0 && (name=(wchar_t *)malloc(sizeof(wchar_t)*nchars))!=NULL && MultiByteToWideChar(CP_UTF8, 0, utf8FileName, -1, name, nchars)==nchars)
+    capture->file=CreateFileW(name, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_FLAG_NO_BUFFERING|FILE_FLAG_OVERLAPPED, NULL);
+  free(name);
+  if(capture->file==INVALID_HANDLE_VALUE)
+    SET_ERROR(capture, "Cannot create file");
+  else if((capture->overlapped.hEvent=CreateEvent(NULL, TRUE, FALSE, NULL))==NULL)
+    SET_ERROR(capture, "Error in CreateEvent");
+  else
+    ret=true;
+  return ret;
+}
+
+static bool captureSubmit(struct SharedImageCapture *capture, const void *data, uint64_t size, uint64_t offset)
+{
+  bool ret=false;
+  HANDLE event=capture->overlapped.hEvent;
+  memset(&capture->overlapped, 0, sizeof(capture->overlapped));
+  capture->overlapped.hEvent=event;
+  capture->overlapped.Offset=(DWORD)offset;
+  capture->overlapped.OffsetHigh=(DWORD)(offset>>32);
+  capture->requestSize=(DWORD)size;
+  ResetEvent(event);
+  if(WriteFile(capture->file, data, (DWORD)size, NULL, &capture->overlapped) || GetLastError()==ERROR_IO_PENDING)
+    ret=true;
+  return ret;
+}
+
+// Returns 1 if the write completed successfully, 0 if it is still pending, -1 on error
+static int captureWait(struct SharedImageCapture *capture, uint32_t timeoutMs)
+{
+  int ret=-1;
+  DWORD waitRet=WaitForSingleObject(capture->overlapped.hEvent, timeoutMs);
+  if(waitRet==WAIT_TIMEOUT)
+    ret=0;
+  else if(waitRet==WAIT_OBJECT_0)
+  {
+    DWORD written=0;
+    if(GetOverlappedResult(capture->file, &capture->overlapped, &written, FALSE) && written==capture->requestSize)
+      ret=1;
+  }
+  return ret;
+}
+
+static void captureClose(struct SharedImageCapture *capture)
+{
+  if(capture->file!=INVALID_HANDLE_VALUE)
+    CloseHandle(capture->file);
+  if(capture->overlapped.hEvent)
+    CloseHandle(capture->overlapped.hEvent);
+  capture->file=INVALID_HANDLE_VALUE;
+  capture->overlapped.hEvent=NULL;
+}
+#else
+static void *captureWriter(void *arg)
+{
+  struct SharedImageCapture *capture=(struct SharedImageCapture *)arg;
+  pthread_mutex_lock(&capture->mutex);
+  for(;;)
+  {
+    while(!capture->requested && !capture->quit)
+      pthread_cond_wait(&capture->cond, &capture->mutex);
+    if(!capture->requested)
+      break;
+    const uint8_t *data=(const uint8_t *)capture->requestData;
+    uint64_t size=capture->requestSize, offset=capture->requestOffset;
+    bool result=true;
+    pthread_mutex_unlock(&capture->mutex);
+    while(size && result)
+    {
+      ssize_t written=pwrite(capture->fd, data, (size_t)size, (off_t)offset);
+      if(written>0)
+      {
+        data+=written;
+        offset+=written;
+        size-=written;
+      }
+      else if(written<0 && errno==EINTR)
+        continue;
+      else
+        result=false;
+    }
+    pthread_mutex_lock(&capture->mutex);
+    capture->requested=false;
+    capture->done=true;
+    capture->result=result;
+    pthread_cond_broadcast(&capture->cond);
+  }
+  pthread_mutex_unlock(&capture->mutex);
+  return NULL;
+}
+
+static bool captureOpen(struct SharedImageCapture *capture, const char *utf8FileName)
+{
+  bool ret=false;
+  capture->fd=open(utf8FileName, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC|O_DIRECT, 0644);
+  if(capture->fd<0 && errno==EINVAL) // File system without direct I/O
+    capture->fd=open(utf8FileName, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+  pthread_mutex_init(&capture->mutex, NULL);
+  pthread_cond_init(&capture->cond, NULL);
+  if(capture->fd<0)
+    SET_ERROR(capture, "Cannot create file");
+  else if(pthread_create(&capture->thread, NULL, captureWriter, capture)!=0)
+    SET_ERROR(capture, "Cannot create writer thread");
+  else
+  {
+    capture->threadStarted=true;
+    ret=true;
+  }
+  return ret;
+}
+
+static bool captureSubmit(struct SharedImageCapture *capture, const void *data, uint64_t size, uint64_t offset)
+{
+  pthread_mutex_lock(&capture->mutex);
+  capture->requestData=data;
+  capture->requestSize=size;
+  capture->requestOffset=offset;
+  capture->requested=true;
+  capture->done=false;
+  pthread_cond_broadcast(&capture->cond);
+  pthread_mutex_unlock(&capture->mutex);
+  return true;
+}
+
+// Returns 1 if the write completed successfully, 0 if it is still pending, -1 on error
+static int captureWait(struct SharedImageCapture *capture, uint32_t timeoutMs)
+{
+  int ret=0;
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec+=timeoutMs/1000;
+  deadline.tv_nsec+=(long)(timeoutMs%1000)*1000000L;
+  if(deadline.tv_nsec>=1000000000L)
+  {
+    deadline.tv_sec++;
+    deadline.tv_nsec-=1000000000L;
+  }
+  pthread_mutex_lock(&capture->mutex);
+  while(!capture->done && pthread_cond_timedwait(&capture->cond, &capture->mutex, &deadline)==0)
+  {
+  }
+  if(capture->done)
+  {
+    capture->done=false;
+    ret=capture->result?1:-1;
+  }
+  pthread_mutex_unlock(&capture->mutex);
+  return ret;
+}
+
+static void captureClose(struct SharedImageCapture *capture)
+{
+  if(capture->threadStarted)
+  {
+    pthread_mutex_lock(&capture->mutex);
+    capture->quit=true;
+    pthread_cond_broadcast(&capture->cond);
+    pthread_mutex_unlock(&capture->mutex);
+    pthread_join(capture->thread, NULL);
+    capture->threadStarted=false;
+  }
+  if(capture->fd>=0)
+    close(capture->fd);
+  capture->fd=-1;
+  pthread_cond_destroy(&capture->cond);
+  pthread_mutex_destroy(&capture->mutex);
+}
+#endif
+
+bool sharedImageCaptureCreate(const char *utf8FileName, uint32_t maxFrames, struct SharedImage *image, struct SharedImageCapture **capture)
+{
+  bool ret=false;
+  if(capture)
+  {
+    struct SharedImageCapture *captureRet=(struct SharedImageCapture *)calloc(1, sizeof(struct SharedImageCapture));
+    uint64_t indexOffset=captureAlign(sizeof(SharedImageRecordHeader));
+    uint64_t dataOffset=captureAlign(indexOffset+(uint64_t)maxFrames*sizeof(SharedImageRecordEntry));
+    *capture=captureRet;
+    if(!captureRet)
+    {
+    }
+    else if(!utf8FileName || !maxFrames || !image)
+      SET_ERROR(captureRet, "Invalid parameters");
+    else if(!(captureRet->headerBuffer=(uint8_t *)captureAlloc(dataOffset)))
+      SET_ERROR(captureRet, "Out of memory");
+    else
+    {
+      captureRet->image=image;
+      captureRet->header=(SharedImageRecordHeader *)captureRet->headerBuffer;
+      captureRet->index=(SharedImageRecordEntry *)(captureRet->headerBuffer+indexOffset);
+      captureRet->header->magic=SHAREDIMAGERECORD_MAGIC;
+      captureRet->header->version=SHAREDIMAGERECORD_VERSION;
+      captureRet->header->headerSize=sizeof(SharedImageRecordHeader);
+      captureRet->header->entrySize=sizeof(SharedImageRecordEntry);
+      captureRet->header->maxFrames=maxFrames;
+      captureRet->header->indexOffset=indexOffset;
+      captureRet->header->dataOffset=dataOffset;
+      captureRet->nextOffset=dataOffset;
+      ret=captureOpen(captureRet, utf8FileName);
+      captureRet->failed=!ret;
+    }
+  }
+  return ret;
+}
+
+bool sharedImageCaptureProcess(struct SharedImageCapture *capture, uint32_t timeoutMs)
+{
+  bool ret=false;
+  if(!capture)
+  {
+  }
+  else if(capture->failed)
+    SET_ERROR(capture, "Capture not valid");
+  else
+  {
+    bool waited=false;
+    ret=true;
+    CLEAR_ERROR(capture);
+    if(capture->pending)
+    {
+      int result=captureWait(capture, timeoutMs);
+      waited=true;
+      if(result<0)
+      {
+        SET_ERROR(capture, "Error writing file");
+        capture->failed=true;
+        ret=false;
+      }
+      else if(result>0)
+      {
+        capture->pending=false;
+        capture->header->numFrames++;
+      }
+    }
+    if(ret && !capture->pending && capture->header->numFrames<capture->header->maxFrames)
+    {
+      void *data;
+      const SharedImageSetting *setting;
+      // Receiving releases the page of the previous frame, whose write is complete
+      if(sharedImageReceive(capture->image, &data, &setting))
+      {
+        if(sharedImageFrameBytes(setting)>UINT32_MAX) // Index entries store 32 bit sizes, the frame is skipped
+        {
+          SET_ERROR(capture, "Frame too large to record");
+          ret=false;
+        }
+        else
+        {
+          const SharedImageFrameInfo *info=sharedImageFrameInfo(capture->image);
+          SharedImageRecordEntry *entry=&capture->index[capture->header->numFrames];
+          uint64_t size;
+          const void *source=data;
+          memset(entry, 0, sizeof(*entry));
+          entry->offset=capture->nextOffset;
+          entry->sequence=info?info->sequence:capture->header->numFrames;
+          entry->timestampUs=info?info->timestampUs:sharedImageTimestampUs();
+          entry->size=(uint32_t)sharedImageFrameBytes(setting);
+          entry->setting=*setting;
+          size=captureAlign(entry->size); // Direct I/O writes whole blocks, the tail comes from the page padding
+          if(((uintptr_t)data)%SHAREDIMAGERECORD_ALIGN || size>sharedImagePageSize(capture->image))
+          {
+            if(capture->bounceSize<size)
+            {
+              captureFree(capture->bounce);
+              capture->bounce=(uint8_t *)captureAlloc(size);
+              capture->bounceSize=capture->bounce?size:0;
+            }
+            if(capture->bounce)
+            {
+              memcpy(capture->bounce, data, entry->size);
+              source=capture->bounce;
+            }
+            else
+              source=NULL;
+          }
+          if(!source || !captureSubmit(capture, source, size, entry->offset))
+          {
+            SET_ERROR(capture, source?"Error writing file":"Out of memory");
+            capture->failed=true;
+            ret=false;
+          }
+          else
+          {
+            capture->pending=true;
+            capture->nextOffset+=size;
+          }
+        }
+      }
+      else if(!waited && timeoutMs)
+        sharedImageWaitNotify(capture->image, timeoutMs);
+    }
+  }
+  return ret;
+}
+
+uint32_t sharedImageCaptureNumFrames(struct SharedImageCapture *capture)
+{
+  return (capture && capture->header)?capture->header->numFrames:0;
+}
+
+bool sharedImageCaptureDestroy(struct SharedImageCapture *capture)
+{
+  bool ret=false;
+  if(capture)
+  {
+    ret=!capture->failed && capture->header;
+    if(capture->pending)
+    {
+      int result;
+      while((result=captureWait(capture, 1000))==0)
+      {
+      }
+      if(result>0)
+        capture->header->numFrames++;
+      else
+        ret=false;
+    }
+    if(ret)
+      ret=captureSubmit(capture, capture->headerBuffer, capture->header->dataOffset, 0);
+    if(ret)
+    {
+      int result;
+      while((result=captureWait(capture, 1000))==0)
+      {
+      }
+      ret=(result>0);
+    }
+    if(capture->header)
+      captureClose(capture);
+    captureFree(capture->headerBuffer);
+    captureFree(capture->bounce);
+    free(capture);
+  }
+  return ret;
+}
+
+const char *sharedImageCaptureGetError(struct SharedImageCapture *capture)
+{
+  capture->message[sizeof(capture->message)-1]='\0';
+  return capture->message;
+}
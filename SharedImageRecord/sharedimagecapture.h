@@ -0,0 +1,82 @@
+/*
+ * This file is part of SharedImageIPC.
+ *
+ * (c) Marzocchi Alessandro
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+/**
+ * @file
+ * @brief Asynchronous direct I/O capture of shared images
+ *
+ * Writes the frames received from a shared image to a recording (see sharedimagerecord.h) without copying them:
+ * each received page is held while an asynchronous unbuffered write takes the data straight from the shared page,
+ * and it is released to the generator only after the write completed.
+ *
+ * Writes use overlapped I/O with FILE_FLAG_NO_BUFFERING on Windows and a writer thread using pwrite on an O_DIRECT file elsewhere.
+ * Direct I/O needs page data aligned to SHAREDIMAGE_PAGE_ALIGN: if a shared image does not satisfy it (e.g. it was created
+ * by an older version of the library) frames are copied in an aligned bounce buffer.
+ * If the file system does not support direct I/O normal buffered writes are used.
+ *
+ * The header and the index are written when the capture is destroyed, so the file is a valid recording only after that.
+ */
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "sharedimagerecord.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** @struct SharedImageCapture
+ *  @brief Opaque pointer representing a running capture
+ */
+struct SharedImageCapture;
+
+/**
+ * @brief Creates a capture
+ *
+ * Note that even on error an object may be returned and it can be only checked for error
+ * @param utf8FileName Name of file to be created (overwritten if existing)
+ * @param maxFrames Maximum number of frames that will be captured
+ * @param image Shared image object (consumer) to capture, used only by sharedImageCaptureProcess
+ * @param capture Pointer that will receive a pointer to the created object
+ * @return True on success
+ */
+bool sharedImageCaptureCreate(const char *utf8FileName, uint32_t maxFrames, struct SharedImage *image, struct SharedImageCapture **capture);
+
+/**
+ * @brief Makes progress on the capture
+ *
+ * Completes the pending write (releasing its page) and starts the write of the next received frame.
+ * Waits at most timeoutMs if no progress can be made.
+ * @param capture Capture
+ * @param timeoutMs Maximum time to wait, in milliseconds
+ * @return False on write error, or if the received frame was skipped being larger than 4 GiB
+ */
+bool sharedImageCaptureProcess(struct SharedImageCapture *capture, uint32_t timeoutMs);
+
+/**
+ * @brief Returns the number of frames completely written
+ */
+uint32_t sharedImageCaptureNumFrames(struct SharedImageCapture *capture);
+
+/**
+ * @brief Waits for pending writes, writes header and index and destroys the object
+ * @param capture The object to destroy
+ * @return True if the recording was correctly completed
+ */
+bool sharedImageCaptureDestroy(struct SharedImageCapture *capture);
+
+/**
+ * @brief Returns current error message
+ */
+const char *sharedImageCaptureGetError(struct SharedImageCapture *capture);
+
+#ifdef __cplusplus
+}
+#endif
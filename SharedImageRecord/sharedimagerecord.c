@@ -0,0 +1,420 @@
+/*
+ * This file is part of SharedImageIPC.
+ *
+ * (c) Marzocchi Alessandro
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#include "sharedimagerecord.h"
+#include "sharedimageconvert.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(_WIN32)
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+#endif
+
+#define CLEAR_ERROR(object) object->message[0]='\0'
+#define SET_ERROR(object, ...) snprintf(object->message, sizeof(object->message), __VA_ARGS__)
+
+struct SharedImageRecorder
+{
+  char message[128];
+  FILE *file;
+  SharedImageRecordHeader header;
+  uint64_t nextOffset;
+  bool failed;
+};
+
+struct SharedImagePlayer
+{
+  char message[128];
+  const uint8_t *data;
+  uint64_t size;
+  const SharedImageRecordHeader *header;
+  const SharedImageRecordEntry *index;
+#if defined(_WIN32)
+  HANDLE file;
+  HANDLE mapping;
+#endif
+};
+
+static uint64_t recordAlign(uint64_t value)
+{
+  return (value+SHAREDIMAGERECORD_ALIGN-1)/SHAREDIMAGERECORD_ALIGN*SHAREDIMAGERECORD_ALIGN;
+}
+
+#if defined(_WIN32)
+static wchar_t *recordWideName(const char *utf8FileName)
+{
+  wchar_t *ret=NULL;
+  int nchars=MultiByteToWideChar(CP_UTF8, 0, utf8FileName, -1, NULL, 0);
+  if(nchars>0 && (ret=(wchar_t *)malloc(sizeof(wchar_t)*nchars))!=NULL && MultiByteToWideChar(CP_UTF8, 0, utf8FileName, -1, ret, nchars)!=nchars)
+  {
+    free(ret);
+    ret=NULL;
+  }
+  return ret;
+}
+#endif
+
+static FILE *recordOpenFile(const char *utf8FileName)
+{
+  FILE *ret=NULL;
+#if defined(_WIN32)
+  wchar_t *name=recordWideName(utf8FileName);
+  if(name)
+  {
+    ret=_wfopen(name, L"w+b");
+    free(name);
+  }
+#else
+  ret=fopen(utf8FileName, "w+b");
+#endif
+  return ret;
+}
+
+static bool recordWriteAt(FILE *file, uint64_t offset, const void *data, size_t size)
+{
+#if defined(_WIN32)
+  bool ret=(_fseeki64(file, (__int64)offset, SEEK_SET)==0);
+#else
+  bool ret=(fseeko(file, (off_t)offset, SEEK_SET)==0);
+#endif
+  return ret && fwrite(data, 1, size, file)==size;
+}
+
+bool sharedImageRecorderCreate(const char *utf8FileName, uint32_t maxFrames, struct SharedImageRecorder **recorder)
+{
+  bool ret=false;
+  if(recorder)
+  {
+    struct SharedImageRecorder *recorderRet=(struct SharedImageRecorder *)calloc(1, sizeof(struct SharedImageRecorder));
+    *recorder=recorderRet;
+    if(!recorderRet)
+    {
+    }
+    else if(!utf8FileName || !maxFrames)
+      SET_ERROR(recorderRet, "Invalid parameters");
+    else if(!(recorderRet->file=recordOpenFile(utf8FileName)))
+      SET_ERROR(recorderRet, "Cannot create file");
+    else
+    {
+      SharedImageRecordHeader *header=&recorderRet->header;
+      header->magic=SHAREDIMAGERECORD_MAGIC;
+      header->version=SHAREDIMAGERECORD_VERSION;
+      header->headerSize=sizeof(SharedImageRecordHeader);
+      header->entrySize=sizeof(SharedImageRecordEntry);
+      header->maxFrames=maxFrames;
+      header->numFrames=0;
+      header->indexOffset=recordAlign(sizeof(SharedImageRecordHeader));
+      header->dataOffset=recordAlign(header->indexOffset+(uint64_t)maxFrames*sizeof(SharedImageRecordEntry));
+      recorderRet->nextOffset=header->dataOffset;
+      // The index is written empty, so the file has its final layout from the start
+      SharedImageRecordEntry empty;
+      memset(&empty, 0, sizeof(empty));
+      ret=recordWriteAt(recorderRet->file, 0, header, sizeof(*header));
+      for(uint32_t i=0;ret && i<maxFrames;i++)
+        ret=(fwrite(&empty, 1, sizeof(empty), recorderRet->file)==sizeof(empty));
+      if(!ret)
+        SET_ERROR(recorderRet, "Error writing file header");
+    }
+  }
+  return ret;
+}
+
+bool sharedImageRecorderWrite(struct SharedImageRecorder *recorder, const void *data, const SharedImageSetting *setting, const SharedImageFrameInfo *info)
+{
+  bool ret=false;
+  if(!recorder)
+  {
+  }
+  else if(!data || !setting)
+    SET_ERROR(recorder, "Invalid parameters");
+  else if(!recorder->file || recorder->failed)
+    SET_ERROR(recorder, "Recording not valid");
+  else if(recorder->header.numFrames>=recorder->header.maxFrames)
+    SET_ERROR(recorder, "Index full");
+  else if(!sharedImageFrameBytes(setting))
+    SET_ERROR(recorder, "Invalid frame setting");
+  else if(sharedImageFrameBytes(setting)>UINT32_MAX) // Index entries store 32 bit sizes
+    SET_ERROR(recorder, "Frame too large to record");
+  else
+  {
+    SharedImageRecordEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.offset=recorder->nextOffset;
+    entry.sequence=info?info->sequence:recorder->header.numFrames;
+    entry.timestampUs=info?info->timestampUs:sharedImageTimestampUs();
+    entry.size=(uint32_t)sharedImageFrameBytes(setting);
+    entry.setting=*setting;
+    if(!recordWriteAt(recorder->file, entry.offset, data, entry.size) ||
+       !recordWriteAt(recorder->file, recorder->header.indexOffset+(uint64_t)recorder->header.numFrames*sizeof(entry), &entry, sizeof(entry)))
+    {
+      recorder->failed=true;
+      SET_ERROR(recorder, "Error writing file");
+    }
+    else
+    {
+      recorder->header.numFrames++;
+      recorder->nextOffset=recordAlign(entry.offset+entry.size);
+      // Seeks flushed payload and entry already, the header goes last so the file is valid after each frame
+      if(!recordWriteAt(recorder->file, 0, &recorder->header, sizeof(recorder->header)) || fflush(recorder->file)!=0)
+      {
+        recorder->failed=true;
+        SET_ERROR(recorder, "Error writing file");
+      }
+      else
+      {
+        CLEAR_ERROR(recorder);
+        ret=true;
+      }
+    }
+  }
+  return ret;
+}
+
+bool sharedImageRecorderConsume(struct SharedImageRecorder *recorder, struct SharedImage *image)
+{
+  bool ret=false;
+  void *data;
+  const SharedImageSetting *setting;
+  if(recorder && image && sharedImageReceive(image, &data, &setting))
+    ret=sharedImageRecorderWrite(recorder, data, setting, sharedImageFrameInfo(image));
+  return ret;
+}
+
+uint32_t sharedImageRecorderNumFrames(struct SharedImageRecorder *recorder)
+{
+  return recorder?recorder->header.numFrames:0;
+}
+
+bool sharedImageRecorderDestroy(struct SharedImageRecorder *recorder)
+{
+  bool ret=false;
+  if(recorder)
+  {
+    ret=!recorder->failed;
+    if(recorder->file && fclose(recorder->file)!=0)
+      ret=false;
+    free(recorder);
+  }
+  return ret;
+}
+
+const char *sharedImageRecorderGetError(struct SharedImageRecorder *recorder)
+{
+  recorder->message[sizeof(recorder->message)-1]='\0';
+  return recorder->message;
+}
+
+static bool recordMap(struct SharedImagePlayer *player, const char *utf8FileName)
+{
+  bool ret=false;
+#if defined(_WIN32)
+  LARGE_INTEGER size;
+  wchar_t *name=recordWideName(utf8FileName);
+  player->file=name?CreateFileW(name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL):INVALID_HANDLE_VALUE;
+  free(name);
+  if(player->file==INVALID_HANDLE_VALUE)
+    SET_ERROR(player, "Cannot open file");
+  else if(!GetFileSizeEx(player->file, &size) || size.QuadPart<(LONGLONG)sizeof(SharedImageRecordHeader))
+    SET_ERROR(player, "File too small");
+  else if((player->mapping=CreateFileMapping(player->file, NULL, PAGE_READONLY, 0, 0, NULL))==NULL)
+    SET_ERROR(player, "Error in CreateFileMapping");
+  else if((player->data=(const uint8_t *)MapViewOfFile(player->mapping, FILE_MAP_READ, 0, 0, 0))==NULL)
+    SET_ERROR(player, "Error in MapViewOfFile");
+  else
+  {
+    player->size=(uint64_t)size.QuadPart;
+    ret=true;
+  }
+#else
+  struct stat st;
+  int fd=open(utf8FileName, O_RDONLY|O_CLOEXEC);
+  void *data;
+  if(fd<0)
+    SET_ERROR(player, "Cannot open file");
+  else if(fstat(fd, &st)<0 || st.st_size<(off_t)sizeof(SharedImageRecordHeader))
+    SET_ERROR(player, "File too small");
+  else if((data=mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0))==MAP_FAILED)
+    SET_ERROR(player, "Error in mmap");
+  else
+  {
+    player->data=(const uint8_t *)data;
+    player->size=(uint64_t)st.st_size;
+    ret=true;
+  }
+  if(fd>=0)
+    close(fd); // The mapping stays valid
+#endif
+  return ret;
+}
+
+bool sharedImagePlayerOpen(const char *utf8FileName, struct SharedImagePlayer **player)
+{
+  bool ret=false;
+  if(player)
+  {
+    struct SharedImagePlayer *playerRet=(struct SharedImagePlayer *)calloc(1, sizeof(struct SharedImagePlayer));
+    *player=playerRet;
+    if(!playerRet)
+    {
+    }
+    else if(!utf8FileName)
+      SET_ERROR(playerRet, "Invalid parameters");
+    else
+    {
+#if defined(_WIN32)
+      playerRet->file=INVALID_HANDLE_VALUE;
+#endif
+      if(recordMap(playerRet, utf8FileName))
+      {
+        const SharedImageRecordHeader *header=(const SharedImageRecordHeader *)playerRet->data;
+        if(header->magic!=SHAREDIMAGERECORD_MAGIC || header->version!=SHAREDIMAGERECORD_VERSION ||
+           header->headerSize!=sizeof(SharedImageRecordHeader) || header->entrySize!=sizeof(SharedImageRecordEntry))
+          SET_ERROR(playerRet, "Incompatible recording");
+        else if(header->numFrames>header->maxFrames || header->indexOffset+(uint64_t)header->maxFrames*header->entrySize>playerRet->size)
+          SET_ERROR(playerRet, "Corrupted recording index");
+        else
+        {
+          playerRet->header=header;
+          playerRet->index=(const SharedImageRecordEntry *)(playerRet->data+header->indexOffset);
+          ret=true;
+          // Validated once here, so frame access needs no check on payload bounds
+          for(uint32_t i=0;ret && i<header->numFrames;i++)
+          {
+            if(playerRet->index[i].offset+playerRet->index[i].size>playerRet->size)
+            {
+              SET_ERROR(playerRet, "Truncated recording");
+              ret=false;
+            }
+          }
+        }
+      }
+    }
+  }
+  return ret;
+}
+
+uint32_t sharedImagePlayerNumFrames(struct SharedImagePlayer *player)
+{
+  return (player && player->header)?player->header->numFrames:0;
+}
+
+bool sharedImagePlayerFrame(struct SharedImagePlayer *player, uint32_t index, const void **data, const SharedImageRecordEntry **entry)
+{
+  bool ret=false;
+  if(index<sharedImagePlayerNumFrames(player))
+  {
+    if(data)
+      *data=player->data+player->index[index].offset;
+    if(entry)
+      *entry=&player->index[index];
+    ret=true;
+  }
+  return ret;
+}
+
+typedef enum
+{
+  RecordPublishSent=0,
+  RecordPublishFull, // No free buffer, retry later
+  RecordPublishError
+} RecordPublishResult;
+
+static RecordPublishResult recordPublish(struct SharedImagePlayer *player, uint32_t index, struct SharedImage *image)
+{
+  RecordPublishResult ret=RecordPublishError;
+  void *buffer;
+  uint32_t availableBytes;
+  if(!image)
+    SET_ERROR(player, "Invalid parameters");
+  else if(index>=sharedImagePlayerNumFrames(player))
+    SET_ERROR(player, "Invalid frame index");
+  else if(sharedImageOutBufferBytes(image, &buffer, &availableBytes))
+  {
+    const SharedImageRecordEntry *entry=&player->index[index];
+    if(availableBytes<entry->size)
+      SET_ERROR(player, "Frame does not fit in shared image");
+    else
+    {
+      sharedImageCopy(buffer, player->data+entry->offset, (size_t)entry->size);
+      if(sharedImageSend(image, &entry->setting))
+      {
+        CLEAR_ERROR(player);
+        ret=RecordPublishSent;
+      }
+      else
+        SET_ERROR(player, "Send failed: %s", sharedImageGetError(image));
+    }
+  }
+  else if(sharedImageGetError(image)[0]) // Shared memory not valid, waiting would not help
+    SET_ERROR(player, "Shared image not valid: %s", sharedImageGetError(image));
+  else
+  {
+    CLEAR_ERROR(player);
+    ret=RecordPublishFull;
+  }
+  return ret;
+}
+
+bool sharedImagePlayerPublish(struct SharedImagePlayer *player, uint32_t index, struct SharedImage *image)
+{
+  return player && recordPublish(player, index, image)==RecordPublishSent;
+}
+
+bool sharedImagePlayerReplay(struct SharedImagePlayer *player, struct SharedImage *image, bool realTime)
+{
+  bool ret=(player && image);
+  uint64_t start=sharedImageTimestampUs();
+  for(uint32_t i=0;ret && i<sharedImagePlayerNumFrames(player);i++)
+  {
+    if(realTime)
+    {
+      uint64_t target=start+(player->index[i].timestampUs-player->index[0].timestampUs);
+      for(uint64_t now=sharedImageTimestampUs();now<target;now=sharedImageTimestampUs())
+        sharedImageWaitNotify(image, (uint32_t)((target-now+999)/1000));
+    }
+    RecordPublishResult result=recordPublish(player, i, image);
+    for(;result==RecordPublishFull;result=recordPublish(player, i, image)) // Only a missing free buffer is worth waiting for
+      sharedImageWaitNotify(image, 100);
+    ret=(result==RecordPublishSent);
+  }
+  return ret;
+}
+
+bool sharedImagePlayerDestroy(struct SharedImagePlayer *player)
+{
+  bool ret=false;
+  if(player)
+  {
+#if defined(_WIN32)
+    if(player->data)
+      UnmapViewOfFile(player->data);
+    if(player->mapping)
+      CloseHandle(player->mapping);
+    if(player->file!=INVALID_HANDLE_VALUE)
+      CloseHandle(player->file);
+#else
+    if(player->data)
+      munmap((void *)player->data, (size_t)player->size);
+#endif
+    free(player);
+    ret=true;
+  }
+  return ret;
+}
+
+const char *sharedImagePlayerGetError(struct SharedImagePlayer *player)
+{
+  player->message[sizeof(player->message)-1]='\0';
+  return player->message;
+}
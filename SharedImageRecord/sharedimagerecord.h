@@ -0,0 +1,180 @@
+/*
+ * This file is part of SharedImageIPC.
+ *
+ * (c) Marzocchi Alessandro
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+/**
+ * @file
+ * @brief Recording and replay of shared image streams
+ *
+ * A recording is a single file with this layout (all values in host byte order):
+ * - a SharedImageRecordHeader at offset 0
+ * - the index: SharedImageRecordHeader::maxFrames SharedImageRecordEntry structures at SharedImageRecordHeader::indexOffset
+ * - the raw frame payloads, each one starting at a multiple of SHAREDIMAGERECORD_ALIGN
+ *
+ * The index is preallocated when recording starts, so a file can be written while consuming a channel and it is
+ * valid (up to SharedImageRecordHeader::numFrames) at any time.
+ * For replay the file is memory-mapped: frames are located through the index with no parsing.
+ */
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "sharedimage.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define SHAREDIMAGERECORD_MAGIC 0x52494853
+#define SHAREDIMAGERECORD_VERSION 0x101
+/// @brief Alignment of index and payloads inside the file (suitable for direct I/O)
+#define SHAREDIMAGERECORD_ALIGN 4096
+
+/// @brief Header at the start of a recording
+typedef struct
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t headerSize;  ///< sizeof(SharedImageRecordHeader)
+  uint32_t entrySize;   ///< sizeof(SharedImageRecordEntry)
+  uint32_t maxFrames;   ///< Capacity of the index
+  uint32_t numFrames;   ///< Number of valid entries in the index
+  uint64_t indexOffset; ///< Offset of the index from start of file
+  uint64_t dataOffset;  ///< Offset of the first payload from start of file
+} SharedImageRecordHeader;
+
+/// @brief Index entry of a recorded frame
+typedef struct
+{
+  uint64_t offset;      ///< Offset of payload from start of file
+  uint64_t sequence;    ///< Sequence number of the frame
+  uint64_t timestampUs; ///< Timestamp of the frame
+  uint32_t size;        ///< Size of payload
+  uint32_t reserved;
+  SharedImageSetting setting; ///< Layout of the payload
+} SharedImageRecordEntry;
+
+/** @struct SharedImageRecorder
+ *  @brief Opaque pointer representing a recording being written
+ */
+struct SharedImageRecorder;
+
+/** @struct SharedImagePlayer
+ *  @brief Opaque pointer representing a memory-mapped recording
+ */
+struct SharedImagePlayer;
+
+/**
+ * @brief Creates a new recording
+ *
+ * Note that even on error an object may be returned and it can be only checked for error
+ * @param utf8FileName Name of file to be created (overwritten if existing)
+ * @param maxFrames Maximum number of frames that will be recorded
+ * @param recorder Pointer that will receive a pointer to the created object
+ * @return True on success
+ */
+bool sharedImageRecorderCreate(const char *utf8FileName, uint32_t maxFrames, struct SharedImageRecorder **recorder);
+
+/**
+ * @brief Appends a frame to the recording
+ * @param recorder Recording
+ * @param data Frame data, sharedImageFrameBytes(setting) bytes
+ * @param setting Layout of frame data
+ * @param info Sequence and timestamp of the frame
+ * @return True on success, false on error, if the index is full or if the frame is larger than 4 GiB
+ */
+bool sharedImageRecorderWrite(struct SharedImageRecorder *recorder, const void *data, const SharedImageSetting *setting, const SharedImageFrameInfo *info);
+
+/**
+ * @brief Receives a frame from a shared image and appends it to the recording
+ * @param recorder Recording
+ * @param image Shared image object (consumer)
+ * @return True if a frame was received and recorded
+ */
+bool sharedImageRecorderConsume(struct SharedImageRecorder *recorder, struct SharedImage *image);
+
+/**
+ * @brief Returns the number of frames recorded
+ */
+uint32_t sharedImageRecorderNumFrames(struct SharedImageRecorder *recorder);
+
+/**
+ * @brief Closes the recording file and destroys the object
+ * @param recorder The object to destroy
+ * @return True if the file was correctly completed
+ */
+bool sharedImageRecorderDestroy(struct SharedImageRecorder *recorder);
+
+/**
+ * @brief Returns current error message
+ */
+const char *sharedImageRecorderGetError(struct SharedImageRecorder *recorder);
+
+/**
+ * @brief Opens a recording for replay, mapping it in memory
+ *
+ * Note that even on error an object may be returned and it can be only checked for error
+ * @param utf8FileName Name of the recording
+ * @param player Pointer that will receive a pointer to the created object
+ * @return True on success
+ */
+bool sharedImagePlayerOpen(const char *utf8FileName, struct SharedImagePlayer **player);
+
+/**
+ * @brief Returns the number of frames of the recording
+ */
+uint32_t sharedImagePlayerNumFrames(struct SharedImagePlayer *player);
+
+/**
+ * @brief Returns a frame of the recording
+ *
+ * Returned pointers point inside the mapped file and are valid until the player is destroyed.
+ * @param player Recording
+ * @param index Index of the frame
+ * @param data Will be filled with a pointer to frame payload
+ * @param entry Will be filled with a pointer to the index entry of the frame
+ * @return True on success
+ */
+bool sharedImagePlayerFrame(struct SharedImagePlayer *player, uint32_t index, const void **data, const SharedImageRecordEntry **entry);
+
+/**
+ * @brief Publishes a frame of the recording in a shared image
+ * @param player Recording
+ * @param index Index of the frame
+ * @param image Shared image object (generator)
+ * @return True if the frame was sent. On false, the error message is empty if there was just no free buffer
+ */
+bool sharedImagePlayerPublish(struct SharedImagePlayer *player, uint32_t index, struct SharedImage *image);
+
+/**
+ * @brief Publishes all the frames of the recording in a shared image
+ *
+ * With realTime frames are sent at the original timing, waiting for a free buffer when needed.
+ * Otherwise each frame is sent as soon as a free buffer is available.
+ * @param player Recording
+ * @param image Shared image object (generator)
+ * @param realTime True to keep the original timing
+ * @return True if all frames were sent
+ */
+bool sharedImagePlayerReplay(struct SharedImagePlayer *player, struct SharedImage *image, bool realTime);
+
+/**
+ * @brief Unmaps the recording and destroys the object
+ * @param player The object to destroy
+ * @return True on success
+ */
+bool sharedImagePlayerDestroy(struct SharedImagePlayer *player);
+
+/**
+ * @brief Returns current error message
+ */
+const char *sharedImagePlayerGetError(struct SharedImagePlayer *player);
+
+#ifdef __cplusplus
+}
+#endif
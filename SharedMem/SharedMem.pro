@@ -5,11 +5,17 @@ CONFIG += staticlib
 
 SOURCES += \
     arch/sharedmemwin.c \
-    sharedmem.c
+    arch/sharedmemlinux.c \
+    sharedmem.c \
+    sharedmemtrace.c
 
 HEADERS += \
     arch/sharedmemarch.h \
+    arch/sharedmematomic.h \
     internal/sharedmeminternal.h \
-    sharedmem.h
+    sharedmem.h \
+    sharedmemtrace.h
 
 win32:DEFINES += SHAREDMEM_WIN32
+linux:DEFINES += SHAREDMEM_LINUX
+trace:DEFINES += SHAREDMEM_TRACE
@@ -16,4 +16,15 @@
     HANDLE eventFromOther;
     HANDLE eventToOther;
   } SharedMemoryArch;
+#elif defined(SHAREDMEM_LINUX)
+  #include <stdint.h>
+  #include <stdbool.h>
+  typedef struct
+  {
+    bool initialized; // False while descriptors are not yet set (zero filled)
+    int fdShared;
+    int eventFromOther;
+    int eventToOther;
+    uint32_t mappedSize;
+  } SharedMemoryArch;
 #endif
@@ -0,0 +1,127 @@
+/*
+ * This file is part of SharedImageIPC.
+ *
+ * (c) Marzocchi Alessandro
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+/*
+ * Atomic primitives used by the lock-free parts of the library.
+ * Loads have acquire semantic, stores have release semantic, read-modify-write operations are full barriers.
+ * sharedMemAtomicFence is a full barrier; the release and acquire fences only order stores after older accesses
+ * and loads before newer accesses, and cost no instruction on x86.
+ * Values must be naturally aligned.
+ */
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+#if defined(_MSC_VER)
+  #include <intrin.h>
+  // Note: MSVC gives volatile accesses acquire/release semantic (/volatile:ms, default on x86/x64)
+  static __inline uint32_t sharedMemAtomicLoad32(volatile uint32_t *value)
+  {
+    uint32_t ret=*value;
+    _ReadWriteBarrier();
+    return ret;
+  }
+  static __inline void sharedMemAtomicStore32(volatile uint32_t *value, uint32_t newValue)
+  {
+    _ReadWriteBarrier();
+    *value=newValue;
+  }
+  static __inline uint32_t sharedMemAtomicAdd32(volatile uint32_t *value, uint32_t add)
+  {
+    return (uint32_t)_InterlockedExchangeAdd((volatile long *)value, (long)add);
+  }
+  static __inline uint32_t sharedMemAtomicExchange32(volatile uint32_t *value, uint32_t newValue)
+  {
+    return (uint32_t)_InterlockedExchange((volatile long *)value, (long)newValue);
+  }
+  static __inline bool sharedMemAtomicCompareExchange32(volatile uint32_t *value, uint32_t expected, uint32_t newValue)
+  {
+    return (uint32_t)_InterlockedCompareExchange((volatile long *)value, (long)newValue, (long)expected)==expected;
+  }
+  static __inline uint64_t sharedMemAtomicLoad64(volatile uint64_t *value)
+  {
+#if defined(_M_X64)
+    uint64_t ret=*value;
+    _ReadWriteBarrier();
+    return ret;
+#else
+    return (uint64_t)_InterlockedCompareExchange64((volatile __int64 *)value, 0, 0);
+#endif
+  }
+  static __inline void sharedMemAtomicStore64(volatile uint64_t *value, uint64_t newValue)
+  {
+#if defined(_M_X64)
+    _ReadWriteBarrier();
+    *value=newValue;
+#else
+    _InterlockedExchange64((volatile __int64 *)value, (__int64)newValue);
+#endif
+  }
+  static __inline uint64_t sharedMemAtomicAdd64(volatile uint64_t *value, uint64_t add)
+  {
+    return (uint64_t)_InterlockedExchangeAdd64((volatile __int64 *)value, (__int64)add);
+  }
+  static __inline void sharedMemAtomicFence(void)
+  {
+    _mm_mfence();
+  }
+  static __inline void sharedMemAtomicFenceRelease(void)
+  {
+    _ReadWriteBarrier(); // x86 does not reorder stores with older loads and stores
+  }
+  static __inline void sharedMemAtomicFenceAcquire(void)
+  {
+    _ReadWriteBarrier(); // x86 does not reorder loads with older loads
+  }
+#else
+  static inline uint32_t sharedMemAtomicLoad32(volatile uint32_t *value)
+  {
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+  }
+  static inline void sharedMemAtomicStore32(volatile uint32_t *value, uint32_t newValue)
+  {
+    __atomic_store_n(value, newValue, __ATOMIC_RELEASE);
+  }
+  static inline uint32_t sharedMemAtomicAdd32(volatile uint32_t *value, uint32_t add)
+  {
+    return __atomic_fetch_add(value, add, __ATOMIC_SEQ_CST);
+  }
+  static inline uint32_t sharedMemAtomicExchange32(volatile uint32_t *value, uint32_t newValue)
+  {
+    return __atomic_exchange_n(value, newValue, __ATOMIC_SEQ_CST);
+  }
+  static inline bool sharedMemAtomicCompareExchange32(volatile uint32_t *value, uint32_t expected, uint32_t newValue)
+  {
+    return __atomic_compare_exchange_n(value, &expected, newValue, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  }
+  static inline uint64_t sharedMemAtomicLoad64(volatile uint64_t *value)
+  {
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+  }
+  static inline void sharedMemAtomicStore64(volatile uint64_t *value, uint64_t newValue)
+  {
+    __atomic_store_n(value, newValue, __ATOMIC_RELEASE);
+  }
+  static inline uint64_t sharedMemAtomicAdd64(volatile uint64_t *value, uint64_t add)
+  {
+    return __atomic_fetch_add(value, add, __ATOMIC_SEQ_CST);
+  }
+  static inline void sharedMemAtomicFence(void)
+  {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  }
+  static inline void sharedMemAtomicFenceRelease(void)
+  {
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+  }
+  static inline void sharedMemAtomicFenceAcquire(void)
+  {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  }
+#endif
@@ -0,0 +1,269 @@
+/*
+ * This file is part of SharedImageIPC.
+ *
+ * (c) Marzocchi Alessandro
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#if defined(SHAREDMEM_LINUX)
+#ifndef _GNU_SOURCE
+  #define _GNU_SOURCE
+#endif
+#include "../internal/sharedmeminternal.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#define SHAREDMEM_SOCKET_MAGIC 0x5D3A61C2
+
+// Payload sent together with the file descriptors
+typedef struct
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t size;
+  uint32_t server; // Side of the sender
+} SharedMemSocketMessage;
+
+static void sharedMemArchReset(struct SharedMemory *shared)
+{
+  shared->arch.fdShared=shared->arch.eventFromOther=shared->arch.eventToOther=-1;
+  shared->arch.mappedSize=0;
+  shared->arch.initialized=true;
+}
+
+void sharedMemArchNotify(struct SharedMemory *shared)
+{
+  uint64_t value=1;
+  if(shared->arch.eventToOther>=0 && write(shared->arch.eventToOther, &value, sizeof(value))<0)
+  {
+    // EAGAIN means the counter is saturated, the other side has a notification pending anyway
+  }
+}
+
+bool sharedMemArchWaitNotify(const struct SharedMemory *memory, uint32_t timeoutMs)
+{
+  bool ret=false;
+  struct pollfd fd;
+  fd.fd=memory->arch.eventFromOther;
+  fd.events=POLLIN;
+  fd.revents=0;
+  if(fd.fd>=0 && poll(&fd, 1, (int)timeoutMs)>0 && (fd.revents&POLLIN))
+  {
+    uint64_t value;
+    ret=(read(fd.fd, &value, sizeof(value))==sizeof(value)); // Resets the event, as an auto-reset event would do
+  }
+  return ret;
+}
+
+bool sharedMemCloseArch(struct SharedMemory *shared)
+{
+  if(shared->arch.initialized)
+  {
+    if(shared->data && shared->arch.mappedSize)
+      munmap((void *)shared->data, shared->arch.mappedSize);
+    shared->data=NULL;
+    if(shared->arch.fdShared>=0)
+      close(shared->arch.fdShared);
+    if(shared->arch.eventFromOther>=0)
+      close(shared->arch.eventFromOther);
+    if(shared->arch.eventToOther>=0)
+      close(shared->arch.eventToOther);
+    sharedMemArchReset(shared);
+  }
+  return true;
+}
+
+bool sharedMemCreateArch(const char *utf8Name, struct SharedMemory *shared, uint32_t requestedSize, bool server)
+{
+  (void)utf8Name; (void)requestedSize; (void)server;
+  sharedMemArchReset(shared);
+  snprintf(shared->message, sizeof(shared->message), "Named shared memory not supported, use sharedMemCreateAnonymous");
+  return false;
+}
+
+bool sharedMemCreateAnonymousArch(struct SharedMemory *shared, uint32_t requestedSize, bool server)
+{
+  bool ret=false;
+  void *pBuf;
+  sharedMemArchReset(shared);
+  if((shared->arch.fdShared=memfd_create("sharedmem", MFD_CLOEXEC|MFD_ALLOW_SEALING))<0)
+    snprintf(shared->message, sizeof(shared->message), "Error in memfd_create (%d)", errno);
+  else if(ftruncate(shared->arch.fdShared, requestedSize)<0)
+    snprintf(shared->message, sizeof(shared->message), "Error in ftruncate (%d)", errno);
+  else if(fcntl(shared->arch.fdShared, F_ADD_SEALS, F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_SEAL)<0)
+    snprintf(shared->message, sizeof(shared->message), "Error sealing shared memory (%d)", errno);
+  else if((shared->arch.eventFromOther=eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK))<0 || (shared->arch.eventToOther=eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK))<0)
+    snprintf(shared->message, sizeof(shared->message), "Error in eventfd (%d)", errno);
+  else if((pBuf=mmap(NULL, requestedSize, PROT_READ|PROT_WRITE, MAP_SHARED, shared->arch.fdShared, 0))==MAP_FAILED)
+    snprintf(shared->message, sizeof(shared->message), "Error in mmap (%d)", errno);
+  else
+  {
+    // New memory is zero filled
+    shared->arch.mappedSize=requestedSize;
+    shared->data=(volatile struct SharedMemInternalHeader *)pBuf;
+    shared->needInitialize=true;
+    shared->server=server;
+    ret=true;
+  }
+  if(!ret)
+    sharedMemCloseArch(shared);
+  return ret;
+}
+
+bool sharedMemSendArch(struct SharedMemory *shared, int socketFd)
+{
+  bool ret=false;
+  SharedMemSocketMessage message;
+  int fds[3]={shared->arch.fdShared, shared->arch.eventFromOther, shared->arch.eventToOther};
+  union
+  {
+    char buffer[CMSG_SPACE(sizeof(fds))];
+    struct cmsghdr align;
+  } control;
+  struct iovec iov;
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  message.magic=SHAREDMEM_SOCKET_MAGIC;
+  message.version=SHAREDMEM_VERSION;
+  message.size=shared->arch.mappedSize;
+  message.server=shared->server;
+  iov.iov_base=&message;
+  iov.iov_len=sizeof(message);
+  memset(&msg, 0, sizeof(msg));
+  memset(&control, 0, sizeof(control));
+  msg.msg_iov=&iov;
+  msg.msg_iovlen=1;
+  msg.msg_control=control.buffer;
+  msg.msg_controllen=sizeof(control.buffer);
+  cmsg=CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level=SOL_SOCKET;
+  cmsg->cmsg_type=SCM_RIGHTS;
+  cmsg->cmsg_len=CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+  if(shared->arch.fdShared<0)
+    snprintf(shared->message, sizeof(shared->message), "Shared memory is not anonymous");
+  else if(sendmsg(socketFd, &msg, MSG_NOSIGNAL)!=(ssize_t)sizeof(message))
+    snprintf(shared->message, sizeof(shared->message), "Error in sendmsg (%d)", errno);
+  else
+    ret=true;
+  return ret;
+}
+
+bool sharedMemAttachArch(struct SharedMemory *shared, int socketFd)
+{
+  bool ret=false;
+  SharedMemSocketMessage message;
+  int fds[3]={-1, -1, -1};
+  union
+  {
+    char buffer[CMSG_SPACE(sizeof(fds))];
+    struct cmsghdr align;
+  } control;
+  struct iovec iov;
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  struct stat st;
+  ssize_t received;
+  void *pBuf;
+  sharedMemArchReset(shared);
+  iov.iov_base=&message;
+  iov.iov_len=sizeof(message);
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov=&iov;
+  msg.msg_iovlen=1;
+  msg.msg_control=control.buffer;
+  msg.msg_controllen=sizeof(control.buffer);
+  received=recvmsg(socketFd, &msg, MSG_CMSG_CLOEXEC);
+  for(cmsg=CMSG_FIRSTHDR(&msg);cmsg;cmsg=CMSG_NXTHDR(&msg, cmsg))
+  {
+    if(cmsg->cmsg_level==SOL_SOCKET && cmsg->cmsg_type==SCM_RIGHTS && cmsg->cmsg_len==CMSG_LEN(sizeof(fds)))
+      memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+  }
+  // The descriptors are ours from now on, even if the message is not valid
+  shared->arch.fdShared=fds[0];
+  shared->arch.eventFromOther=fds[2];
+  shared->arch.eventToOther=fds[1];
+  if(received!=(ssize_t)sizeof(message) || (msg.msg_flags&MSG_CTRUNC))
+    snprintf(shared->message, sizeof(shared->message), "Error in recvmsg (%d)", errno);
+  else if(fds[0]<0 || fds[1]<0 || fds[2]<0)
+    snprintf(shared->message, sizeof(shared->message), "No file descriptors received");
+  else if(message.magic!=SHAREDMEM_SOCKET_MAGIC || message.version!=SHAREDMEM_VERSION)
+    snprintf(shared->message, sizeof(shared->message), "Incompatible socket message");
+  else if(fstat(fds[0], &st)<0 || st.st_size<(off_t)message.size || message.size<sizeof(struct SharedMemInternalHeader))
+    snprintf(shared->message, sizeof(shared->message), "Received shared memory too small");
+  else if((pBuf=mmap(NULL, message.size, PROT_READ|PROT_WRITE, MAP_SHARED, fds[0], 0))==MAP_FAILED)
+    snprintf(shared->message, sizeof(shared->message), "Error in mmap (%d)", errno);
+  else
+  {
+    shared->arch.mappedSize=message.size;
+    shared->data=(volatile struct SharedMemInternalHeader *)pBuf;
+    shared->needInitialize=false;
+    shared->server=!message.server;
+    if(sharedMemCheckHeader(shared))
+    {
+      if(shared->data->layout.fullSize>message.size)
+        snprintf(shared->message, sizeof(shared->message), "Received shared memory smaller than its layout");
+      else
+        ret=true;
+    }
+  }
+  if(!ret)
+    sharedMemCloseArch(shared);
+  return ret;
+}
+
+int sharedMemNotificationFd(struct SharedMemory *memory)
+{
+  return memory->arch.eventFromOther;
+}
+
+uint64_t sharedMemArchTimeNs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ull+(uint64_t)ts.tv_nsec;
+}
+
+uint32_t sharedMemArchProcessId(void)
+{
+  return (uint32_t)getpid();
+}
+
+// Traced on every event, so the system call is made once per thread
+static __thread uint32_t sharedMemThreadId;
+static pthread_once_t sharedMemThreadIdOnce=PTHREAD_ONCE_INIT;
+
+static void sharedMemThreadIdForked(void)
+{
+  sharedMemThreadId=0; // The thread of the child has its own id
+}
+
+static void sharedMemThreadIdInit(void)
+{
+  pthread_atfork(NULL, NULL, sharedMemThreadIdForked);
+}
+
+uint32_t sharedMemArchThreadId(void)
+{
+  if(!sharedMemThreadId)
+  {
+    pthread_once(&sharedMemThreadIdOnce, sharedMemThreadIdInit);
+    sharedMemThreadId=(uint32_t)syscall(SYS_gettid);
+  }
+  return sharedMemThreadId;
+}
+
+#endif
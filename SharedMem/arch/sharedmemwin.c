@@ -256,4 +256,24 @@ void *sharedMemNotificationHandle(struct SharedMemory *memory)
   return memory->arch.eventFromOther;
 }
 
+uint64_t sharedMemArchTimeNs(void)
+{
+  static LARGE_INTEGER frequency;
+  LARGE_INTEGER counter;
+  if(!frequency.QuadPart)
+    QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  return (uint64_t)(counter.QuadPart/frequency.QuadPart)*1000000000ull+(uint64_t)(counter.QuadPart%frequency.QuadPart)*1000000000ull/(uint64_t)frequency.QuadPart;
+}
+
+uint32_t sharedMemArchProcessId(void)
+{
+  return GetCurrentProcessId();
+}
+
+uint32_t sharedMemArchThreadId(void)
+{
+  return GetCurrentThreadId();
+}
+
 #endif
@@ -44,6 +44,8 @@ struct SharedMemLayout
   uint32_t libPageHeaderOffset; // Library header offset from start of page
   uint32_t appPageHeaderOffset; // Application header offset from start of page
   uint32_t dataOffset;      // Data offset from start of page. Pages will be found at firstPageStart+wholePageSize*NPage+dataOffset
+  uint32_t firstLargePageStart; // Large pages follow the small ones, with the same offsets
+  uint32_t wholeLargePageSize;
   uint32_t fullSize; // Full size of allocated memory area
 };
 
@@ -77,4 +79,12 @@ void sharedMemArchNotify(struct SharedMemory *shared);
 bool sharedMemArchWaitNotify(const struct SharedMemory *memory, uint32_t timeoutMs);
 bool sharedMemCloseArch(struct SharedMemory *shared);
 bool sharedMemCreateArch(const char *utf8Name, struct SharedMemory *shared, uint32_t requestedSize, bool server);
+#if defined(SHAREDMEM_LINUX)
+bool sharedMemCreateAnonymousArch(struct SharedMemory *shared, uint32_t requestedSize, bool server);
+bool sharedMemSendArch(struct SharedMemory *shared, int socketFd);
+bool sharedMemAttachArch(struct SharedMemory *shared, int socketFd);
+#endif
+uint64_t sharedMemArchTimeNs(void); // Monotonic system-wide clock, in nanoseconds
+uint32_t sharedMemArchProcessId(void);
+uint32_t sharedMemArchThreadId(void);
 
@@ -11,7 +11,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include "sharedmem.h"
+#include "sharedmemtrace.h"
 #include "internal/sharedmeminternal.h"
+#include "arch/sharedmematomic.h"
 #define CLEAR_ERROR(memory) memory->message[0]='\0'
 #define SET_ERROR(memory, ...) snprintf(memory->message, sizeof(memory->message), __VA_ARGS__)
 static const uint32_t sharedDefaultAlignment=16;
@@ -93,12 +95,20 @@ static bool sharedCheckInitialized(struct SharedMemory *shared)
   return ret;
 }
 
+// Offset of a page from the start of the memory, page must be valid
+static uint32_t sharedMemPageStart(struct SharedMemory *shared, uint32_t page)
+{
+  volatile struct SharedMemLayout *layout=&shared->data->layout;
+  uint32_t numSmall=shared->data->info.numPages-shared->data->info.numLargePages;
+  return (page<numSmall)?layout->firstPageStart+layout->wholePageSize*page:layout->firstLargePageStart+layout->wholeLargePageSize*(page-numSmall);
+}
+
 static volatile struct SharedMemPageHeader *sharedMemPageLibHeader(struct SharedMemory *shared, uint32_t page)
 {
   volatile struct SharedMemPageHeader *ret=NULL;
   if(page<shared->data->info.numPages)
   {
-    ret=(volatile struct SharedMemPageHeader *)(((volatile uint8_t *)shared->data)+shared->data->layout.firstPageStart+shared->data->layout.wholePageSize*page+shared->data->layout.libPageHeaderOffset);
+    ret=(volatile struct SharedMemPageHeader *)(((volatile uint8_t *)shared->data)+sharedMemPageStart(shared, page)+shared->data->layout.libPageHeaderOffset);
     CLEAR_ERROR(shared);
   }
   else
@@ -113,7 +123,7 @@ volatile void *sharedMemPageHeader(struct SharedMemory *shared, uint32_t page)
   {
     if(page<shared->data->info.numPages)
     {
-      ret=((volatile uint8_t *)shared->data)+shared->data->layout.firstPageStart+shared->data->layout.wholePageSize*page+shared->data->layout.appPageHeaderOffset;
+      ret=((volatile uint8_t *)shared->data)+sharedMemPageStart(shared, page)+shared->data->layout.appPageHeaderOffset;
       CLEAR_ERROR(shared);
     }
     else
@@ -128,7 +138,7 @@ volatile void *sharedMemPageData(struct SharedMemory *shared, uint32_t page)
   {
     if(page<shared->data->info.numPages)
     {
-      ret=((volatile uint8_t *)shared->data)+shared->data->layout.firstPageStart+shared->data->layout.wholePageSize*page+shared->data->layout.dataOffset;
+      ret=((volatile uint8_t *)shared->data)+sharedMemPageStart(shared, page)+shared->data->layout.dataOffset;
       CLEAR_ERROR(shared);
     }
     else
@@ -136,20 +146,39 @@ volatile void *sharedMemPageData(struct SharedMemory *shared, uint32_t page)
   }
   return ret;
 }
+
+uint32_t sharedMemPageSize(struct SharedMemory *shared, uint32_t page)
+{
+  uint32_t ret=0;
+  if(sharedCheckValidOrInitializing(shared))
+  {
+    if(page>=shared->data->info.numPages)
+      SET_ERROR(shared, "Invalid page number");
+    else if(page<shared->data->info.numPages-shared->data->info.numLargePages)
+      ret=shared->data->info.pageSize;
+    else
+      ret=shared->data->info.largePageSize;
+  }
+  return ret;
+}
+
 static bool sharedCalculateLayout(const SharedMemInfo *info, struct SharedMemLayout *layout)
 {
   bool ret=false;
   if(layout)
     memset(layout, 0, sizeof(*layout));
-  if(info && layout && checkValueMultiple2(info->headerAlign) && checkValueMultiple2(info->pageHeaderAlign) && checkValueMultiple2(info->pageAlign))
+  if(info && layout && checkValueMultiple2(info->headerAlign) && checkValueMultiple2(info->pageHeaderAlign) && checkValueMultiple2(info->pageAlign) && info->numLargePages<=info->numPages)
   {
+    uint32_t pageAlign=maxUint32(alignOf(0), maxUint32(alignOf(info->pageHeaderAlign), alignOf(info->pageAlign)));
     layout->headerStart=upboundn(sizeof(struct SharedMemInternalHeader), info->headerAlign);
     layout->firstPageStart=upboundn(layout->headerStart+info->headerSize, 0);
     layout->libPageHeaderOffset=0;
     layout->appPageHeaderOffset=upboundn(layout->firstPageStart+sizeof(struct SharedMemPageHeader), info->pageHeaderAlign)-layout->firstPageStart;
     layout->dataOffset=upboundn(layout->firstPageStart+layout->appPageHeaderOffset+info->pageHeaderSize, info->pageAlign)-layout->firstPageStart;
-    layout->wholePageSize=upboundn(layout->firstPageStart+layout->dataOffset+info->pageSize,maxUint32(alignOf(0), maxUint32(alignOf(info->pageHeaderAlign), alignOf(info->pageAlign))));
-    layout->fullSize=layout->firstPageStart+layout->wholePageSize*info->numPages;
+    layout->wholePageSize=upboundn(layout->firstPageStart+layout->dataOffset+info->pageSize, pageAlign);
+    layout->firstLargePageStart=layout->firstPageStart+layout->wholePageSize*(info->numPages-info->numLargePages);
+    layout->wholeLargePageSize=upboundn(layout->dataOffset+info->largePageSize, pageAlign);
+    layout->fullSize=layout->firstLargePageStart+layout->wholeLargePageSize*info->numLargePages;
     ret=true;
   }
   return ret;
@@ -163,18 +192,41 @@ bool sharedMemCheckHeader(struct SharedMemory *shared)
   return ret;
 }
 
+static struct SharedMemory *sharedMemAllocate(uint32_t localSize)
+{
+  int baseSize=upboundn(sizeof(struct SharedMemory), 0);
+  struct SharedMemory *ret=malloc(baseSize+localSize);
+  if(ret)
+    memset(ret, 0, baseSize+localSize);
+  return ret;
+}
+
+static void sharedMemInitializeData(struct SharedMemory *shared, const SharedMemInfo *info, const struct SharedMemLayout *layout)
+{
+  shared->data->state=Unitialized; // Should already be zero, but for safety
+  shared->data->info=*info;
+  shared->data->layout=*layout;
+  shared->data->info.headerAlign=alignOf(shared->data->info.headerAlign);
+  shared->data->info.pageHeaderAlign=alignOf(shared->data->info.pageHeaderAlign);
+  shared->data->info.pageAlign=alignOf(shared->data->info.pageAlign);
+  uint8_t *pBuf=(uint8_t *)shared->data;
+  for(unsigned i=0;i<shared->data->info.numPages;i++)
+  {
+    struct SharedMemPageHeader *header=(struct SharedMemPageHeader *)(pBuf+sharedMemPageStart(shared, i)+layout->libPageHeaderOffset);
+    header->state=1; // Free to server
+  }
+  shared->data->version=SHAREDMEM_VERSION;
+  shared->data->magic=SHAREDMEM_MAGIC;
+}
+
 bool sharedMemCreate(const char *utf8Name, const SharedMemInfo *info, struct SharedMemory **shared, uint32_t localSize, bool server)
 {
   bool ret=false;
   if(shared)
   {
-    struct SharedMemory *sharedRet=NULL;
+    struct SharedMemory *sharedRet=sharedMemAllocate(localSize);
     struct SharedMemLayout layout;
-    int baseSize=upboundn(sizeof(struct SharedMemory), 0);
-    sharedRet=malloc(baseSize+localSize);
     *shared=sharedRet;
-    if(sharedRet)
-      memset(sharedRet, 0, baseSize+localSize);
     if(!sharedRet)
     {
     }
@@ -192,22 +244,7 @@ bool sharedMemCreate(const char *utf8Name, const SharedMemInfo *info, struct Sha
       {
         sharedRet->server=server;
         if(sharedRet->needInitialize)
-        {
-          sharedRet->data->state=Unitialized; // Should already be zero, but for safety
-          sharedRet->data->info=*info;
-          sharedRet->data->layout=layout;
-          sharedRet->data->info.headerAlign=alignOf(sharedRet->data->info.headerAlign);
-          sharedRet->data->info.pageHeaderAlign=alignOf(sharedRet->data->info.pageHeaderAlign);
-          sharedRet->data->info.pageAlign=alignOf(sharedRet->data->info.pageAlign);
-          uint8_t *pBuf=(uint8_t *)sharedRet->data;
-          for(unsigned i=0;i<sharedRet->data->info.numPages;i++)
-          {
-            struct SharedMemPageHeader *header=(struct SharedMemPageHeader *)(pBuf+layout.firstPageStart+i*layout.wholePageSize+layout.libPageHeaderOffset);
-            header->state=1; // Free to server
-          }
-          sharedRet->data->version=SHAREDMEM_VERSION;
-          sharedRet->data->magic=SHAREDMEM_MAGIC;
-        }
+          sharedMemInitializeData(sharedRet, info, &layout);
         ret=true;
       }
     }
@@ -215,6 +252,56 @@ bool sharedMemCreate(const char *utf8Name, const SharedMemInfo *info, struct Sha
   return ret;
 }
 
+#if defined(SHAREDMEM_LINUX)
+bool sharedMemCreateAnonymous(const SharedMemInfo *info, struct SharedMemory **shared, uint32_t localSize, bool server)
+{
+  bool ret=false;
+  if(shared)
+  {
+    struct SharedMemory *sharedRet=sharedMemAllocate(localSize);
+    struct SharedMemLayout layout;
+    *shared=sharedRet;
+    if(!sharedRet)
+    {
+    }
+    else if(!info)
+      SET_ERROR(sharedRet, "Info parameter NULL");
+    else if(!sharedCalculateLayout(info, &layout))
+      SET_ERROR(sharedRet, "Invalid layout info");
+    else if(sharedMemCreateAnonymousArch(sharedRet, layout.fullSize, server))
+    {
+      sharedMemInitializeData(sharedRet, info, &layout);
+      ret=true;
+    }
+  }
+  return ret;
+}
+
+bool sharedMemSendToSocket(struct SharedMemory *shared, int socketFd)
+{
+  bool ret=false;
+  if(sharedCheckValidOrInitializing(shared) && sharedMemSendArch(shared, socketFd))
+  {
+    CLEAR_ERROR(shared);
+    ret=true;
+  }
+  return ret;
+}
+
+bool sharedMemAttachFromSocket(int socketFd, struct SharedMemory **shared, uint32_t localSize)
+{
+  bool ret=false;
+  if(shared)
+  {
+    struct SharedMemory *sharedRet=sharedMemAllocate(localSize);
+    *shared=sharedRet;
+    if(sharedRet)
+      ret=sharedMemAttachArch(sharedRet, socketFd);
+  }
+  return ret;
+}
+#endif
+
 bool sharedMemDestroy(struct SharedMemory *shared)
 {
   bool ret=false;
@@ -232,6 +319,11 @@ bool sharedMemMustInitialize(struct SharedMemory *shared)
   return (shared && shared->needInitialize);
 }
 
+bool sharedMemIsServerSide(struct SharedMemory *shared)
+{
+  return (shared && shared->server);
+}
+
 const SharedMemInfo *sharedMemInfo(struct SharedMemory *shared)
 {
   const SharedMemInfo *ret=NULL;
@@ -257,7 +349,23 @@ bool sharedMemIsInitialized(struct SharedMemory *shared)
 
 bool sharedMemWaitNotify(struct SharedMemory *shared, uint32_t timeoutMs)
 {
-  return sharedMemArchWaitNotify(shared, timeoutMs);
+  bool ret;
+  SHAREDMEM_TRACE_EVENT(shared, SharedMemTraceWaitBegin, -1);
+  ret=sharedMemArchWaitNotify(shared, timeoutMs);
+  SHAREDMEM_TRACE_EVENT(shared, SharedMemTraceWaitEnd, -1);
+  return ret;
+}
+
+bool sharedMemNotify(struct SharedMemory *shared)
+{
+  bool ret=false;
+  if(sharedCheckInitialized(shared))
+  {
+    sharedMemArchNotify(shared);
+    CLEAR_ERROR(shared);
+    ret=true;
+  }
+  return ret;
 }
 
 int32_t sharedMemGetFreePage(struct SharedMemory *shared, int32_t start)
@@ -339,6 +447,7 @@ bool sharedMemFreePage(struct SharedMemory *shared, uint32_t page)
     else
     {
       sharedMemPageLibHeader(shared, page)->state=(shared->server?SharedMemPageFreeServer:SharedMemPageFreeClient);
+      SHAREDMEM_TRACE_EVENT(shared, SharedMemTraceFree, page);
       CLEAR_ERROR(shared);
       ret=true;
     }
@@ -357,6 +466,7 @@ bool sharedMemSendData(struct SharedMemory *shared, uint32_t page)
     else
     {
       sharedMemPageLibHeader(shared, page)->state=(shared->server?SharedMemPageDataClient:SharedMemPageDataServer);
+      SHAREDMEM_TRACE_EVENT(shared, SharedMemTraceSend, page);
       sharedMemArchNotify(shared);
       CLEAR_ERROR(shared);
       ret=true;
@@ -377,6 +487,7 @@ bool sharedMemSendFree(struct SharedMemory *shared, uint32_t page)
     else
     {
       sharedMemPageLibHeader(shared, page)->state=(shared->server?SharedMemPageFreeClient:SharedMemPageFreeServer);
+      SHAREDMEM_TRACE_EVENT(shared, SharedMemTraceFree, page);
       sharedMemArchNotify(shared);
       CLEAR_ERROR(shared);
       ret=true;
@@ -385,6 +496,26 @@ bool sharedMemSendFree(struct SharedMemory *shared, uint32_t page)
   return ret;
 }
 
+bool sharedMemSendFreeN(struct SharedMemory *shared, uint32_t page, uint32_t state)
+{
+  bool ret=false;
+  // No CLEAR_ERROR/SET_ERROR, the message belongs to the thread using the object
+  if(shared && shared->data && shared->data->state==SharedMemory_Initialized && page<shared->data->info.numPages)
+  {
+    volatile uint8_t *start=(volatile uint8_t *)shared->data+sharedMemPageStart(shared, page)+shared->data->layout.libPageHeaderOffset;
+    volatile uint32_t *pageState=(volatile uint32_t *)&((volatile struct SharedMemPageHeader *)start)->state;
+    int32_t from=shared->server?(int32_t)state:-(int32_t)state;
+    int32_t to=shared->server?SharedMemPageFreeClient:SharedMemPageFreeServer;
+    if(sharedMemAtomicCompareExchange32(pageState, (uint32_t)from, (uint32_t)to))
+    {
+      SHAREDMEM_TRACE_EVENT(shared, SharedMemTraceFree, page);
+      sharedMemArchNotify(shared);
+      ret=true;
+    }
+  }
+  return ret;
+}
+
 void *sharedMemLocal(struct SharedMemory *shared)
 {
   return (shared && shared->data)?(&((uint8_t *)shared)[upboundn(sizeof(struct SharedMemory), 0)]): NULL;
@@ -449,8 +580,19 @@ int32_t sharedMemGetFirstPageN(struct SharedMemory *shared, uint32_t state, int3
   return start;
 }
 
+uint64_t sharedMemTimestampUs(void)
+{
+  return sharedMemArchTimeNs()/1000;
+}
+
 const char *sharedMemGetError(struct SharedMemory *shared)
 {
   shared->message[sizeof(shared->message)-1]='\0';
   return shared->message;
 }
+
+void sharedMemSetError(struct SharedMemory *shared, const char *message)
+{
+  if(shared)
+    SET_ERROR(shared, "%s", message);
+}
@@ -22,7 +22,7 @@ extern "C"
 {
 #endif
 
-#define SHAREDMEM_VERSION 0x100
+#define SHAREDMEM_VERSION 0x101
 
 /**
  * @brief Shared memory layout
@@ -46,6 +46,10 @@ typedef struct
   uint32_t pageSize;
   /// @brief Number of pages
   uint32_t numPages;
+  /// @brief Size of large pages data
+  uint32_t largePageSize;
+  /// @brief Number of large pages, 0 for none. They are the last pages and are included in numPages
+  uint32_t numLargePages;
 } SharedMemInfo;
 
 /** @struct SharedMemory
@@ -86,6 +90,15 @@ bool sharedMemCreate(const char *utf8Name, const SharedMemInfo *info, struct Sha
  */
 const char *sharedMemGetError(struct SharedMemory *shared);
 
+/**
+ * @brief Sets current error message
+ *
+ * Used by the layers built on shared memory to report their own failures through sharedMemGetError.
+ * @param shared Shared memory
+ * @param message Error message, truncated to the size of the buffer
+ */
+void sharedMemSetError(struct SharedMemory *shared, const char *message);
+
 /**
  * @brief Deletes the shared memory
  *
@@ -121,6 +134,21 @@ bool sharedMemMustInitialize(struct SharedMemory *shared);
  */
 const SharedMemInfo *sharedMemInfo(struct SharedMemory *shared);
 
+/**
+ * @brief Returns the size of the data of a page
+ * @param shared Shared memory object
+ * @param page Number of page
+ * @return pageSize or largePageSize of info, 0 if page is not valid
+ */
+uint32_t sharedMemPageSize(struct SharedMemory *shared, uint32_t page);
+
+/**
+ * @brief Returns the side of the shared memory held by this process
+ * @param shared Shared memory object
+ * @return True for the "server" side
+ */
+bool sharedMemIsServerSide(struct SharedMemory *shared);
+
 /**
  * @brief Assigns a page as free page of the client
  *
@@ -162,6 +190,15 @@ bool sharedMemIsInitialized(struct SharedMemory *shared);
  */
 bool sharedMemWaitNotify(struct SharedMemory *shared, uint32_t timeoutMs);
 
+/**
+ * @brief Notifies the other process
+ *
+ * Page transitions notify automatically: this is needed only by protocols that exchange data outside page states.
+ * @param shared Shared memory
+ * @return True on success
+ */
+bool sharedMemNotify(struct SharedMemory *shared);
+
 /**
  * @brief Gets the number of pages (both free or data) owned by this process
  * @param shared Shared memory object
@@ -232,6 +269,18 @@ bool sharedMemSendData(struct SharedMemory *shared, uint32_t page);
  */
 bool sharedMemSendFree(struct SharedMemory *shared, uint32_t page);
 
+/**
+ * @brief Sends a page in state N to the other process as "free" page, can be called from any thread
+ *
+ * The page state is changed atomically and the error message is not touched, so the page can be given back
+ * by a thread other than the one using the object. Only one of concurrent calls for the same page succeeds.
+ * @param memory Shared Memory object
+ * @param page Page to send
+ * @param state State of the page as set by sharedMemSetPageN
+ * @return True on success, false if the page was not in state N
+ */
+bool sharedMemSendFreeN(struct SharedMemory *shared, uint32_t page, uint32_t state);
+
 /**
  * @brief Gets the data part of a page
  * @param memory Shared Memory object
@@ -248,10 +297,66 @@ volatile void *sharedMemPageData(struct SharedMemory *shared, uint32_t page);
  */
 volatile void *sharedMemPageHeader(struct SharedMemory *shared, uint32_t page);
 
+/**
+ * @brief Returns a monotonic timestamp
+ *
+ * The clock is common to all processes of the system, so timestamps taken by different processes can be compared.
+ * @return Time in microseconds
+ */
+uint64_t sharedMemTimestampUs(void);
+
 #if defined(SHAREDMEM_WIN32)
 void *sharedMemNotificationHandle(struct SharedMemory *memory);
 #endif
 
+#if defined(SHAREDMEM_LINUX)
+/**
+ * @brief Creates an anonymous shared memory object
+ *
+ * The memory is created with memfd_create and sealed against resizing, so it has no global name and disappears when the last user closes it.
+ * The returned object always needs initialization (sharedMemMustInitialize returns true), exactly as a newly created named object.
+ * The other process gets access to the object only through sharedMemSendToSocket/sharedMemAttachFromSocket.
+ * As with sharedMemCreate an object may be returned even on failure and should be destroyed with sharedMemDestroy.
+ * @param info Size and align of memory region allocated
+ * @param shared [out] Will be filled with a pointer to the allocated shared object
+ * @param localSize Size of the process area returned by sharedMemLocal
+ * @param server True if we are creating the "server" side of the shared memory
+ * @return True on success
+ */
+bool sharedMemCreateAnonymous(const SharedMemInfo *info, struct SharedMemory **shared, uint32_t localSize, bool server);
+
+/**
+ * @brief Passes an anonymous shared memory to the other process
+ *
+ * The memory descriptor and the two notification descriptors are sent with SCM_RIGHTS on an AF_UNIX socket.
+ * The call can be made before initialization is ended. The object must have been created with sharedMemCreateAnonymous.
+ * @param shared Shared memory
+ * @param socketFd Connected AF_UNIX socket
+ * @return True on success
+ */
+bool sharedMemSendToSocket(struct SharedMemory *shared, int socketFd);
+
+/**
+ * @brief Attaches to a shared memory passed by the other process with sharedMemSendToSocket
+ *
+ * The region is mapped with a single mmap, no name lookup or remap is needed. The attached side is the opposite of the sender's one.
+ * Blocks until a message is received on socket (unless socket is non-blocking).
+ * As with sharedMemCreate an object may be returned even on failure and should be destroyed with sharedMemDestroy.
+ * @param socketFd Connected AF_UNIX socket
+ * @param shared [out] Will be filled with a pointer to the attached shared object
+ * @param localSize Size of the process area returned by sharedMemLocal
+ * @return True on success
+ */
+bool sharedMemAttachFromSocket(int socketFd, struct SharedMemory **shared, uint32_t localSize);
+
+/**
+ * @brief Returns a descriptor that becomes readable when a notification is pending
+ *
+ * Can be used with poll/select or QSocketNotifier. sharedMemWaitNotify should be used to consume the notification.
+ */
+int sharedMemNotificationFd(struct SharedMemory *memory);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
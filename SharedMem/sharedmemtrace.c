@@ -0,0 +1,141 @@
+/*
+ * This file is part of SharedImageIPC.
+ *
+ * (c) Marzocchi Alessandro
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "sharedmemtrace.h"
+#include "internal/sharedmeminternal.h"
+#include "arch/sharedmematomic.h"
+#if defined(_MSC_VER)
+  #include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+  #include <x86intrin.h>
+#endif
+
+#if defined(SHAREDMEM_TRACE)
+typedef struct
+{
+  uint64_t sequence; // Index+1 of the event stored in slot, 0 while being written
+  uint64_t ticks;
+  uint32_t threadId;
+  int32_t page;
+  uint16_t event;
+  uint16_t server;
+} SharedMemTraceEntry;
+
+static SharedMemTraceEntry sharedMemTraceRing[SHAREDMEM_TRACE_SIZE];
+static volatile uint64_t sharedMemTraceHead;
+static volatile uint32_t sharedMemTraceEnabled;
+static uint64_t sharedMemTraceStartTicks, sharedMemTraceStartNs;
+
+static inline uint64_t sharedMemTraceTicks(void)
+{
+#if (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))) || defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return sharedMemArchTimeNs();
+#endif
+}
+
+static const char *sharedMemTraceName(uint16_t event)
+{
+  switch(event)
+  {
+    case SharedMemTraceAcquire: return "acquire";
+    case SharedMemTraceSend: return "send";
+    case SharedMemTraceReceive: return "receive";
+    case SharedMemTraceFree: return "free";
+    case SharedMemTraceWaitBegin:
+    case SharedMemTraceWaitEnd: return "wait";
+    default: return "unknown";
+  }
+}
+#endif
+
+bool sharedMemTraceEnable(bool enable)
+{
+#if defined(SHAREDMEM_TRACE)
+  if(enable && !sharedMemTraceEnabled)
+  {
+    sharedMemTraceStartNs=sharedMemArchTimeNs();
+    sharedMemTraceStartTicks=sharedMemTraceTicks();
+  }
+  sharedMemAtomicStore32(&sharedMemTraceEnabled, enable?1:0);
+  return true;
+#else
+  (void)enable;
+  return false;
+#endif
+}
+
+void sharedMemTraceRecord(const struct SharedMemory *shared, SharedMemTraceEvent event, int32_t page)
+{
+#if defined(SHAREDMEM_TRACE)
+  if(sharedMemTraceEnabled && shared)
+  {
+    uint64_t index=sharedMemAtomicAdd64(&sharedMemTraceHead, 1);
+    SharedMemTraceEntry *entry=&sharedMemTraceRing[index&(SHAREDMEM_TRACE_SIZE-1)];
+    sharedMemAtomicStore64(&entry->sequence, 0);
+    sharedMemAtomicFenceRelease(); // Readers see the slot as being written before any of the fields changes
+    entry->ticks=sharedMemTraceTicks();
+    entry->threadId=sharedMemArchThreadId();
+    entry->page=page;
+    entry->event=(uint16_t)event;
+    entry->server=shared->server;
+    sharedMemAtomicStore64(&entry->sequence, index+1);
+  }
+#else
+  (void)shared; (void)event; (void)page;
+#endif
+}
+
+void sharedMemTraceClear(void)
+{
+#if defined(SHAREDMEM_TRACE)
+  sharedMemAtomicStore64(&sharedMemTraceHead, 0);
+  memset(sharedMemTraceRing, 0, sizeof(sharedMemTraceRing));
+#endif
+}
+
+bool sharedMemTraceDump(const char *fileName)
+{
+  bool ret=false;
+#if defined(SHAREDMEM_TRACE)
+  FILE *file=fileName?fopen(fileName, "w"):NULL;
+  if(file)
+  {
+    uint64_t endNs=sharedMemArchTimeNs(), endTicks=sharedMemTraceTicks();
+    double ticksPerUs=(endNs>sharedMemTraceStartNs && endTicks>sharedMemTraceStartTicks)?(endTicks-sharedMemTraceStartTicks)*1000./(endNs-sharedMemTraceStartNs):1000.;
+    uint64_t head=sharedMemAtomicLoad64(&sharedMemTraceHead);
+    uint64_t first=(head>SHAREDMEM_TRACE_SIZE)?head-SHAREDMEM_TRACE_SIZE:0;
+    uint32_t pid=sharedMemArchProcessId();
+    fprintf(file, "{\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"args\":{\"name\":\"SharedMem %u\"}}", pid, pid);
+    for(uint64_t i=first;i<head;i++)
+    {
+      SharedMemTraceEntry *slot=&sharedMemTraceRing[i&(SHAREDMEM_TRACE_SIZE-1)];
+      uint64_t sequence=sharedMemAtomicLoad64(&slot->sequence);
+      SharedMemTraceEntry entry=*slot;
+      sharedMemAtomicFenceAcquire(); // The copy is complete before the sequence is checked again
+      if(sequence!=i+1 || sharedMemAtomicLoad64(&slot->sequence)!=i+1)
+        continue; // Overwritten or still being written
+      double ts=sharedMemTraceStartNs/1000.+((int64_t)(entry.ticks-sharedMemTraceStartTicks))/ticksPerUs;
+      const char *phase=(entry.event==SharedMemTraceWaitBegin)?"B":(entry.event==SharedMemTraceWaitEnd)?"E":"i";
+      fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":%u,\"tid\":%u%s,\"args\":{\"page\":%d}}",
+              sharedMemTraceName(entry.event), entry.server?"server":"client", phase, ts, pid, entry.threadId,
+              (phase[0]=='i')?",\"s\":\"t\"":"", entry.page);
+    }
+    fprintf(file, "\n],\"displayTimeUnit\":\"ns\"}\n");
+    ret=(fclose(file)==0);
+  }
+#else
+  (void)fileName;
+#endif
+  return ret;
+}
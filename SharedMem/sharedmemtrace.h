@@ -0,0 +1,86 @@
+/*
+ * This file is part of SharedImageIPC.
+ *
+ * (c) Marzocchi Alessandro
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+/**
+ * @file
+ * @brief Page transition tracing
+ *
+ * Records every page transition (acquire, send, receive, free, wait begin/end) of the current process in a lock-free ring buffer,
+ * timestamped with the CPU time stamp counter.
+ * Recording is compiled in only if SHAREDMEM_TRACE is defined (qmake CONFIG+=trace) and must be enabled at runtime with sharedMemTraceEnable.
+ * Collected events can be dumped as a Chrome trace JSON file, to be opened with chrome://tracing or ui.perfetto.dev.
+ * Timestamps are based on the system monotonic clock so dumps of producer and consumer can be merged and viewed side by side.
+ */
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/// @brief Number of events kept in the ring (oldest events are overwritten)
+#define SHAREDMEM_TRACE_SIZE 65536
+
+struct SharedMemory;
+
+/// @brief Type of a traced event
+typedef enum
+{
+  SharedMemTraceAcquire,  ///< A free page was taken for writing
+  SharedMemTraceSend,     ///< A page was sent as data to the other process
+  SharedMemTraceReceive,  ///< A data page was taken for reading
+  SharedMemTraceFree,     ///< A page was freed (locally or sent back to the other process)
+  SharedMemTraceWaitBegin,///< Start of a wait for a notification
+  SharedMemTraceWaitEnd   ///< End of a wait for a notification
+} SharedMemTraceEvent;
+
+/**
+ * @brief Enables or disables recording of events
+ *
+ * Enabling also stores the reference point used to convert time stamp counter values to microseconds.
+ * @param enable True to start recording
+ * @return True if tracing support is compiled in
+ */
+bool sharedMemTraceEnable(bool enable);
+
+/**
+ * @brief Records an event in the trace ring
+ *
+ * Safe to be called concurrently from any thread. Usually called through SHAREDMEM_TRACE_EVENT.
+ * @param shared Shared memory the event refers to
+ * @param event Type of event
+ * @param page Page involved in the transition, -1 if none
+ */
+void sharedMemTraceRecord(const struct SharedMemory *shared, SharedMemTraceEvent event, int32_t page);
+
+/**
+ * @brief Discards all recorded events
+ */
+void sharedMemTraceClear(void);
+
+/**
+ * @brief Writes the recorded events to a Chrome trace JSON file
+ *
+ * Should not be called while other threads are recording (events being written during the dump are skipped).
+ * @param fileName Name of file to be written
+ * @return True on success
+ */
+bool sharedMemTraceDump(const char *fileName);
+
+#if defined(SHAREDMEM_TRACE)
+  #define SHAREDMEM_TRACE_EVENT(shared, event, page) sharedMemTraceRecord((shared), (event), (page))
+#else
+  #define SHAREDMEM_TRACE_EVENT(shared, event, page) ((void)0)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -5,13 +5,24 @@ CONFIG -= app_bundle
 
 SOURCES += \
         main.cpp \
-        ..\SharedMem\sharedmem.c \
-        ..\SharedMem\arch\sharedmemwin.c
+        bridgeloopback.cpp \
+        ../SharedImage/sharedimage.c \
+        ../SharedImageBridge/sharedimagebridge.c \
+        ../SharedMem/sharedmem.c \
+        ../SharedMem/sharedmemtrace.c \
+        ../SharedMem/arch/sharedmemwin.c \
+        ../SharedMem/arch/sharedmemlinux.c
 
 win32:DEFINES += SHAREDMEM_WIN32
+linux:DEFINES += SHAREDMEM_LINUX
+trace:DEFINES += SHAREDMEM_TRACE
+win32:LIBS += -lws2_32
+unix:LIBS += -lpthread
 
 #win32:CONFIG(release, debug|release): LIBS += -L$$OUT_PWD/../SharedMem/release/ -lSharedMem
 #else:win32:CONFIG(debug, debug|release): LIBS += -L$$OUT_PWD/../SharedMem/debug/ -lSharedMem
 #else:unix: LIBS += -L$$OUT_PWD/../SharedMem/ -lSharedMem
 
 INCLUDEPATH += $$PWD/../SharedMem
+INCLUDEPATH += $$PWD/../SharedImage
+INCLUDEPATH += $$PWD/../SharedImageBridge
@@ -0,0 +1,117 @@
+/*
+ * This file is part of SharedImageIPC.
+ *
+ * (c) Marzocchi Alessandro
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#include "sharedimage.h"
+#include "sharedimagebridge.h"
+#include <stdio.h>
+#include <string.h>
+#if defined(SHAREDMEM_LINUX)
+  #include <unistd.h>
+  #include <sys/socket.h>
+#endif
+
+#define LOOPBACK_FRAMES 200
+#define LOOPBACK_WIDTH 320
+#define LOOPBACK_HEIGHT 240
+#define LOOPBACK_TIMEOUT_US 20000000ull
+#define LOOPBACK_SKIPPED 5 // Frames consumed locally before the bridge starts, so source and sink sequences differ
+
+// Creates both sides of a channel in this process
+static bool loopbackChannel(const char *name, const SharedImageConfig *config, SharedImage **generator, SharedImage **consumer)
+{
+#if defined(SHAREDMEM_LINUX) // Named shared memory is not supported, the consumer attaches through a socket pair
+  bool ret=false;
+  int sockets[2];
+  (void)name;
+  if(sharedImageCreateAnonymousConfig(config, generator, true) && socketpair(AF_UNIX, SOCK_STREAM, 0, sockets)==0)
+  {
+    ret=sharedImageSendToSocket(*generator, sockets[0]) && sharedImageAttachFromSocket(sockets[1], consumer);
+    close(sockets[0]);
+    close(sockets[1]);
+  }
+  return ret;
+#else
+  return sharedImageCreateConfig(name, config, generator, true) && sharedImageCreateConfig(name, config, consumer, false);
+#endif
+}
+
+// Forwards frames from a source channel to a sink channel through a bridge on 127.0.0.1,
+// checking pixels, sequence and timestamp of every frame. Returns 0 on success
+int bridgeLoopback()
+{
+  int ret=1;
+  SharedImageConfig config;
+  memset(&config, 0, sizeof(config));
+  config.numBytes=LOOPBACK_WIDTH*LOOPBACK_HEIGHT*4;
+  config.numBuffers=4;
+  config.mode=SharedImageModeFifo; // No frame is dropped, so each one can be checked
+  SharedImage *source=nullptr, *sourceConsumer=nullptr, *sink=nullptr, *sinkConsumer=nullptr;
+  SharedImageBridge *receiver=nullptr, *sender=nullptr;
+  if(!loopbackChannel("BridgeLoopbackSource", &config, &source, &sourceConsumer) || !loopbackChannel("BridgeLoopbackSink", &config, &sink, &sinkConsumer))
+    printf("Cannot create shared images\n");
+  else if(!sharedImageBridgeCreateReceiver(sink, "127.0.0.1", 0, nullptr, &receiver))
+    printf("Cannot create receiver: %s\n", receiver?sharedImageBridgeGetError(receiver):"out of memory");
+  else if(!sharedImageBridgeCreateSender(sourceConsumer, "127.0.0.1", sharedImageBridgePort(receiver), nullptr, &sender))
+    printf("Cannot create sender: %s\n", sender?sharedImageBridgeGetError(sender):"out of memory");
+  else
+  {
+    static uint64_t sendUs[LOOPBACK_FRAMES][2]; // Time before and after the send of each frame on the source
+    uint64_t start=sharedImageTimestampUs();
+    uint32_t sent=0, received=0, errors=0;
+    bool ok=true;
+    for(uint32_t i=0;i<LOOPBACK_SKIPPED;i++)
+    {
+      void *data;
+      uint32_t availableBytes;
+      const SharedImageSetting *setting;
+      SharedImageSetting frame={LOOPBACK_WIDTH, LOOPBACK_HEIGHT, LOOPBACK_WIDTH*4, SharedImageFormatBGRA};
+      ok=ok && sharedImageOutBufferBytes(source, &data, &availableBytes) && sharedImageSend(source, &frame) && sharedImageReceive(sourceConsumer, &data, &setting);
+    }
+    while(ok && received<LOOPBACK_FRAMES && sharedImageTimestampUs()-start<LOOPBACK_TIMEOUT_US)
+    {
+      void *data;
+      uint32_t availableBytes;
+      const SharedImageSetting *setting;
+      if(sent<LOOPBACK_FRAMES && sharedImageOutBufferBytes(source, &data, &availableBytes))
+      {
+        SharedImageSetting frame={LOOPBACK_WIDTH, LOOPBACK_HEIGHT, LOOPBACK_WIDTH*4, SharedImageFormatBGRA};
+        memset(data, (int)(sent&255), LOOPBACK_WIDTH*LOOPBACK_HEIGHT*4);
+        sendUs[sent][0]=sharedImageTimestampUs();
+        if(sharedImageSend(source, &frame))
+          sendUs[sent++][1]=sharedImageTimestampUs();
+      }
+      ok=sharedImageBridgeProcess(sender, 1) && sharedImageBridgeProcess(receiver, 1);
+      while(sharedImageReceive(sinkConsumer, &data, &setting))
+      {
+        const SharedImageFrameInfo *info=sharedImageFrameInfo(sinkConsumer);
+        const uint8_t *pixels=(const uint8_t *)data;
+        // Sequence and timestamp are the ones of the source frame, not of the send on the sink
+        bool frameOk=(setting->width==LOOPBACK_WIDTH && setting->height==LOOPBACK_HEIGHT && info && info->sequence==LOOPBACK_SKIPPED+received);
+        frameOk=frameOk && received<sent && info->timestampUs>=sendUs[received][0] && info->timestampUs<=sendUs[received][1];
+        for(uint32_t i=0;frameOk && i<LOOPBACK_WIDTH*LOOPBACK_HEIGHT*4;i++)
+          frameOk=(pixels[i]==(uint8_t)(received&255));
+        if(!frameOk)
+          errors++;
+        received++;
+      }
+    }
+    if(!ok)
+      printf("Bridge failed: %s%s\n", sharedImageBridgeGetError(sender), sharedImageBridgeGetError(receiver));
+    printf("Bridge loopback: sent %u received %u errors %u\n", sent, received, errors);
+    if(ok && received==LOOPBACK_FRAMES && !errors)
+      ret=0;
+  }
+  sharedImageBridgeDestroy(sender);
+  sharedImageBridgeDestroy(receiver);
+  sharedImageDestroy(sinkConsumer);
+  sharedImageDestroy(sink);
+  sharedImageDestroy(sourceConsumer);
+  sharedImageDestroy(source);
+  return ret;
+}
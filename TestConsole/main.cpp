@@ -11,10 +11,14 @@
 #include "sharedmem.h"
 #include <QThread>
 #include <QDebug>
-#include "windows.h"
+#if defined(SHAREDMEM_WIN32)
+  #include "windows.h"
+#endif
 #include <QTime>
 #include <QCoreApplication>
+#include <string.h>
 void thread(bool server);
+int bridgeLoopback();
 
 void delay( int ms )
 {
@@ -27,6 +31,8 @@ void delay( int ms )
 
 int main(int argc, char *argv[])
 {
+  if(argc>1 && strcmp(argv[1], "bridge")==0) // End-to-end check of the network bridge
+    return bridgeLoopback();
   auto t1=QThread::create(thread, 0);
   auto t2=QThread::create(thread, 1);
   t2->start();
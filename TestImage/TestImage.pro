@@ -6,8 +6,12 @@ CONFIG += c++11
 
 SOURCES += \
     ..\SharedMem\sharedmem.c \
+    ..\SharedMem\sharedmemtrace.c \
     ..\SharedMem\arch\sharedmemwin.c \
+    ..\SharedMem\arch\sharedmemlinux.c \
     ..\SharedImage\sharedimage.c \
+    ..\SharedImage\sharedimageconvert.c \
+    ..\SharedImage\internal\sharedimageparallel.c \
     hfsharedimage.cpp \
     imagecanvas.cpp \
     imageprovider.cpp \
@@ -18,9 +22,13 @@ SOURCES += \
 
 HEADERS += \
     ..\SharedMem\sharedmem.h \
+    ..\SharedMem\sharedmemtrace.h \
+    ..\SharedMem\arch\sharedmematomic.h \
     ..\SharedMem\arch\sharedmemarch.h \
     ..\SharedMem\internal\sharedmeminternal.h \
     ..\SharedImage\sharedimage.h \
+    ..\SharedImage\sharedimageconvert.h \
+    ..\SharedImage\internal\sharedimageparallel.h \
     hfsharedimage.h \
     imagecanvas.h \
     imageprovider.h \
@@ -34,6 +42,8 @@ FORMS += \
     mainwindow.ui
 
 win32:DEFINES += SHAREDMEM_WIN32
+linux:DEFINES += SHAREDMEM_LINUX
+trace:DEFINES += SHAREDMEM_TRACE
 
 #win32:CONFIG(release, debug|release): LIBS += -L$$OUT_PWD/../SharedImage/release/ -lSharedImage
 #else:win32:CONFIG(debug, debug|release): LIBS += -L$$OUT_PWD/../SharedImage/debug/ -lSharedImage
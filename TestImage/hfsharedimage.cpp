@@ -9,12 +9,13 @@
 
 #include "hfsharedimage.h"
 #include "sharedimage.h"
+#include "sharedimageconvert.h"
 #include <QDateTime>
 #include <QWinEventNotifier>
 #include <QImage>
 #include <QDebug>
 HFSharedImage::HFSharedImage(bool provider, QObject *parent)
-  : QObject{parent}, m_image(nullptr), m_wantedPixels(3000*2000), m_provider(provider), m_notifyHandle(nullptr)
+  : QObject{parent}, m_image(nullptr), m_wantedPixels(3000*2000), m_pyramidLevels(0), m_provider(provider), m_notifyHandle(nullptr)
 {
   m_startTime=m_lastTime=-1;
   m_numFrames=0;
@@ -54,13 +55,19 @@ void HFSharedImage::setWantedPixels(quint32 newWantedPixels)
   m_wantedPixels = newWantedPixels;
 }
 
-bool HFSharedImage::sendImageStart()
+bool HFSharedImage::sendImageStart(bool delta)
 {
   bool ret=false;
   clearSend();
   if(m_image)
   {
-    ret=sharedImageOutBuffer(m_image, &m_sendImageData, &m_sendImagePixels);
+    if(delta) // Buffer holds the previous frame
+    {
+      ret=sharedImageOutBufferDelta(m_image, &m_sendImageData, &m_sendImagePixels);
+      m_sendImagePixels/=sizeof(quint32);
+    }
+    else
+      ret=sharedImageOutBuffer(m_image, &m_sendImageData, &m_sendImagePixels);
     if(ret)
       frame();
   }
@@ -80,25 +87,29 @@ QImage HFSharedImage::sendImage(quint32 width, quint32 height)
     m_sendWidth=width;
     m_sendHeight=height;
     m_sendBytesPerLine=width*sizeof(quint32);
+    m_sendFormat=SharedImageFormatBGRA;
     ret=QImage((uchar *)m_sendImageData, width, height, m_sendBytesPerLine, QImage::Format_ARGB32);
   }
   return ret;
 }
 
-void *HFSharedImage::sendImageBuffer(quint32 width, quint32 height, quint32 bytesPerLine)
+void *HFSharedImage::sendImageBuffer(quint32 width, quint32 height, quint32 bytesPerLine, quint32 format)
 {
   void *ret=nullptr;
-  if(m_sendImageData && width && height && (!m_sendWidth || m_sendWidth==width) && (!m_sendHeight || m_sendHeight==height) && (!m_sendBytesPerLine || m_sendBytesPerLine==bytesPerLine) && bytesPerLine*height<=m_sendImagePixels*sizeof(quint32) && bytesPerLine>=width*sizeof(quint32))
+  SharedImageSetting setting={width, height, bytesPerLine, format};
+  quint64 bytes=sharedImageFrameBytes(&setting);
+  if(m_sendImageData && width && height && (!m_sendWidth || m_sendWidth==width) && (!m_sendHeight || m_sendHeight==height) && (!m_sendBytesPerLine || m_sendBytesPerLine==bytesPerLine) && bytes && bytes<=m_sendImagePixels*sizeof(quint32))
   {
     m_sendWidth=width;
     m_sendHeight=height;
     m_sendBytesPerLine=bytesPerLine;
+    m_sendFormat=format;
     ret=m_sendImageData;
   }
   return ret;
 }
 
-bool HFSharedImage::sendEnd()
+bool HFSharedImage::sendEnd(const QVector<QRect> &dirty)
 {
   bool ret=false;
   if(m_image)
@@ -107,14 +118,67 @@ bool HFSharedImage::sendEnd()
     setting.width=m_sendWidth;
     setting.height=m_sendHeight;
     setting.bytesPerLine=m_sendBytesPerLine;
-    ret=sharedImageSend(m_image, &setting);
+    setting.format=m_sendFormat;
+    QVector<SharedImageRect> rects;
+    for(const auto &rect: dirty)
+      rects.append(SharedImageRect{quint32(rect.x()), quint32(rect.y()), quint32(rect.width()), quint32(rect.height())});
+    if(m_pyramidLevels) // Downscaled levels follow the image in the buffer
+    {
+      SharedImagePlane levels[SHAREDIMAGE_MAX_PLANES];
+      levels[0].setting=setting;
+      levels[0].offset=0;
+      quint32 numLevels=sharedImageBuildPyramid(m_sendImageData, m_sendImagePixels*sizeof(quint32), levels, qMin<quint32>(m_pyramidLevels+1, SHAREDIMAGE_MAX_PLANES));
+      ret=sharedImageSendPyramid(m_image, levels, numLevels, rects.constData(), quint32(rects.size()));
+    }
+    else
+      ret=sharedImageSendDirty(m_image, &setting, rects.constData(), quint32(rects.size()));
   }
-  m_sendWidth=m_sendHeight=m_sendBytesPerLine=m_sendImagePixels=0;
+  m_sendWidth=m_sendHeight=m_sendBytesPerLine=m_sendImagePixels=m_sendFormat=0;
   m_sendImageData=nullptr;
   return ret;
 }
 
-bool HFSharedImage::receiveImage(QImage &buffer)
+void HFSharedImage::setPyramidLevels(quint32 levels)
+{
+  m_pyramidLevels=levels;
+}
+
+bool HFSharedImage::requestFrame(quint32 maxAgeMs)
+{
+  return m_image && sharedImageRequestFrame(m_image, (quint64)maxAgeMs*1000);
+}
+
+bool HFSharedImage::frameRequested()
+{
+  return m_image && sharedImageFrameRequested(m_image);
+}
+
+quint32 HFSharedImage::numConsumers()
+{
+  return m_image?sharedImageNumConsumers(m_image):0;
+}
+
+bool HFSharedImage::setPreferredSize(const QSize &size, quint32 frameIntervalMs)
+{
+  SharedImagePreference preference={quint32(qMax(size.width(), 0)), quint32(qMax(size.height(), 0)), SHAREDIMAGE_ANY_FORMAT, frameIntervalMs*1000};
+  return m_image && sharedImageSetPreference(m_image, &preference);
+}
+
+QSize HFSharedImage::preferredSize()
+{
+  SharedImagePreference preference;
+  QSize ret;
+  if(m_image && sharedImageGetPreference(m_image, &preference) && preference.width && preference.height)
+    ret=QSize(int(preference.width), int(preference.height));
+  return ret;
+}
+
+bool HFSharedImage::preferenceChanged()
+{
+  return m_image && sharedImagePreferenceChanged(m_image);
+}
+
+bool HFSharedImage::receiveImage(QImage &buffer, const QSize &viewSize)
 {
   bool ret=false;
   if(m_image)
@@ -122,10 +186,56 @@ bool HFSharedImage::receiveImage(QImage &buffer)
     void *data;
     const SharedImageSetting *setting;
     ret=sharedImageReceive(m_image, &data, &setting);
+    if(ret && !viewSize.isEmpty()) // Smallest level still bigger than the image shown in a view of viewSize
+    {
+      double scale=qMin(viewSize.width()*1./setting->width, viewSize.height()*1./setting->height);
+      const SharedImageSetting *levelSetting;
+      for(quint32 level=1;level<sharedImageNumLevels(m_image);level++)
+      {
+        const void *levelData=sharedImageLevel(m_image, level, &levelSetting);
+        if(levelSetting->width<setting->width*scale || levelSetting->height<setting->height*scale)
+          break;
+        data=const_cast<void *>(levelData);
+        setting=levelSetting;
+      }
+    }
     if(ret)
     {
-      frame();
-      buffer=QImage((const uchar *)data, setting->width, setting->height, setting->bytesPerLine, QImage::Format_ARGB32);
+      QImage::Format format;
+      bool convert=false;
+      switch(setting->format)
+      {
+        case SharedImageFormatBGRA: format=QImage::Format_ARGB32; break;
+        case SharedImageFormatGray8: format=QImage::Format_Grayscale8; break;
+        case SharedImageFormatGray16: format=QImage::Format_Grayscale16; break;
+        case SharedImageFormatRGB24: format=QImage::Format_RGB888; break;
+        case SharedImageFormatBGR24: format=QImage::Format_BGR888; break;
+        case SharedImageFormatRGBA: format=QImage::Format_RGBA8888; break;
+        case SharedImageFormatRGBA16F: format=QImage::Format_RGBA16FPx4; break;
+        case SharedImageFormatRGBA32F: format=QImage::Format_RGBA32FPx4; break;
+        case SharedImageFormatYUYV:
+        case SharedImageFormatNV12:
+        case SharedImageFormatI420: format=QImage::Format_ARGB32; convert=true; break;
+        default: format=QImage::Format_Invalid; break;
+      }
+      ret=(format!=QImage::Format_Invalid);
+      if(ret && convert)
+      {
+        if(m_convertImage.width()!=(int)setting->width || m_convertImage.height()!=(int)setting->height)
+          m_convertImage=QImage(setting->width, setting->height, QImage::Format_ARGB32);
+        SharedImageSetting converted={setting->width, setting->height, (quint32)m_convertImage.bytesPerLine(), SharedImageFormatBGRA};
+        ret=sharedImageConvert(data, setting, m_convertImage.bits(), &converted);
+        if(ret)
+        {
+          frame();
+          buffer=m_convertImage;
+        }
+      }
+      else if(ret)
+      {
+        frame();
+        buffer=QImage((const uchar *)data, setting->width, setting->height, setting->bytesPerLine, format);
+      }
     }
   }
   return ret;
@@ -190,7 +300,7 @@ void HFSharedImage::clearNotifyHandle()
 void HFSharedImage::clearSend()
 {
   m_sendImageData=nullptr;
-  m_sendImagePixels=m_sendWidth=m_sendHeight=m_sendBytesPerLine=0;
+  m_sendImagePixels=m_sendWidth=m_sendHeight=m_sendBytesPerLine=m_sendFormat=0;
 }
 
 void HFSharedImage::frame()
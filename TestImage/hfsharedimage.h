@@ -10,6 +10,9 @@
 #pragma once
 
 #include <QObject>
+#include <QImage>
+#include <QRect>
+#include <QVector>
 
 struct SharedImage;
 
@@ -22,12 +25,19 @@ public:
   bool open(const QString &id);
   quint32 wantedPixels() const;
   void setWantedPixels(quint32 newWantedPixels);
-  bool sendImageStart();
+  bool sendImageStart(bool delta=false);
   quint32 sendImageNumPixels();
   QImage sendImage(quint32 width, quint32 height);
-  void *sendImageBuffer(quint32 width, quint32 height, quint32 bytesPerLine);
-  bool sendEnd();
-  bool receiveImage(QImage &buffer);
+  void *sendImageBuffer(quint32 width, quint32 height, quint32 bytesPerLine, quint32 format=0);
+  bool sendEnd(const QVector<QRect> &dirty=QVector<QRect>());
+  void setPyramidLevels(quint32 levels);
+  bool requestFrame(quint32 maxAgeMs=0);
+  bool frameRequested();
+  quint32 numConsumers();
+  bool setPreferredSize(const QSize &size, quint32 frameIntervalMs=0);
+  QSize preferredSize();
+  bool preferenceChanged();
+  bool receiveImage(QImage &buffer, const QSize &viewSize=QSize());
   void debug();
   double fps();
 signals:
@@ -44,6 +54,9 @@ protected:
   quint32 m_sendWidth;
   quint32 m_sendHeight;
   quint32 m_sendBytesPerLine;
+  quint32 m_sendFormat;
+  QImage m_convertImage; // Received frames in formats QImage cannot show
+  quint32 m_pyramidLevels; // Levels sent with each frame, 0 for none
 
   qint64 m_startTime;
   qint64 m_lastTime;
@@ -30,6 +30,7 @@ void ImageCanvas::setSize(int width, int height)
   resize(wWidth, wHeight);
   m_size = QSize(width, height);
   m_image=m_image.scaled(width, height);
+  m_dirty=QRect(0, 0, width, height);
 }
 
 int ImageCanvas::zoom() const
@@ -47,6 +48,13 @@ const QImage &ImageCanvas::image() const
   return m_image;
 }
 
+QRegion ImageCanvas::takeDirty()
+{
+  QRegion ret=m_dirty&m_image.rect();
+  m_dirty=QRegion();
+  return ret;
+}
+
 
 void ImageCanvas::paintEvent(QPaintEvent *)
 {
@@ -68,6 +76,7 @@ void ImageCanvas::mousePressEvent(QMouseEvent *event)
     QPainter paint(&m_image);
     paint.setPen(QPen(Qt::black, 5));
     paint.drawPoint(m_lastPoint);
+    m_dirty+=QRect(m_lastPoint, QSize(1, 1)).adjusted(-3, -3, 3, 3);
     update();
   }
 }
@@ -80,6 +89,7 @@ void ImageCanvas::mouseMoveEvent(QMouseEvent *event)
     QPainter paint(&m_image);
     paint.setPen(QPen(Qt::black, 5));
     paint.drawLine(m_lastPoint, p);
+    m_dirty+=QRect(m_lastPoint, p).normalized().adjusted(-3, -3, 3, 3);
     m_lastPoint=p;
     update();
   }
@@ -11,6 +11,7 @@
 #define IMAGECANVAS_H
 
 #include <QWidget>
+#include <QRegion>
 
 class ImageCanvas : public QWidget
 {
@@ -25,12 +26,15 @@ public:
 
   const QImage &image() const;
   QImage &imageData() { return m_image; }
+  void addDirty(const QRect &rect) { m_dirty+=rect; }
+  QRegion takeDirty();
 
 protected:
   QImage m_image;
   QSize m_size;
   int m_zoom;
   QPoint m_lastPoint;
+  QRegion m_dirty; // Changed since last takeDirty
 signals:
 
   // QWidget interface
@@ -12,6 +12,8 @@
 #include <QDateTime>
 #include <QVariant>
 #include "hfsharedimage.h"
+#include "sharedimage.h"
+#include "sharedimageconvert.h"
 #include <QPainter>
 ImageProvider::ImageProvider(QWidget *parent) :
   QWidget(parent),
@@ -56,6 +58,8 @@ void ImageProvider::connect(bool connectValue)
     else
     {
       m_image=new HFSharedImage(true);
+      m_sentSize=QSize();
+      m_image->setPyramidLevels(3); // Viewers smaller than the image read a downscaled copy
       connected=m_image->open(ui->id->text().toUtf8());
       if(connected)
       {
@@ -188,7 +192,7 @@ void ImageProvider::on_connect_clicked(bool checked)
 
 void ImageProvider::onImageNotify()
 {
-  if(ui->eventDriven->isChecked())
+  if(ui->eventDriven->isChecked() && m_image && (m_image->frameRequested() || m_image->preferenceChanged())) // Renders only frames asked by the viewer
     trySendImage();
 }
 
@@ -196,12 +200,14 @@ void ImageProvider::onImageNotify()
 
 void ImageProvider::timerEvent(QTimerEvent *)
 {
-  if(!ui->eventDriven->isChecked())
+  if(!ui->eventDriven->isChecked() && m_image && m_image->numConsumers()) // Idles while no viewer is attached
     trySendImage();
   if(m_image)
   {
     double fps=m_image?m_image->fps():qQNaN();
-    if(qIsNaN(fps))
+    if(!m_image->numConsumers())
+      ui->message->setText(tr("No viewer"));
+    else if(qIsNaN(fps))
       ui->message->clear();
     else
       ui->message->setText(tr("%1 fps").arg(fps, 0, 'f', 1));
@@ -210,11 +216,33 @@ void ImageProvider::timerEvent(QTimerEvent *)
 
 void ImageProvider::trySendImage()
 {
-  if(m_image && m_image->sendImageStart())
+  if(m_image && m_image->sendImageStart(true))
   {
     uint32_t numPixels=m_image->sendImageNumPixels();
 
-    auto &img=ui->provider->image();
+    auto &source=ui->provider->image();
+    if(ui->dynamic->isChecked())
+    {
+      QPainter p(&ui->provider->imageData());
+      double pos=(QDateTime::currentMSecsSinceEpoch()%1000)/1000.;
+      auto vat=[pos](double p){return qAbs(1-fmod((2+p-pos)*2., 2.));};
+      auto colat=[vat](double p){double v=vat(p); return QColor(v*255, 0, 255-255*v);};
+      QLinearGradient linearGrad(QPointF(0, 0), QPointF(source.width(), 0));
+      linearGrad.setColorAt(0, colat(0));
+      linearGrad.setColorAt(pos, colat(pos));
+      linearGrad.setColorAt(fmod(pos+0.5, 1), colat(pos+0.5));
+      linearGrad.setColorAt(1, colat(1));
+      p.setBrush(linearGrad);
+      p.drawRect(0,0, source.width(), 50);
+      p.end();
+      ui->provider->addDirty(QRect(0, 0, source.width(), 51));
+      ui->provider->update();
+    }
+    QImage scaled; // A viewer smaller than the image asked for fewer pixels
+    QSize wanted=m_image->preferredSize();
+    if(wanted.isValid() && (wanted.width()<source.width() || wanted.height()<source.height()))
+      scaled=source.scaled(wanted, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    auto &img=scaled.isNull()?source:scaled;
     auto bytes=img.bytesPerLine()*img.height();
     if(bytes<=numPixels*sizeof(uint32_t))
     {
@@ -225,24 +253,24 @@ void ImageProvider::trySendImage()
         buffer=m_image->sendImageBuffer(img.width(), img.height(), img.bytesPerLine());
         qDebug()<<"BUG!"<<buffer;
       }
-      if(ui->dynamic->isChecked())
+      // The buffer holds the previous frame: only changed regions are copied
+      QVector<QRect> dirty;
+      for(const auto &rect: ui->provider->takeDirty())
+        dirty.append(rect);
+      if(dirty.size()>SHAREDIMAGE_MAX_DIRTY_RECTS || !scaled.isNull() || img.size()!=m_sentSize)
+        dirty={img.rect()};
+      m_sentSize=img.size();
+      for(const auto &rect: dirty)
       {
-        QPainter p(&ui->provider->imageData());
-        double pos=(QDateTime::currentMSecsSinceEpoch()%1000)/1000.;
-        auto vat=[pos](double p){return qAbs(1-fmod((2+p-pos)*2., 2.));};
-        auto colat=[vat](double p){double v=vat(p); return QColor(v*255, 0, 255-255*v);};
-        QLinearGradient linearGrad(QPointF(0, 0), QPointF(img.width(), 0));
-        linearGrad.setColorAt(0, colat(0));
-        linearGrad.setColorAt(pos, colat(pos));
-        linearGrad.setColorAt(fmod(pos+0.5, 1), colat(pos+0.5));
-        linearGrad.setColorAt(1, colat(1));
-        p.setBrush(linearGrad);
-        p.drawRect(0,0, img.width(), 50);
-        p.end();
-        ui->provider->update();
+        if(rect==img.rect()) // Same bytesPerLine, a single streaming copy
+          sharedImageCopy(buffer, img.constBits(), img.sizeInBytes());
+        else
+        {
+          for(int y=rect.top();y<=rect.bottom();y++)
+            memcpy((uchar *)buffer+y*img.bytesPerLine()+rect.x()*sizeof(quint32), img.constScanLine(y)+rect.x()*sizeof(quint32), rect.width()*sizeof(quint32));
+        }
       }
-      memcpy(buffer, img.bits(), bytes);
-      m_image->sendEnd();
+      m_image->sendEnd(dirty);
     }
   }
 }
@@ -257,6 +285,7 @@ void ImageProvider::on_eventDriven_clicked(bool checked)
 void ImageProvider::on_clear_clicked()
 {
   ui->provider->imageData().fill(Qt::transparent);
+  ui->provider->addDirty(ui->provider->image().rect());
   ui->provider->update();
 }
 
@@ -43,6 +43,7 @@ private slots:
 private:
   void changedResSpin();
   bool m_changingRes;
+  QSize m_sentSize; // Size of the last frame, the next one is copied whole when it changes
   Ui::ImageProvider *ui;
 protected:
   HFSharedImage *m_image;
@@ -47,6 +47,7 @@ void ImageViewer::connect(bool connect)
       else
       {
         QObject::connect(m_image, &HFSharedImage::notify, this, &ImageViewer::onImageNotify);
+        m_preferredSize=QSize();
         ui->message->clear();
       }
       connected=result;
@@ -91,6 +92,9 @@ void ImageViewer::timerEvent(QTimerEvent *)
     tryReceive();
   if(m_image)
   {
+    m_image->requestFrame(25); // Pulls frames from event driven providers, at most one per tick
+    if(ui->view->size()!=m_preferredSize && m_image->setPreferredSize(ui->view->size(), 25))
+      m_preferredSize=ui->view->size();
     double fps=m_image?m_image->fps():qQNaN();
     if(qIsNaN(fps))
       ui->message->clear();
@@ -114,7 +118,7 @@ void ImageViewer::onImageNotify()
 void ImageViewer::tryReceive()
 {
   QImage buffer;
-  if(m_image && m_image->receiveImage(buffer))
+  if(m_image && m_image->receiveImage(buffer, ui->view->size()))
   {
     ui->view->setImage(buffer);
     ui->view->update();
@@ -29,6 +29,7 @@ private:
   Ui::ImageViewer *ui;
 protected:
   HFSharedImage *m_image;
+  QSize m_preferredSize; // Size published to the provider
 private slots:
   void on_connect_clicked(bool checked);
 